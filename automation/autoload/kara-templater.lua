@@ -36,7 +36,7 @@ local tr = aegisub.gettext
 script_name = tr"Karaoke Templater"
 script_description = tr"Macro and export filter to apply karaoke effects using the template language"
 script_author = "Niels Martin Hansen"
-script_version = "2.1.7"
+script_version = "2.2.0"
 
 
 include("karaskel.lua")
@@ -102,6 +102,8 @@ function parse_code(meta, styles, line, templates, mods)
 			template.style = nil
 		elseif m == "noblank" then
 			template.noblank = true
+		elseif m == "parallel" then
+			templates.parallel = true
 		elseif m == "repeat" or m == "loop" then
 			local times, t = string.headtail(rest)
 			template.loops = tonumber(times)
@@ -125,7 +127,7 @@ end
 -- List of reserved words that can't be used as "line" template identifiers
 template_modifiers = {
 	"pre-line", "line", "syl", "furi", "char", "all", "repeat", "loop",
-	"notext", "keeptags", "noblank", "multi", "fx", "fxgroup"
+	"notext", "keeptags", "noblank", "multi", "fx", "fxgroup", "parallel"
 }
 
 function parse_template(meta, styles, line, templates, mods)
@@ -217,6 +219,8 @@ function parse_template(meta, styles, line, templates, mods)
 			template.perchar = true
 		elseif m == "noblank" then
 			template.noblank = true
+		elseif m == "parallel" then
+			templates.parallel = true
 		elseif m == "fx" then
 			local fx, t = string.headtail(rest)
 			if fx ~= "" then
@@ -290,6 +294,34 @@ end
 
 -- Apply the templates
 function apply_templates(meta, styles, subs, templates)
+	-- Lines are only split over several Lua states when a template or code
+	-- line has the parallel modifier. Each state has its own globals and runs
+	-- the "once" code itself, so anything carried from one line to the next
+	-- (globals set by code lines, remember/recall, etc.) would be reset at
+	-- each shard boundary.
+	if templates.parallel and aegisub.__run_sharded then
+		if aegisub.__run_sharded(subs, "apply_templates_shard", 1, #subs) then
+			return
+		end
+		aegisub.debug.out(4, "Not applying templates in parallel, processing lines serially\n")
+	end
+
+	local tenv = create_template_env(meta, styles, templates)
+	apply_templates_range(meta, styles, subs, templates, tenv, 1, #subs)
+end
+
+-- Entry point for the worker Lua states used by aegisub.__run_sharded
+-- Each worker has its own copy of the file, so it rebuilds the templates and
+-- replays the run-once code before applying the templates to its lines
+function apply_templates_shard(subs, first, last)
+	local meta, styles = karaskel.collect_head(subs, true)
+	local templates = parse_templates(meta, styles, subs)
+	local tenv = create_template_env(meta, styles, templates)
+	apply_templates_range(meta, styles, subs, templates, tenv, first, last)
+end
+
+-- Create the environment the templates run in and run all run-once code in it
+function create_template_env(meta, styles, templates)
 	-- the environment the templates will run in
 	local tenv = {
 		meta = meta,
@@ -423,11 +455,14 @@ function apply_templates(meta, styles, subs, templates)
 		run_code_template(t, tenv)
 	end
 
-	-- start processing lines
-	local i, n = 0, #subs
-	while i < n do
-		aegisub.progress.set(i/n*100)
-		i = i + 1
+	return tenv
+end
+
+-- Apply the templates to the lines with indices first to last
+function apply_templates_range(meta, styles, subs, templates, tenv, first, last)
+	local n = last - first + 1
+	for i = first, last do
+		aegisub.progress.set((i - first)/n*100)
 		local l = subs[i]
 		if l.class == "dialogue" and ((l.effect == "" and not l.comment) or l.effect:match("[Kk]araoke")) then
 			l.i = i
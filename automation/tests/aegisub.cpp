@@ -49,7 +49,7 @@ int main(int argc, char **argv) {
 	}
 
 	std::locale::global(boost::locale::generator().generate(""));
-	agi::dispatch::Init([](agi::dispatch::Thunk f) { });
+	agi::dispatch::Init();
 	agi::log::log = new agi::log::LogSink;
 
 	// Init lua state
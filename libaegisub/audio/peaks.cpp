@@ -0,0 +1,188 @@
+// Copyright (c) 2026, agent <agent@local>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+
+#include "libaegisub/audio/peaks.h"
+
+#include "libaegisub/audio/provider.h"
+#include "libaegisub/fs.h"
+#include "libaegisub/io.h"
+#include "libaegisub/log.h"
+#include "libaegisub/make_unique.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+const char magic[8] = {'A', 'G', 'I', 'P', 'E', 'A', 'K', '1'};
+
+struct header {
+	char magic[8];
+	int64_t num_samples;
+	int32_t base_block;
+	int32_t levels;
+};
+
+agi::AudioPeak combine(agi::AudioPeak const& a, agi::AudioPeak const& b) {
+	return {
+		std::min(a.min, b.min),
+		std::max(a.max, b.max),
+		static_cast<int16_t>((a.avg_min + b.avg_min) / 2),
+		static_cast<int16_t>((a.avg_max + b.avg_max) / 2)
+	};
+}
+}
+
+namespace agi {
+AudioPeakPyramid::AudioPeakPyramid(int64_t num_samples)
+: num_samples(num_samples)
+{
+	for (auto size = (num_samples + base_block - 1) / base_block; size > 0; size = (size + 1) / 2) {
+		levels.emplace_back(static_cast<size_t>(size));
+		if (size == 1) break;
+	}
+}
+
+void AudioPeakPyramid::Append(const int16_t *samples, size_t count) {
+	count = static_cast<size_t>(std::min<int64_t>(count, num_samples - appended));
+	while (count > 0) {
+		auto n = std::min<size_t>(count, base_block - cur_count);
+		for (size_t i = 0; i < n; ++i) {
+			int16_t sample = samples[i];
+			if (sample > 0) {
+				cur_max = std::max(cur_max, sample);
+				cur_sum_max += sample;
+			}
+			else {
+				cur_min = std::min(cur_min, sample);
+				cur_sum_min += sample;
+			}
+		}
+
+		samples += n;
+		count -= n;
+		cur_count += static_cast<int>(n);
+		appended += n;
+		if (cur_count == base_block || appended == num_samples)
+			FinishBlock();
+	}
+}
+
+void AudioPeakPyramid::FinishBlock() {
+	size_t index = static_cast<size_t>((appended - 1) / base_block);
+	levels[0][index] = {cur_min, cur_max,
+		static_cast<int16_t>(cur_sum_min / base_block),
+		static_cast<int16_t>(cur_sum_max / base_block)};
+	cur_count = 0;
+	cur_min = cur_max = 0;
+	cur_sum_min = cur_sum_max = 0;
+
+	// A parent block can be filled in once its right child is done, or when
+	// it's at the end and has no right child
+	bool last = appended == num_samples;
+	for (size_t k = 1; k < levels.size() && ((index & 1) || last); ++k) {
+		auto const& below = levels[k - 1];
+		auto left = index & ~size_t(1);
+		index /= 2;
+		levels[k][index] = left + 1 < below.size()
+			? combine(below[left], below[left + 1])
+			: combine(below[left], AudioPeak{0, 0, 0, 0});
+	}
+
+	ready_samples.store(appended, std::memory_order_release);
+}
+
+int AudioPeakPyramid::GetLevel(double max_block_samples) const {
+	int level = -1;
+	for (size_t k = 0; k < levels.size() && (int64_t(base_block) << k) <= max_block_samples; ++k)
+		level = static_cast<int>(k);
+	return level;
+}
+
+bool AudioPeakPyramid::GetPeak(int level, int64_t start, int64_t end, AudioPeak &out) const {
+	if (level < 0 || static_cast<size_t>(level) >= levels.size()) return false;
+
+	auto const& blocks = levels[level];
+	int64_t block_size = int64_t(base_block) << level;
+	auto first = std::max<int64_t>(0, (start + block_size - 1) / block_size);
+	auto last = std::min<int64_t>(blocks.size(), (end + block_size - 1) / block_size);
+	if (first >= last) return false;
+
+	auto ready = GetReadySamples();
+	if (ready != num_samples && last * block_size > ready) return false;
+
+	out = blocks[first];
+	int32_t sum_min = out.avg_min, sum_max = out.avg_max;
+	for (auto i = first + 1; i < last; ++i) {
+		auto const& peak = blocks[i];
+		out.min = std::min(out.min, peak.min);
+		out.max = std::max(out.max, peak.max);
+		sum_min += peak.avg_min;
+		sum_max += peak.avg_max;
+	}
+	out.avg_min = static_cast<int16_t>(sum_min / (last - first));
+	out.avg_max = static_cast<int16_t>(sum_max / (last - first));
+	return true;
+}
+
+void AudioPeakPyramid::Save(fs::path const& filename) const {
+	header h;
+	memcpy(h.magic, magic, sizeof magic);
+	h.num_samples = num_samples;
+	h.base_block = base_block;
+	h.levels = static_cast<int32_t>(levels.size());
+
+	io::Save file(filename, true);
+	auto& out = file.Get();
+	out.write(reinterpret_cast<const char *>(&h), sizeof h);
+	for (auto const& level : levels)
+		out.write(reinterpret_cast<const char *>(level.data()), level.size() * sizeof(AudioPeak));
+}
+
+std::unique_ptr<AudioPeakPyramid> AudioPeakPyramid::Create(AudioProvider const& provider) {
+	if (provider.GetBytesPerSample() != 2 || provider.GetChannels() != 1)
+		return nullptr;
+	return agi::make_unique<AudioPeakPyramid>(provider.GetNumSamples());
+}
+
+std::unique_ptr<AudioPeakPyramid> AudioPeakPyramid::Load(fs::path const& filename, int64_t num_samples) {
+	if (!fs::FileExists(filename)) return nullptr;
+
+	try {
+		auto in = io::Open(filename, true);
+		header h;
+		if (!in->read(reinterpret_cast<char *>(&h), sizeof h)) return nullptr;
+
+		auto pyramid = agi::make_unique<AudioPeakPyramid>(num_samples);
+		if (memcmp(h.magic, magic, sizeof magic) || h.num_samples != num_samples ||
+			h.base_block != base_block || h.levels != static_cast<int32_t>(pyramid->levels.size()))
+			return nullptr;
+
+		for (auto& level : pyramid->levels) {
+			if (!in->read(reinterpret_cast<char *>(level.data()), level.size() * sizeof(AudioPeak)))
+				return nullptr;
+		}
+
+		pyramid->appended = num_samples;
+		pyramid->ready_samples = num_samples;
+		return pyramid;
+	}
+	catch (agi::Exception const& e) {
+		LOG_D("audio/peaks") << "Failed to read " << filename << ": " << e.GetMessage();
+		return nullptr;
+	}
+}
+}
@@ -19,12 +19,197 @@
 #include <libaegisub/log.h>
 #include <libaegisub/make_unique.h>
 
+#include <cstring>
 #include <limits>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AGI_AUDIO_SSE2
+#include <emmintrin.h>
+#endif
+
 using namespace agi;
 
-/// Anything integral -> 16 bit signed machine-endian audio converter
 namespace {
+// Conversion kernels for the common formats. Each has a SSE2 main loop and
+// a scalar tail which give identical results.
+
+/// Unsigned 8-bit with a bias of 128 -> signed 16-bit
+void convert_u8(const uint8_t *src, int16_t *dst, size_t count) {
+	size_t i = 0;
+#ifdef AGI_AUDIO_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi16(std::numeric_limits<int16_t>::min());
+	for (; i + 16 <= count; i += 16) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		// Unpacking into the high byte is the shift by 8; flipping the top
+		// bit is then the same as subtracting 128 << 8
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(_mm_unpacklo_epi8(zero, x), bias));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 8), _mm_xor_si128(_mm_unpackhi_epi8(zero, x), bias));
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i] = static_cast<int16_t>((src[i] - 128) * 256);
+}
+
+/// Signed little-endian 24-bit -> signed 16-bit by dropping the low byte
+void convert_s24(const uint8_t *src, int16_t *dst, size_t count) {
+	for (size_t i = 0; i < count; ++i, src += 3)
+		dst[i] = static_cast<int16_t>(src[1] | src[2] << 8);
+}
+
+/// Signed 32-bit -> signed 16-bit by dropping the low two bytes
+void convert_s32(const uint8_t *src, int16_t *dst, size_t count) {
+	size_t i = 0;
+#ifdef AGI_AUDIO_SSE2
+	for (; i + 8 <= count; i += 8) {
+		__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+		__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4 + 16));
+		// Everything fits after the shift so the pack never saturates
+		__m128i out = _mm_packs_epi32(_mm_srai_epi32(lo, 16), _mm_srai_epi32(hi, 16));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), out);
+	}
+#endif
+	for (; i < count; ++i) {
+		int32_t sample;
+		memcpy(&sample, src + i * 4, 4);
+		dst[i] = static_cast<int16_t>(sample >> 16);
+	}
+}
+
+/// Floating point in [-1, 1] -> signed 16-bit, truncating and saturating
+/// values out of range (and mapping NaN to the minimum)
+template<class Source>
+inline int16_t float_to_s16(Source x) {
+	Source v = x * (x < 0 ? Source(32768) : Source(32767));
+	v = v > Source(-32768) ? v : Source(-32768);
+	v = v < Source(32767) ? v : Source(32767);
+	return static_cast<int16_t>(v);
+}
+
+void convert_float(const float *src, int16_t *dst, size_t count) {
+	size_t i = 0;
+#ifdef AGI_AUDIO_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 neg_scale = _mm_set1_ps(32768.f), pos_scale = _mm_set1_ps(32767.f);
+	const __m128 lo = _mm_set1_ps(-32768.f), hi = _mm_set1_ps(32767.f);
+	auto convert4 = [&](__m128 x) {
+		__m128 neg = _mm_cmplt_ps(x, zero);
+		__m128 scale = _mm_or_ps(_mm_and_ps(neg, neg_scale), _mm_andnot_ps(neg, pos_scale));
+		__m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(x, scale), lo), hi);
+		return _mm_cvttps_epi32(v);
+	};
+	for (; i + 8 <= count; i += 8) {
+		__m128i a = convert4(_mm_loadu_ps(src + i));
+		__m128i b = convert4(_mm_loadu_ps(src + i + 4));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packs_epi32(a, b));
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i] = float_to_s16(src[i]);
+}
+
+void convert_float(const double *src, int16_t *dst, size_t count) {
+	size_t i = 0;
+#ifdef AGI_AUDIO_SSE2
+	const __m128d zero = _mm_setzero_pd();
+	const __m128d neg_scale = _mm_set1_pd(32768.), pos_scale = _mm_set1_pd(32767.);
+	const __m128d lo = _mm_set1_pd(-32768.), hi = _mm_set1_pd(32767.);
+	auto convert2 = [&](__m128d x) {
+		__m128d neg = _mm_cmplt_pd(x, zero);
+		__m128d scale = _mm_or_pd(_mm_and_pd(neg, neg_scale), _mm_andnot_pd(neg, pos_scale));
+		__m128d v = _mm_min_pd(_mm_max_pd(_mm_mul_pd(x, scale), lo), hi);
+		return _mm_cvttpd_epi32(v); // results in the low two lanes
+	};
+	for (; i + 8 <= count; i += 8) {
+		__m128i a = _mm_unpacklo_epi64(convert2(_mm_loadu_pd(src + i)), convert2(_mm_loadu_pd(src + i + 2)));
+		__m128i b = _mm_unpacklo_epi64(convert2(_mm_loadu_pd(src + i + 4)), convert2(_mm_loadu_pd(src + i + 6)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packs_epi32(a, b));
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i] = float_to_s16(src[i]);
+}
+
+/// Average each frame of Channels samples, rounding towards zero
+template<int Channels>
+void downmix_frames(const int16_t *src, int16_t *dst, size_t count) {
+	for (size_t i = 0; i < count; ++i, src += Channels) {
+		int sum = 0;
+		for (int c = 0; c < Channels; ++c)
+			sum += src[c];
+		dst[i] = static_cast<int16_t>(sum / Channels);
+	}
+}
+
+void downmix_stereo(const int16_t *src, int16_t *dst, size_t count) {
+	size_t i = 0;
+#ifdef AGI_AUDIO_SSE2
+	const __m128i ones = _mm_set1_epi16(1);
+	auto average4 = [&](const int16_t *p) {
+		// madd with ones sums each adjacent (left, right) pair into 32 bits
+		__m128i sum = _mm_madd_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), ones);
+		// Add one to negative sums so that the shift rounds towards zero
+		return _mm_srai_epi32(_mm_add_epi32(sum, _mm_srli_epi32(sum, 31)), 1);
+	};
+	for (; i + 8 <= count; i += 8) {
+		__m128i out = _mm_packs_epi32(average4(src + i * 2), average4(src + i * 2 + 8));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), out);
+	}
+#endif
+	downmix_frames<2>(src + i * 2, dst + i, count - i);
+}
+
+void downmix(const int16_t *src, int16_t *dst, size_t count, int channels) {
+	// Fixed channel counts let the compiler unroll the sum and turn the
+	// division into a multiplication
+	switch (channels) {
+		case 2: downmix_stereo(src, dst, count); return;
+		case 3: downmix_frames<3>(src, dst, count); return;
+		case 4: downmix_frames<4>(src, dst, count); return;
+		case 5: downmix_frames<5>(src, dst, count); return;
+		case 6: downmix_frames<6>(src, dst, count); return;
+		case 8: downmix_frames<8>(src, dst, count); return;
+	}
+
+	for (size_t i = 0; i < count; ++i, src += channels) {
+		int sum = 0;
+		for (int c = 0; c < channels; ++c)
+			sum += src[c];
+		dst[i] = static_cast<int16_t>(sum / channels);
+	}
+}
+
+/// Mean of two samples, rounding towards zero
+inline int16_t average(int16_t a, int16_t b) {
+	return static_cast<int16_t>((static_cast<int32_t>(a) + b) / 2);
+}
+
+/// Write src[0], avg(src[0], src[1]), src[1], ... to dst
+/// @param count Number of samples to write; src must have count / 2 + 1
+void double_samples(const int16_t *src, int16_t *dst, size_t count) {
+	size_t k = 0;
+#ifdef AGI_AUDIO_SSE2
+	for (; 2 * k + 16 <= count; k += 8) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + k));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + k + 1));
+		// Floor of the mean without overflowing, then add one to odd
+		// negative sums so that it rounds towards zero
+		__m128i odd = _mm_xor_si128(a, b);
+		__m128i mean = _mm_add_epi16(_mm_and_si128(a, b), _mm_srai_epi16(odd, 1));
+		mean = _mm_add_epi16(mean, _mm_and_si128(odd, _mm_srli_epi16(mean, 15)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * k), _mm_unpacklo_epi16(a, mean));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * k + 8), _mm_unpackhi_epi16(a, mean));
+	}
+#endif
+	for (; 2 * k + 1 < count; ++k) {
+		dst[2 * k] = src[k];
+		dst[2 * k + 1] = average(src[k], src[k + 1]);
+	}
+	if (count & 1)
+		dst[count - 1] = src[count / 2];
+}
+
+/// Anything integral -> 16 bit signed machine-endian audio converter
 template<class Target>
 class BitdepthConvertAudioProvider final : public AudioProviderWrapper {
 	int src_bytes_per_sample;
@@ -48,6 +233,14 @@ public:
 
 		auto dest = static_cast<int16_t*>(buf);
 
+		if (sizeof(Target) == 2) {
+			switch (src_bytes_per_sample) {
+				case 1: convert_u8(src_buf.data(), dest, count * channels); return;
+				case 3: convert_s24(src_buf.data(), dest, count * channels); return;
+				case 4: convert_s32(src_buf.data(), dest, count * channels); return;
+			}
+		}
+
 		for (int64_t i = 0; i < count * channels; ++i) {
 			int64_t sample = 0;
 
@@ -73,13 +266,13 @@ public:
 };
 
 /// Floating point -> 16 bit signed machine-endian audio converter
-template<class Source, class Target>
+template<class Source>
 class FloatConvertAudioProvider final : public AudioProviderWrapper {
 	mutable std::vector<Source> src_buf;
 
 public:
 	FloatConvertAudioProvider(std::unique_ptr<AudioProvider> src) : AudioProviderWrapper(std::move(src)) {
-		bytes_per_sample = sizeof(Target);
+		bytes_per_sample = sizeof(int16_t);
 		float_samples = false;
 	}
 
@@ -89,20 +282,7 @@ public:
 
 		src_buf.resize(count * channels);
 		source->GetAudio(&src_buf[0], start, count);
-
-		auto dest = static_cast<Target*>(buf);
-
-		for (size_t i = 0; i < static_cast<size_t>(count * channels); ++i) {
-			Source expanded;
-			if (src_buf[i] < 0)
-				expanded = static_cast<Target>(-src_buf[i] * std::numeric_limits<Target>::min());
-			else
-				expanded = static_cast<Target>(src_buf[i] * std::numeric_limits<Target>::max());
-
-			dest[i] = expanded < std::numeric_limits<Target>::min() ? std::numeric_limits<Target>::min() :
-			          expanded > std::numeric_limits<Target>::max() ? std::numeric_limits<Target>::max() :
-			                                                          static_cast<Target>(expanded);
-		}
+		convert_float(src_buf.data(), static_cast<int16_t*>(buf), count * channels);
 	}
 };
 
@@ -124,20 +304,16 @@ public:
 		src_buf.resize(count * src_channels);
 		source->GetAudio(&src_buf[0], start, count);
 
-		auto dst = static_cast<int16_t*>(buf);
 		// Just average the channels together
-		while (count-- > 0) {
-			int sum = 0;
-			for (int c = 0; c < src_channels; ++c)
-				sum += src_buf[count * src_channels + c];
-			dst[count] = static_cast<int16_t>(sum / src_channels);
-		}
+		downmix(src_buf.data(), static_cast<int16_t*>(buf), count, src_channels);
 	}
 };
 
 /// Sample doubler with linear interpolation for the samples provider
 /// Requires 16-bit mono input
 class SampleDoublingAudioProvider final : public AudioProviderWrapper {
+	mutable std::vector<int16_t> src_buf;
+
 public:
 	SampleDoublingAudioProvider(std::unique_ptr<AudioProvider> src) : AudioProviderWrapper(std::move(src)) {
 		sample_rate *= 2;
@@ -146,28 +322,21 @@ public:
 	}
 
 	void FillBuffer(void *buf, int64_t start, int64_t count) const override {
-		int16_t *src, *dst = static_cast<int16_t *>(buf);
-
-		// We need to always get at least two samples to be able to interpolate
-		int16_t srcbuf[2];
-		if (count == 1) {
-			source->GetAudio(srcbuf, start / 2, 2);
-			src = srcbuf;
-		}
-		else {
-			source->GetAudio(buf, start / 2, (start + count) / 2 - start / 2 + 1);
-			src = dst;
-		}
-
-		// walking backwards so that the conversion can be done in place
-		for (; count > 0; --count) {
-			auto src_index = (start + count - 1) / 2 - start / 2;
-			auto i = count - 1;
-			if ((start + i) & 1)
-				dst[i] = (int16_t)(((int32_t)src[src_index] + src[src_index + 1]) / 2);
-			else
-				dst[i] = src[src_index];
+		auto dst = static_cast<int16_t *>(buf);
+
+		// Always get at least two samples to be able to interpolate
+		auto src_count = (start + count) / 2 - start / 2 + 1;
+		src_buf.resize(static_cast<size_t>(src_count));
+		source->GetAudio(src_buf.data(), start / 2, src_count);
+
+		auto src = src_buf.data();
+		// Odd output samples are the interpolated ones
+		if (start & 1) {
+			*dst++ = average(src[0], src[1]);
+			++src;
+			--count;
 		}
+		double_samples(src, dst, static_cast<size_t>(count));
 	}
 };
 }
@@ -178,9 +347,9 @@ std::unique_ptr<AudioProvider> CreateConvertAudioProvider(std::unique_ptr<AudioP
 	if (provider->AreSamplesFloat()) {
 		LOG_D("audio_provider") << "Converting float to S16";
 		if (provider->GetBytesPerSample() == sizeof(float))
-			provider = agi::make_unique<FloatConvertAudioProvider<float, int16_t>>(std::move(provider));
+			provider = agi::make_unique<FloatConvertAudioProvider<float>>(std::move(provider));
 		else
-			provider = agi::make_unique<FloatConvertAudioProvider<double, int16_t>>(std::move(provider));
+			provider = agi::make_unique<FloatConvertAudioProvider<double>>(std::move(provider));
 	}
 	if (provider->GetBytesPerSample() != 2) {
 		LOG_D("audio_provider") << "Converting " << provider->GetBytesPerSample() << " bytes per sample or wrong endian to S16";
@@ -16,12 +16,16 @@
 
 #include "libaegisub/audio/provider.h"
 
+#include <libaegisub/audio/peaks.h>
 #include <libaegisub/file_mapping.h>
 #include <libaegisub/format.h>
 #include <libaegisub/fs.h>
+#include <libaegisub/log.h>
 #include <libaegisub/path.h>
 #include <libaegisub/make_unique.h>
 
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/interprocess/detail/os_thread_functions.hpp>
 #include <ctime>
@@ -30,8 +34,83 @@
 namespace {
 using namespace agi;
 
+/// Get the name of the file which the peaks for a saved cache file are kept in
+fs::path PeaksFilename(fs::path const& filename) {
+	auto ret = filename;
+	return ret.replace_extension(".peaks");
+}
+
+void SavePeaks(AudioPeakPyramid const& peaks, fs::path const& filename) {
+	try {
+		peaks.Save(filename);
+	}
+	catch (agi::Exception const& e) {
+		LOG_W("audio/provider/cache/hd") << "Failed to save waveform peaks: " << e.GetMessage();
+	}
+}
+
+/// Writes the decoded audio to a file alongside the temporary mapping, and
+/// publishes it with an atomic rename only once all of it has been written
+/// so that other processes never see a partial cache file
+class PersistentCacheWriter {
+	fs::path filename;
+	fs::path tmp_name;
+	std::unique_ptr<boost::filesystem::ofstream> out;
+
+public:
+	PersistentCacheWriter(fs::path const& filename)
+	: filename(filename)
+	{
+		try {
+			tmp_name = boost::filesystem::unique_path(filename.parent_path()/(filename.stem().string() + "_tmp_%%%%%%%%.part"));
+		}
+		catch (boost::filesystem::filesystem_error const& e) {
+			LOG_W("audio/provider/cache/hd") << "Could not pick a temporary name for " << filename << ": " << e.what();
+			return;
+		}
+
+		out = agi::make_unique<boost::filesystem::ofstream>(tmp_name, std::ios::binary);
+		if (!out->good()) {
+			LOG_W("audio/provider/cache/hd") << "Could not open " << tmp_name << " for writing";
+			out.reset();
+		}
+	}
+
+	~PersistentCacheWriter() {
+		if (out) Abort();
+	}
+
+	void Write(const char *data, int64_t len) {
+		if (out && !out->write(data, len)) {
+			LOG_W("audio/provider/cache/hd") << "Failed writing " << tmp_name;
+			Abort();
+		}
+	}
+
+	void Commit() {
+		if (!out) return;
+		out.reset();
+		try {
+			fs::Rename(tmp_name, filename);
+			LOG_D("audio/provider/cache/hd") << "Saved decoded audio to " << filename;
+		}
+		catch (fs::FileSystemError const& e) {
+			// Most likely another process cached the same audio and it's in use
+			LOG_D("audio/provider/cache/hd") << e.GetMessage();
+			Abort();
+		}
+	}
+
+	void Abort() {
+		out.reset();
+		boost::system::error_code ec;
+		boost::filesystem::remove(tmp_name, ec);
+	}
+};
+
 class HDAudioProvider final : public AudioProviderWrapper {
 	mutable temp_file_mapping file;
+	std::unique_ptr<AudioPeakPyramid> peaks;
 	std::atomic<bool> cancelled = {false};
 	std::thread decoder;
 
@@ -59,19 +138,38 @@ class HDAudioProvider final : public AudioProviderWrapper {
 	}
 
 public:
-	HDAudioProvider(std::unique_ptr<AudioProvider> src, agi::fs::path const& dir)
+	/// @param persist_to If not empty, also save the decoded audio to this file
+	HDAudioProvider(std::unique_ptr<AudioProvider> src, agi::fs::path const& dir, agi::fs::path const& persist_to = agi::fs::path())
 	: AudioProviderWrapper(std::move(src))
 	, file(dir / CacheFilename(dir), num_samples * bytes_per_sample)
+	, peaks(AudioPeakPyramid::Create(*this))
 	{
 		decoded_samples = 0;
-		decoder = std::thread([&] {
+		decoder = std::thread([=] {
+			std::unique_ptr<PersistentCacheWriter> writer;
+			if (!persist_to.empty())
+				writer = agi::make_unique<PersistentCacheWriter>(persist_to);
+
 			int64_t block = 65536;
-			for (int64_t i = 0; i < num_samples; i += block) {
+			int64_t i = 0;
+			for (; i < num_samples; i += block) {
 				if (cancelled) break;
 				block = std::min(block, num_samples - i);
-				source->GetAudio(file.write(i * bytes_per_sample, block * bytes_per_sample), i, block);
+				auto buf = file.write(i * bytes_per_sample, block * bytes_per_sample);
+				source->GetAudio(buf, i, block);
+				if (writer) writer->Write(buf, block * bytes_per_sample);
+				if (peaks) peaks->Append(reinterpret_cast<int16_t *>(buf), block);
 				decoded_samples += block;
 			}
+
+			// Only save the audio if all of it was decoded. The cancel flag
+			// can't be used for this as the destructor sets it even when
+			// decoding has already finished.
+			if (writer && i >= num_samples) {
+				// Saved first so that the peaks exist whenever the audio does
+				if (peaks) SavePeaks(*peaks, PeaksFilename(persist_to));
+				writer->Commit();
+			}
 		});
 	}
 
@@ -79,11 +177,101 @@ public:
 		cancelled = true;
 		decoder.join();
 	}
+
+	AudioPeakPyramid const *GetPeaks() const override { return peaks.get(); }
 };
-}
 
+/// Reads audio decoded by an earlier HDAudioProvider from its saved file
+class MappedAudioProvider final : public AudioProviderWrapper {
+	std::unique_ptr<read_file_mapping> file;
+	std::unique_ptr<AudioPeakPyramid> peaks;
+	std::atomic<bool> cancelled = {false};
+	std::thread scanner;
+
+	void FillBuffer(void *buf, int64_t start, int64_t count) const override {
+		memcpy(buf, file->read(start * bytes_per_sample, count * bytes_per_sample), count * bytes_per_sample);
+	}
+
+public:
+	MappedAudioProvider(std::unique_ptr<AudioProvider> src, std::unique_ptr<read_file_mapping> file, fs::path const& filename)
+	: AudioProviderWrapper(std::move(src))
+	, file(std::move(file))
+	{
+		decoded_samples = num_samples;
+
+		auto peaks_filename = PeaksFilename(filename);
+		if (fs::FileExists(peaks_filename))
+			fs::Touch(peaks_filename);
+		peaks = AudioPeakPyramid::Load(peaks_filename, num_samples);
+		if (peaks || !(peaks = AudioPeakPyramid::Create(*this))) return;
+
+		// The peaks are missing, so rebuild them from the saved audio. Reading
+		// a mapping can replace its mapped region, so the scanner maps the
+		// file separately rather than sharing the one used by GetAudio.
+		scanner = std::thread([=] {
+			try {
+				read_file_mapping scan_file(filename);
+				int64_t block = 1 << 20;
+				for (int64_t i = 0; i < num_samples; i += block) {
+					if (cancelled) return;
+					block = std::min(block, num_samples - i);
+					auto samples = scan_file.read(i * bytes_per_sample, block * bytes_per_sample);
+					peaks->Append(reinterpret_cast<const int16_t *>(samples), static_cast<size_t>(block));
+				}
+			}
+			catch (agi::Exception const& e) {
+				LOG_W("audio/provider/cache/hd") << "Failed to rebuild waveform peaks: " << e.GetMessage();
+				return;
+			}
+			catch (std::exception const& e) {
+				LOG_W("audio/provider/cache/hd") << "Failed to rebuild waveform peaks: " << e.what();
+				return;
+			}
+			SavePeaks(*peaks, peaks_filename);
+		});
+	}
+
+	~MappedAudioProvider() {
+		cancelled = true;
+		if (scanner.joinable())
+			scanner.join();
+	}
+
+	AudioPeakPyramid const *GetPeaks() const override { return peaks.get(); }
+};
+}
 namespace agi {
 std::unique_ptr<AudioProvider> CreateHDAudioProvider(std::unique_ptr<AudioProvider> src, agi::fs::path const& dir) {
 	return agi::make_unique<HDAudioProvider>(std::move(src), dir);
 }
+
+std::unique_ptr<AudioProvider> CreatePersistentHDAudioProvider(std::unique_ptr<AudioProvider> src, agi::fs::path const& dir, std::string const& cache_key) {
+	auto filename = dir/format("%s_%lld_%d_%d_%d%s.pcm", cache_key, src->GetNumSamples(),
+		src->GetSampleRate(), src->GetChannels(), src->GetBytesPerSample(),
+		src->AreSamplesFloat() ? "f" : "");
+
+	if (fs::FileExists(filename)) {
+		try {
+			// Bump the modification time so that cleaning the cache is LRU
+			fs::Touch(filename);
+			auto file = agi::make_unique<read_file_mapping>(filename);
+			if (file->size() == static_cast<uint64_t>(src->GetNumSamples() * src->GetBytesPerSample())) {
+				LOG_D("audio/provider/cache/hd") << "Using cached audio from " << filename;
+				return agi::make_unique<MappedAudioProvider>(std::move(src), std::move(file), filename);
+			}
+			LOG_W("audio/provider/cache/hd") << "Ignoring cached audio with the wrong size: " << filename;
+		}
+		catch (fs::FileSystemError const& e) {
+			LOG_W("audio/provider/cache/hd") << "Ignoring unreadable cached audio " << filename << ": " << e.GetMessage();
+		}
+	}
+
+	try {
+		fs::CreateDirectory(dir);
+	}
+	catch (fs::FileSystemError const& e) {
+		throw AudioProviderError("Could not create the audio cache directory " + dir.string() + ": " + e.GetMessage());
+	}
+	return agi::make_unique<HDAudioProvider>(std::move(src), dir, filename);
+}
 }
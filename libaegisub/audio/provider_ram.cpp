@@ -16,6 +16,7 @@
 
 #include "libaegisub/audio/provider.h"
 
+#include "libaegisub/audio/peaks.h"
 #include "libaegisub/make_unique.h"
 
 #include <array>
@@ -34,6 +35,7 @@ class RAMAudioProvider final : public AudioProviderWrapper {
 #else
 	boost::container::stable_vector<std::array<char, CacheBlockSize>> blockcache;
 #endif
+	std::unique_ptr<AudioPeakPyramid> peaks;
 	std::atomic<bool> cancelled = {false};
 	std::thread decoder;
 
@@ -52,12 +54,16 @@ public:
 			throw AudioProviderError("Not enough memory available to cache in RAM");
 		}
 
+		peaks = AudioPeakPyramid::Create(*this);
+
 		decoder = std::thread([&] {
 			int64_t readsize = CacheBlockSize / source->GetBytesPerSample();
 			for (size_t i = 0; i < blockcache.size(); i++) {
 				if (cancelled) break;
 				auto actual_read = std::min<int64_t>(readsize, num_samples - i * readsize);
 				source->GetAudio(&blockcache[i][0], i * readsize, actual_read);
+				if (peaks)
+					peaks->Append(reinterpret_cast<int16_t *>(&blockcache[i][0]), actual_read);
 				decoded_samples += actual_read;
 			}
 		});
@@ -67,6 +73,8 @@ public:
 		cancelled = true;
 		decoder.join();
 	}
+
+	AudioPeakPyramid const *GetPeaks() const override { return peaks.get(); }
 };
 
 void RAMAudioProvider::FillBuffer(void *buf, int64_t start, int64_t count) const {
@@ -18,101 +18,148 @@
 
 #include "libaegisub/util.h"
 
+#include <algorithm>
 #include <atomic>
-#include <boost/asio/io_service.hpp>
-#include <boost/asio/strand.hpp>
 #include <condition_variable>
+#include <deque>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 namespace {
+	using agi::dispatch::Thunk;
 
-	class MainQueue final : public agi::dispatch::Queue {
-		void DoInvoke(agi::dispatch::Thunk thunk) override {
-                    thunk();
- 
-		}
-	};
+	std::function<void (Thunk)> invoke_main;
+	std::thread::id main_thread;
+	std::atomic<bool> initialized(false);
+	std::atomic<uint_fast32_t> threads_running(0);
 
-	class BackgroundQueue final : public agi::dispatch::Queue {
-		void DoInvoke(agi::dispatch::Thunk thunk) override {
-                    thunk();
-		}
+	/// Thunks for the main thread when there is no GUI event loop to run them
+	struct PendingMainThunks {
+		std::mutex lock;
+		std::condition_variable cv;
+		std::deque<Thunk> thunks;
 	};
 
-	class SerialQueue final : public agi::dispatch::Queue {
-
-		void DoInvoke(agi::dispatch::Thunk thunk) override {
-                     thunk();
-		}
-	};
+	PendingMainThunks& pending_main() {
+		static PendingMainThunks pending;
+		return pending;
+	}
 
-}
+	/// Thread pool where each worker has its own deque of tasks. Tasks posted
+	/// from a worker go to the back of that worker's deque and are run LIFO,
+	/// while tasks posted from elsewhere go to a shared queue. Idle workers
+	/// steal from the front of the other workers' deques.
+	class ThreadPool {
+		struct Worker {
+			std::mutex lock;
+			std::deque<Thunk> tasks;
+			std::thread::id id;
+		};
 
-namespace agi { namespace dispatch {
+		std::vector<std::unique_ptr<Worker>> workers;
+		std::vector<std::thread> threads;
 
-void Init(std::function<void (Thunk)> invoke_main) {
-}
-void Queue::Async(Thunk thunk) {
-        thunk();
-}
+		std::mutex lock;
+		std::condition_variable work_available;
+		std::deque<Thunk> injected; ///< Tasks posted from outside the pool
+		std::atomic<size_t> pending; ///< Number of tasks in any queue
+		bool stopping = false;
 
-void Queue::Sync(Thunk thunk) {
-       thunk();
-}
-
-Queue& Main() {
-	static MainQueue q;
-	return q;
-}
+		Worker *CurrentWorker() {
+			auto id = std::this_thread::get_id();
+			for (auto& worker : workers) {
+				if (worker->id == id)
+					return worker.get();
+			}
+			return nullptr;
+		}
 
-Queue& Background() {
-	static BackgroundQueue q;
-	return q;
-}
+		bool PopFront(std::deque<Thunk>& queue, Thunk& task) {
+			if (queue.empty()) return false;
+			task = std::move(queue.front());
+			queue.pop_front();
+			--pending;
+			return true;
+		}
 
-std::unique_ptr<Queue> Create() {
-	return std::unique_ptr<Queue>(new SerialQueue);
-}
+		bool Take(Worker *self, Thunk& task) {
+			{
+				std::lock_guard<std::mutex> l(self->lock);
+				if (!self->tasks.empty()) {
+					task = std::move(self->tasks.back());
+					self->tasks.pop_back();
+					--pending;
+					return true;
+				}
+			}
 
-} }
+			{
+				std::lock_guard<std::mutex> l(lock);
+				if (PopFront(injected, task)) return true;
+			}
 
-/*
-namespace {
-	boost::asio::io_service *service;
-	std::function<void (agi::dispatch::Thunk)> invoke_main;
-	std::atomic<uint_fast32_t> threads_running;
+			for (auto& victim : workers) {
+				if (victim.get() == self) continue;
+				std::lock_guard<std::mutex> l(victim->lock);
+				if (PopFront(victim->tasks, task)) return true;
+			}
 
-	class MainQueue final : public agi::dispatch::Queue {
-		void DoInvoke(agi::dispatch::Thunk thunk) override {
-			invoke_main(thunk);
+			return false;
 		}
-	};
 
-	class BackgroundQueue final : public agi::dispatch::Queue {
-		void DoInvoke(agi::dispatch::Thunk thunk) override {
-			service->post(thunk);
-		}
-	};
+		void Run(Worker *self) {
+			++threads_running;
+			agi::util::SetThreadName("Dispatch Worker");
 
-	class SerialQueue final : public agi::dispatch::Queue {
-		boost::asio::io_service::strand strand;
+			Thunk task;
+			while (true) {
+				if (Take(self, task)) {
+					// Queue::Async and Sync catch exceptions from the thunk
+					// themselves, but before Init there's no main queue to
+					// pass them on to
+					try {
+						task();
+					}
+					catch (...) { }
+					task = nullptr;
+					continue;
+				}
+
+				std::unique_lock<std::mutex> l(lock);
+				if (stopping && !pending) break;
+				work_available.wait(l, [&] { return stopping || pending > 0; });
+			}
 
-		void DoInvoke(agi::dispatch::Thunk thunk) override {
-			strand.post(thunk);
+			--threads_running;
 		}
+
 	public:
-		SerialQueue() : strand(*service) { }
-	};
+		ThreadPool() : pending(0) {
+			size_t count = std::max<unsigned>(4, std::thread::hardware_concurrency());
+			for (size_t i = 0; i < count; ++i)
+				workers.emplace_back(new Worker);
 
-	struct IOServiceThreadPool {
-		boost::asio::io_service io_service;
-		std::unique_ptr<boost::asio::io_service::work> work;
-		std::vector<std::thread> threads;
+			// Workers look each other up by id, so all ids have to be filled
+			// in before any of them start taking tasks
+			std::unique_lock<std::mutex> l(lock);
+			threads.reserve(count);
+			for (auto& worker : workers) {
+				Worker *w = worker.get();
+				threads.emplace_back([=] {
+					{ std::lock_guard<std::mutex> l(lock); }
+					Run(w);
+				});
+				w->id = threads.back().get_id();
+			}
+		}
 
-		IOServiceThreadPool() : work(new boost::asio::io_service::work(io_service)) { }
-		~IOServiceThreadPool() {
-			work.reset();
+		~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> l(lock);
+				stopping = true;
+			}
+			work_available.notify_all();
 #ifndef _WIN32
 			for (auto& thread : threads) thread.join();
 #else
@@ -122,26 +169,145 @@ namespace {
 			while (threads_running) std::this_thread::yield();
 #endif
 		}
+
+		void Post(Thunk task) {
+			if (Worker *self = CurrentWorker()) {
+				std::lock_guard<std::mutex> l(self->lock);
+				self->tasks.push_back(std::move(task));
+				++pending;
+			}
+			else {
+				std::lock_guard<std::mutex> l(lock);
+				injected.push_back(std::move(task));
+				++pending;
+			}
+
+			// Taking the lock ensures that a worker which just saw pending == 0
+			// is already waiting and will get the notification
+			{ std::lock_guard<std::mutex> l(lock); }
+			work_available.notify_one();
+		}
+	};
+
+	ThreadPool& pool() {
+		// Workers can post to the main queue while the pool is shutting down,
+		// so it has to be destroyed after the pool
+		pending_main();
+		static ThreadPool thread_pool;
+		return thread_pool;
+	}
+
+	bool on_main_thread() {
+		return initialized && std::this_thread::get_id() == main_thread;
+	}
+
+	void post_main(Thunk thunk) {
+		if (invoke_main)
+			invoke_main(std::move(thunk));
+		else if (!initialized)
+			thunk();
+		else {
+			auto& pending = pending_main();
+			{
+				std::lock_guard<std::mutex> l(pending.lock);
+				pending.thunks.push_back(std::move(thunk));
+			}
+			pending.cv.notify_all();
+		}
+	}
+
+	class MainQueue final : public agi::dispatch::Queue {
+		void DoInvoke(Thunk thunk) override {
+			post_main(std::move(thunk));
+		}
+	};
+
+	class BackgroundQueue final : public agi::dispatch::Queue {
+		void DoInvoke(Thunk thunk) override {
+			pool().Post(std::move(thunk));
+		}
+	};
+
+	/// A queue which runs its thunks one at a time, in order, on the thread
+	/// pool. The state is shared with the drain task so that destroying the
+	/// queue with work still pending is safe.
+	class SerialQueue final : public agi::dispatch::Queue {
+		struct State {
+			std::mutex lock;
+			std::deque<Thunk> thunks;
+			bool scheduled = false;
+		};
+		std::shared_ptr<State> state = std::make_shared<State>();
+
+		/// Run a batch of thunks, then yield the worker thread if more remain
+		static void Drain(std::shared_ptr<State> const& state) {
+			for (int i = 0; i < 64; ++i) {
+				Thunk thunk;
+				{
+					std::lock_guard<std::mutex> l(state->lock);
+					if (state->thunks.empty()) {
+						state->scheduled = false;
+						return;
+					}
+					thunk = std::move(state->thunks.front());
+					state->thunks.pop_front();
+				}
+				thunk();
+			}
+			pool().Post([=] { Drain(state); });
+		}
+
+		void DoInvoke(Thunk thunk) override {
+			{
+				std::lock_guard<std::mutex> l(state->lock);
+				state->thunks.push_back(std::move(thunk));
+				if (state->scheduled) return;
+				state->scheduled = true;
+			}
+			auto state = this->state;
+			pool().Post([=] { Drain(state); });
+		}
 	};
 }
 
 namespace agi { namespace dispatch {
 
 void Init(std::function<void (Thunk)> invoke_main) {
-	static IOServiceThreadPool thread_pool;
-	::service = &thread_pool.io_service;
 	::invoke_main = invoke_main;
+	main_thread = std::this_thread::get_id();
+	initialized = true;
+	pool();
+}
 
-	thread_pool.threads.reserve(std::max<unsigned>(4, std::thread::hardware_concurrency()));
-	for (size_t i = 0; i < thread_pool.threads.capacity(); ++i) {
-		thread_pool.threads.emplace_back([]{
-			++threads_running;
-			agi::util::SetThreadName("Dispatch Worker");
-			service->run();
-			--threads_running;
-		});
+void Init() {
+	Init(nullptr);
+}
+
+size_t ProcessMainQueue(std::chrono::milliseconds timeout) {
+	auto& pending = pending_main();
+
+	size_t count;
+	{
+		std::unique_lock<std::mutex> l(pending.lock);
+		if (pending.thunks.empty() && timeout.count() > 0)
+			pending.cv.wait_for(l, timeout, [&] { return !pending.thunks.empty(); });
+		count = pending.thunks.size();
+	}
+
+	// Only run what was queued on entry so that thunks which requeue
+	// themselves can't keep this from returning
+	for (size_t i = 0; i < count; ++i) {
+		Thunk thunk;
+		{
+			std::lock_guard<std::mutex> l(pending.lock);
+			thunk = std::move(pending.thunks.front());
+			pending.thunks.pop_front();
+		}
+		thunk();
 	}
+	return count;
 }
+
 void Queue::Async(Thunk thunk) {
 	DoInvoke([=] {
 		try {
@@ -149,28 +315,35 @@ void Queue::Async(Thunk thunk) {
 		}
 		catch (...) {
 			auto e = std::current_exception();
-			invoke_main([=] { std::rethrow_exception(e); });
+			post_main([=] { std::rethrow_exception(e); });
 		}
 	});
 }
 
 void Queue::Sync(Thunk thunk) {
+	// Waiting on the main queue from the main thread would never finish
+	if (this == &Main() && on_main_thread()) {
+		thunk();
+		return;
+	}
+
 	std::mutex m;
 	std::condition_variable cv;
-	std::unique_lock<std::mutex> l(m);
 	std::exception_ptr e;
 	bool done = false;
 	DoInvoke([&]{
-		std::unique_lock<std::mutex> l(m);
 		try {
 			thunk();
 		}
 		catch (...) {
 			e = std::current_exception();
 		}
+		std::lock_guard<std::mutex> l(m);
 		done = true;
 		cv.notify_all();
 	});
+
+	std::unique_lock<std::mutex> l(m);
 	cv.wait(l, [&]{ return done; });
 	if (e) std::rethrow_exception(e);
 }
@@ -190,4 +363,3 @@ std::unique_ptr<Queue> Create() {
 }
 
 } }
-*/
@@ -16,14 +16,57 @@
 
 #include "libaegisub/cajun/elements.h"
 #include "libaegisub/cajun/writer.h"
-#include "libaegisub/dispatch.h"
+#include "libaegisub/exception.h"
 #include "libaegisub/util.h"
 
 #include <boost/filesystem/fstream.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/path.hpp>
+#include <algorithm>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/trim.hpp>
 #include <boost/range/algorithm/remove_if.hpp>
 #include <chrono>
+#include <condition_variable>
+#include <cstring>
+
+namespace {
+/// Number of messages which can be waiting for the drain thread
+const size_t queue_size = 4096;
+/// Number of messages kept for GetMessages
+const size_t tail_size = 250;
+
+typedef std::vector<std::pair<std::string, agi::log::Severity>> SectionLevels;
+
+/// Serializes changes to the levels; readers use atomic loads only
+std::mutex section_levels_lock;
+std::shared_ptr<const SectionLevels> section_levels;
+std::atomic<int> default_level(agi::log::Debug);
+
+/// Recompute max_severity after the levels have changed
+void update_max_severity() {
+	auto levels = std::atomic_load(&section_levels);
+	int max = default_level;
+	if (levels) {
+		for (auto const& level : *levels)
+			max = std::max<int>(max, level.second);
+	}
+	agi::log::max_severity = max;
+	agi::log::has_section_levels = levels && !levels->empty();
+}
+
+agi::log::Severity parse_severity(std::string name) {
+	static const char *names[] = {"exception", "assert", "warning", "info", "debug"};
+	boost::to_lower(name);
+	for (int i = 0; i < 5; ++i) {
+		if (name == names[i])
+			return static_cast<agi::log::Severity>(i);
+	}
+	throw agi::InvalidInputException("Unknown log level: " + name);
+}
+}
+
 namespace agi { namespace log {
 
 /// Global log sink.
@@ -33,76 +76,278 @@ LogSink *log;
 /// Keep this ordered the same as Severity
 const char *Severity_ID = "EAWID";
 
-LogSink::LogSink()   { }
+std::atomic<int> max_severity(Debug);
+std::atomic<bool> has_section_levels(false);
 
-LogSink::~LogSink() {
-	// The destructor for emitters may try to log messages, so disable all the
-	// emitters before destructing any
+bool SectionEnabled(const char *section, Severity severity) {
+	auto levels = std::atomic_load(&section_levels);
+	int level = default_level;
+	if (!levels) return severity <= level;
+
+	// Longest matching prefix which ends at a path separator wins
+	size_t best = 0;
+	for (auto const& entry : *levels) {
+		auto const& name = entry.first;
+		if (name.size() < best || strncmp(section, name.c_str(), name.size()) != 0)
+			continue;
+		char next = section[name.size()];
+		if (next != 0 && next != '/') continue;
+		best = name.size();
+		level = entry.second;
+	}
+	return severity <= level;
 }
 
-void LogSink::Log(SinkMessage const& sm) {
-   std::cout << sm.time << "\t" << sm.file << ":" << sm.line << "\t" << sm.message << std::endl;
+void SetLevel(Severity severity) {
+	std::lock_guard<std::mutex> lock(section_levels_lock);
+	default_level = severity;
+	update_max_severity();
 }
 
-void LogSink::Subscribe(std::unique_ptr<Emitter> em) {
+void SetSectionLevel(std::string const& section, Severity severity) {
+	std::lock_guard<std::mutex> lock(section_levels_lock);
+	auto levels = std::make_shared<SectionLevels>();
+	if (section_levels) *levels = *section_levels;
+
+	auto it = find_if(begin(*levels), end(*levels), [&](std::pair<std::string, Severity> const& level) {
+		return level.first == section;
+	});
+	if (it != end(*levels))
+		it->second = severity;
+	else
+		levels->emplace_back(section, severity);
+
+	std::atomic_store(&section_levels, std::shared_ptr<const SectionLevels>(std::move(levels)));
+	update_max_severity();
 }
 
-void LogSink::Unsubscribe(Emitter *em) {
+void ClearSectionLevels() {
+	std::lock_guard<std::mutex> lock(section_levels_lock);
+	std::atomic_store(&section_levels, std::shared_ptr<const SectionLevels>());
+	update_max_severity();
 }
 
-decltype(LogSink::messages) LogSink::GetMessages() const {
-	decltype(messages) ret;
-        return ret;
+void SetLevels(std::string const& spec) {
+	Severity level = Debug;
+	auto levels = std::make_shared<SectionLevels>();
+
+	std::vector<std::string> entries;
+	boost::split(entries, spec, [](char c) { return c == ','; });
+	for (auto& entry : entries) {
+		boost::trim(entry);
+		if (entry.empty()) continue;
+
+		auto eq = entry.find('=');
+		if (eq == std::string::npos) {
+			level = parse_severity(entry);
+			continue;
+		}
+
+		auto section = boost::trim_copy(entry.substr(0, eq));
+		if (section.empty())
+			throw InvalidInputException("Missing section name in log level: " + entry);
+		levels->emplace_back(section, parse_severity(boost::trim_copy(entry.substr(eq + 1))));
+	}
+
+	std::lock_guard<std::mutex> lock(section_levels_lock);
+	default_level = level;
+	std::atomic_store(&section_levels, levels->empty()
+		? std::shared_ptr<const SectionLevels>()
+		: std::shared_ptr<const SectionLevels>(std::move(levels)));
+	update_max_severity();
 }
 
-/*
-LogSink::LogSink() : queue(dispatch::Create()) { }
+/// Bounded multi-producer single-consumer queue. Each cell has a sequence
+/// number which says whether it is free for the producer claiming that
+/// position or holds a message ready for the consumer.
+class LogSink::MessageQueue {
+	struct Cell {
+		std::atomic<size_t> sequence;
+		SinkMessage message;
+	};
+
+	std::unique_ptr<Cell[]> cells{new Cell[queue_size]};
+	std::atomic<size_t> write_pos{0};
+	size_t read_pos = 0; ///< Only touched by the drain thread
+
+public:
+	std::atomic<size_t> dropped{0};
+	std::atomic<size_t> emitted{0};
+
+	std::mutex wake_lock;
+	std::condition_variable wake;    ///< Signalled when messages arrive
+	std::condition_variable flushed; ///< Signalled when messages are emitted
+	std::atomic<bool> sleeping{false};
+	bool stop = false;
+
+	MessageQueue() {
+		for (size_t i = 0; i < queue_size; ++i)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	/// Number of messages which have been accepted so far
+	size_t Written() const { return write_pos.load(); }
+
+	bool Push(SinkMessage&& sm) {
+		size_t pos = write_pos.load(std::memory_order_relaxed);
+		Cell *cell;
+		while (true) {
+			cell = &cells[pos % queue_size];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (diff == 0) {
+				if (write_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = write_pos.load(std::memory_order_relaxed);
+		}
+
+		cell->message = std::move(sm);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Pop(SinkMessage& sm) {
+		Cell *cell = &cells[read_pos % queue_size];
+		if (cell->sequence.load(std::memory_order_acquire) != read_pos + 1)
+			return false;
+		sm = std::move(cell->message);
+		cell->sequence.store(read_pos + queue_size, std::memory_order_release);
+		++read_pos;
+		return true;
+	}
+
+	bool Empty() const {
+		return cells[read_pos % queue_size].sequence.load(std::memory_order_acquire) != read_pos + 1;
+	}
+};
+
+LogSink::LogSink()
+: queue(new MessageQueue)
+{
+	messages.reserve(tail_size);
+	drain_thread = std::thread([=] {
+		util::SetThreadName("Log Writer");
+		Drain();
+	});
+}
 
 LogSink::~LogSink() {
+	{
+		std::lock_guard<std::mutex> lock(queue->wake_lock);
+		queue->stop = true;
+	}
+	queue->wake.notify_one();
+	drain_thread.join();
+
 	// The destructor for emitters may try to log messages, so disable all the
 	// emitters before destructing any
 	decltype(emitters) emitters_temp;
-	queue->Sync([&]{ swap(emitters_temp, emitters); });
+	{
+		std::lock_guard<std::mutex> lock(emitters_lock);
+		swap(emitters_temp, emitters);
+	}
+}
+
+void LogSink::Log(SinkMessage sm) {
+	if (!queue->Push(std::move(sm))) {
+		++queue->dropped;
+		return;
+	}
+
+	if (queue->sleeping) {
+		std::lock_guard<std::mutex> lock(queue->wake_lock);
+		queue->wake.notify_one();
+	}
 }
 
-void LogSink::Log(SinkMessage const& sm) {
-	queue->Async([=] {
-		if (messages.size() < 250)
+void LogSink::Emit(SinkMessage const& sm) {
+	{
+		std::lock_guard<std::mutex> lock(messages_lock);
+		if (messages.size() < tail_size)
 			messages.push_back(sm);
 		else {
 			messages[next_idx] = sm;
-			if (++next_idx == 250)
+			if (++next_idx == tail_size)
 				next_idx = 0;
 		}
-		for (auto& em : emitters) em->log(sm);
-	});
+	}
+
+	std::lock_guard<std::mutex> lock(emitters_lock);
+	for (auto& em : emitters) em->log(sm);
+}
+
+void LogSink::Drain() {
+	SinkMessage sm;
+	while (true) {
+		while (queue->Pop(sm)) {
+			Emit(sm);
+			++queue->emitted;
+		}
+
+		if (size_t dropped = queue->dropped.exchange(0)) {
+			SinkMessage note;
+			note.message = std::to_string(dropped) + " log messages dropped";
+			note.time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			note.section = "agi/log";
+			note.file = __FILE__;
+			note.func = __FUNCTION__;
+			note.severity = Warning;
+			note.line = __LINE__;
+			Emit(note);
+		}
+
+		std::unique_lock<std::mutex> lock(queue->wake_lock);
+		queue->flushed.notify_all();
+		if (queue->stop && queue->Empty()) break;
+
+		// Producers only signal when they see sleeping set, and can race
+		// with it being set, so don't sleep for long without rechecking
+		queue->sleeping = true;
+		queue->wake.wait_for(lock, std::chrono::milliseconds(50), [&] {
+			return queue->stop || !queue->Empty();
+		});
+		queue->sleeping = false;
+	}
+}
+
+void LogSink::Flush() {
+	// Emitters which log would wait on themselves
+	if (std::this_thread::get_id() == drain_thread.get_id()) return;
+
+	size_t target = queue->Written();
+	std::unique_lock<std::mutex> lock(queue->wake_lock);
+	queue->wake.notify_one();
+	queue->flushed.wait(lock, [&] { return queue->emitted >= target; });
 }
 
 void LogSink::Subscribe(std::unique_ptr<Emitter> em) {
 	LOG_D("agi/log/emitter/subscribe") << "Subscribe: " << this;
-	auto tmp = em.release();
-	queue->Sync([=] { emitters.emplace_back(tmp); });
+	std::lock_guard<std::mutex> lock(emitters_lock);
+	emitters.emplace_back(std::move(em));
 }
 
 void LogSink::Unsubscribe(Emitter *em) {
-	queue->Sync([=] {
+	{
+		std::lock_guard<std::mutex> lock(emitters_lock);
 		emitters.erase(
 			boost::remove_if(emitters, [=](std::unique_ptr<Emitter> const& e) { return e.get() == em; }),
 			emitters.end());
-	});
+	}
 	LOG_D("agi/log/emitter/unsubscribe") << "Un-Subscribe: " << this;
 }
 
 decltype(LogSink::messages) LogSink::GetMessages() const {
 	decltype(messages) ret;
-	queue->Sync([&] {
-		ret.reserve(messages.size());
-		ret.insert(ret.end(), messages.begin() + next_idx, messages.end());
-		ret.insert(ret.end(), messages.begin(), messages.begin() + next_idx);
-	});
+	std::lock_guard<std::mutex> lock(messages_lock);
+	ret.reserve(messages.size());
+	ret.insert(ret.end(), messages.begin() + next_idx, messages.end());
+	ret.insert(ret.end(), messages.begin(), messages.begin() + next_idx);
 	return ret;
 }
-*/
 
 Message::Message(const char *section, Severity severity, const char *file, const char *func, int line)
 : msg(buffer, sizeof buffer)
@@ -118,7 +363,7 @@ Message::Message(const char *section, Severity severity, const char *file, const
 
 Message::~Message() {
 	sm.message = std::string(buffer, (std::string::size_type)msg.tellp());
-	agi::log::log->Log(sm);
+	agi::log::log->Log(std::move(sm));
 }
 
 JsonEmitter::JsonEmitter(fs::path const& directory)
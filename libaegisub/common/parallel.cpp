@@ -0,0 +1,104 @@
+// Copyright (c) 2026, agent <agent@local>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include "libaegisub/parallel.h"
+
+#include "libaegisub/dispatch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+typedef std::function<void (size_t, size_t, size_t)> ChunkFunc;
+
+/// State shared between the caller and the helper thunks. Helpers which start
+/// after every chunk has been claimed may outlive the call, so they only ever
+/// touch func after successfully claiming a chunk.
+struct Job {
+	size_t count;
+	size_t chunk_count;
+	ChunkFunc const *func;
+
+	std::atomic<size_t> next;
+	std::mutex lock;
+	std::condition_variable finished;
+	size_t done = 0;
+	std::vector<std::exception_ptr> errors;
+
+	Job(size_t count, size_t chunk_count, ChunkFunc const& func)
+	: count(count), chunk_count(chunk_count), func(&func), next(0), errors(chunk_count) { }
+
+	/// Run chunks until there are none left to claim
+	void Work() {
+		for (size_t i; (i = next++) < chunk_count; ) {
+			std::exception_ptr error;
+			try {
+				(*func)(i, count * i / chunk_count, count * (i + 1) / chunk_count);
+			}
+			catch (...) {
+				error = std::current_exception();
+			}
+
+			std::lock_guard<std::mutex> l(lock);
+			errors[i] = error;
+			if (++done == chunk_count)
+				finished.notify_all();
+		}
+	}
+};
+}
+
+namespace agi { namespace parallel {
+
+size_t Concurrency() {
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+size_t ChunkCount(size_t count, size_t min_per_chunk) {
+	return std::max<size_t>(1, std::min(Concurrency(), count / std::max<size_t>(1, min_per_chunk)));
+}
+
+void ForChunks(size_t count, size_t chunk_count, ChunkFunc const& func) {
+	if (!count || !chunk_count) return;
+
+	auto job = std::make_shared<Job>(count, chunk_count, func);
+	size_t helpers = std::min(chunk_count, Concurrency()) - 1;
+	for (size_t i = 0; i < helpers; ++i)
+		dispatch::Background().Async([=] { job->Work(); });
+
+	// Only chunks which another thread has already started are waited on, so
+	// this can't deadlock even if every background thread is busy
+	job->Work();
+	std::unique_lock<std::mutex> l(job->lock);
+	job->finished.wait(l, [&] { return job->done == chunk_count; });
+
+	for (auto const& error : job->errors) {
+		if (error)
+			std::rethrow_exception(error);
+	}
+}
+
+void For(size_t count, std::function<void (size_t)> const& func) {
+	ForChunks(count, count, [&](size_t i, size_t, size_t) { func(i); });
+}
+
+} }
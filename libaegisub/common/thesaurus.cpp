@@ -20,47 +20,176 @@
 
 #include "libaegisub/charset_conv.h"
 #include "libaegisub/file_mapping.h"
-#include "libaegisub/line_iterator.h"
 #include "libaegisub/make_unique.h"
 #include "libaegisub/split.h"
 
-#include <boost/interprocess/streams/bufferstream.hpp>
+#include <algorithm>
+#include <boost/algorithm/string/predicate.hpp>
+#include <cstring>
+
+namespace {
+const uint64_t not_found = UINT64_MAX;
+
+/// A line of the index file, which should be of the form word|offset
+struct IndexLine {
+	const char *key_end;   ///< End of the word (i.e. the first '|')
+	const char *line_end;  ///< End of the line, not including the line terminator
+	const char *next;      ///< Start of the next line
+
+	IndexLine(const char *begin, const char *end) {
+		next = std::find(begin, end, '\n');
+		line_end = next;
+		if (next < end) ++next;
+		if (line_end > begin && line_end[-1] == '\r') --line_end;
+		key_end = std::find(begin, line_end, '|');
+	}
+
+	/// Does the line have exactly one '|'?
+	bool valid() const {
+		return key_end != line_end && std::find(key_end + 1, line_end, '|') == line_end;
+	}
+
+	/// Parse the data file offset, which like atoi is zero if there are no digits
+	uint64_t offset() const {
+		uint64_t ret = 0;
+		for (auto p = key_end + 1; p < line_end && *p >= '0' && *p <= '9'; ++p)
+			ret = ret * 10 + (*p - '0');
+		return ret;
+	}
+};
+
+/// Bytewise comparison of the word of the line starting at begin with word
+int compare(const char *begin, const char *key_end, const char *word, size_t word_len) {
+	size_t key_len = key_end - begin;
+	if (int cmp = memcmp(begin, word, std::min(key_len, word_len)))
+		return cmp;
+	return key_len < word_len ? -1 : key_len > word_len;
+}
+
+/// Find the start of the line containing pos
+const char *line_start(const char *begin, const char *pos) {
+	while (pos > begin && pos[-1] != '\n') --pos;
+	return pos;
+}
+}
 
 namespace agi {
 
 Thesaurus::Thesaurus(agi::fs::path const& dat_path, agi::fs::path const& idx_path)
-: dat(make_unique<read_file_mapping>(dat_path))
+: idx(make_unique<read_file_mapping>(idx_path))
+, dat(make_unique<read_file_mapping>(dat_path))
 {
-	read_file_mapping idx_file(idx_path);
-	boost::interprocess::ibufferstream idx(idx_file.read(), static_cast<size_t>(idx_file.size()));
+	idx_begin = idx->read();
+	idx_end = idx_begin + idx->size();
 
-	std::string encoding_name;
-	getline(idx, encoding_name);
-	std::string unused_entry_count;
-	getline(idx, unused_entry_count);
+	// The first line is the encoding and the second the (unused) entry count
+	IndexLine encoding_line(idx_begin, idx_end);
+	std::string encoding_name(idx_begin, encoding_line.line_end);
+	idx_begin = IndexLine(encoding_line.next, idx_end).next;
 
 	conv = make_unique<charset::IconvWrapper>(encoding_name.c_str(), "utf-8");
+	if (!boost::iequals(encoding_name, "utf-8") && !boost::iequals(encoding_name, "utf8"))
+		conv_to_dict = make_unique<charset::IconvWrapper>("utf-8", encoding_name.c_str(), false);
+}
+
+Thesaurus::~Thesaurus() { }
+
+void Thesaurus::CheckIndex() {
+	index_checked = true;
+
+	// MyThes indices are normally sorted, in which case they can be binary
+	// searched in place without building anything
+	bool sorted = true;
+	const char *prev = nullptr, *prev_key_end = nullptr;
+	for (auto pos = idx_begin; pos < idx_end; ) {
+		IndexLine line(pos, idx_end);
+		if (prev && compare(prev, prev_key_end, pos, line.key_end - pos) > 0) {
+			sorted = false;
+			break;
+		}
+		prev = pos;
+		prev_key_end = line.key_end;
+		pos = line.next;
+	}
+	if (sorted) return;
 
-	// Read the list of words and file offsets for those words
-	for (auto const& line : line_iterator<std::string>(idx, encoding_name)) {
-		auto pos = line.find('|');
-		if (pos != line.npos && line.find('|', pos + 1) == line.npos)
-			offsets[line.substr(0, pos)] = static_cast<size_t>(atoi(line.c_str() + pos + 1));
+	for (auto pos = idx_begin; pos < idx_end; ) {
+		IndexLine line(pos, idx_end);
+		if (line.valid())
+			sorted_lines.push_back(static_cast<uint32_t>(pos - idx_begin));
+		pos = line.next;
 	}
+
+	auto base = idx_begin, last = idx_end;
+	std::stable_sort(begin(sorted_lines), end(sorted_lines), [=](uint32_t a, uint32_t b) {
+		auto key_b = IndexLine(base + b, last).key_end;
+		return compare(base + a, IndexLine(base + a, last).key_end, base + b, key_b - (base + b)) < 0;
+	});
 }
 
-Thesaurus::~Thesaurus() { }
+uint64_t Thesaurus::FindOffset(std::string const& word) {
+	if (!index_checked) CheckIndex();
+
+	auto key_cmp = [&](const char *line) {
+		return compare(line, IndexLine(line, idx_end).key_end, word.data(), word.size());
+	};
+
+	if (!sorted_lines.empty()) {
+		auto it = std::upper_bound(begin(sorted_lines), end(sorted_lines), word,
+			[&](std::string const&, uint32_t line) { return key_cmp(idx_begin + line) > 0; });
+		// When a word appears more than once the last entry wins
+		if (it == begin(sorted_lines) || key_cmp(idx_begin + *--it) != 0)
+			return not_found;
+		return IndexLine(idx_begin + *it, idx_end).offset();
+	}
+
+	auto lo = idx_begin, hi = idx_end;
+	const char *match = nullptr;
+	while (lo < hi) {
+		auto mid = line_start(lo, lo + (hi - lo) / 2);
+		int cmp = key_cmp(mid);
+		if (cmp < 0)
+			lo = IndexLine(mid, idx_end).next;
+		else if (cmp > 0)
+			hi = mid;
+		else {
+			match = mid;
+			break;
+		}
+	}
+	if (!match) return not_found;
+
+	// Duplicate words are adjacent; use the last well-formed one
+	while (match > idx_begin) {
+		auto prev = line_start(idx_begin, match - 1);
+		if (key_cmp(prev) != 0) break;
+		match = prev;
+	}
+	uint64_t offset = not_found;
+	for (; match < idx_end && key_cmp(match) == 0; match = IndexLine(match, idx_end).next) {
+		IndexLine line(match, idx_end);
+		if (line.valid())
+			offset = line.offset();
+	}
+	return offset;
+}
 
 std::vector<Thesaurus::Entry> Thesaurus::Lookup(std::string const& word) {
 	std::vector<Entry> out;
 	if (!dat) return out;
 
-	auto it = offsets.find(word);
-	if (it == offsets.end()) return out;
-	if (it->second >= dat->size()) return out;
+	uint64_t offset;
+	try {
+		offset = FindOffset(conv_to_dict ? conv_to_dict->Convert(word) : word);
+	}
+	catch (charset::ConvError const&) {
+		// The word can't be represented in the dictionary's charset
+		return out;
+	}
+	if (offset >= dat->size()) return out;
 
-	auto len = dat->size() - it->second;
-	auto buff = dat->read(it->second, len);
+	auto len = dat->size() - offset;
+	auto buff = dat->read(offset, len);
 	auto buff_end = buff + len;
 
 	std::string temp;
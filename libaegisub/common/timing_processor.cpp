@@ -0,0 +1,149 @@
+// Copyright (c) 2026, agent <agent@local>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include "libaegisub/timing_processor.h"
+
+#include "libaegisub/vfr.h"
+
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <queue>
+
+namespace {
+using agi::timing::Line;
+using agi::timing::Settings;
+
+void add_lead_in(std::vector<Line> &lines, int lead_in) {
+	// A line can be extended back to the end of the latest earlier line which
+	// it doesn't already overlap. As start times only increase, once an end
+	// time is before the start of one line it is before all following ones,
+	// so the ends only need to be examined once each.
+	std::priority_queue<int, std::vector<int>, std::greater<int>> pending;
+	int limit = INT_MIN;
+	for (size_t i = 0; i < lines.size(); ++i) {
+		int start = lines[i].Start;
+		if (i > 0)
+			pending.push(lines[i - 1].End);
+		for (; !pending.empty() && pending.top() <= start; pending.pop())
+			limit = std::max(limit, pending.top());
+		lines[i].Start = std::max(start - lead_in, limit);
+	}
+}
+
+void add_lead_out(std::vector<Line> &lines, int lead_out) {
+	// Adding lead-in leaves the lines sorted by start time, so the first
+	// later line which starts after a line ends can be binary searched for
+	std::vector<int> starts;
+	starts.reserve(lines.size());
+	for (auto const& line : lines)
+		starts.push_back(line.Start);
+
+	// Zero-length lines never overlap the other lines starting at the same
+	// time, so they limit the lead-out of those lines to nothing
+	std::vector<char> zero_after(lines.size());
+	for (size_t i = lines.size() - 1; i-- > 0; ) {
+		zero_after[i] = starts[i + 1] == starts[i]
+			&& ((int)lines[i + 1].End <= starts[i + 1] || zero_after[i + 1]);
+	}
+
+	for (size_t i = 0; i < lines.size(); ++i) {
+		int end = lines[i].End;
+		int limit = end + lead_out;
+		if (zero_after[i])
+			limit = std::min(limit, starts[i]);
+
+		auto later = std::upper_bound(begin(starts) + i + 1, std::end(starts), starts[i]);
+		auto next = std::lower_bound(later, std::end(starts), end);
+		if (next != std::end(starts))
+			limit = std::min(limit, *next);
+		lines[i].End = limit;
+	}
+}
+
+void make_adjacent(std::vector<Line> &lines, Settings const& settings) {
+	for (size_t i = 1; i < lines.size(); ++i) {
+		Line &prev = lines[i - 1];
+		Line &cur = lines[i];
+
+		int dist = cur.Start - prev.End;
+		if ((dist < 0 && -dist <= settings.adjacent_overlap) || (dist > 0 && dist <= settings.adjacent_gap)) {
+			int setPos = prev.End + int(dist * settings.adjacent_bias);
+			cur.Start = setPos;
+			prev.End = setPos;
+		}
+	}
+}
+
+/// Index of the keyframe closest to the given frame
+size_t closest_keyframe(std::vector<int> const& kf, int frame) {
+	const auto pos = std::upper_bound(begin(kf), end(kf), frame);
+	// Return last keyframe if this is after the last one
+	if (pos == end(kf)) return kf.size() - 1;
+	// *pos is greater than frame, and *(pos - 1) is less than or equal to frame
+	if (pos == begin(kf) || *pos - frame < frame - *(pos - 1))
+		return pos - begin(kf);
+	return pos - begin(kf) - 1;
+}
+
+void snap_to_keyframes(std::vector<Line> &lines, Settings const& settings, std::vector<int> const& kf, agi::vfr::Framerate const& fps) {
+	if (kf.empty()) return;
+
+	// Times which each keyframe snaps start and end times to
+	std::vector<int> start_times, end_times;
+	start_times.reserve(kf.size());
+	end_times.reserve(kf.size());
+	for (int frame : kf) {
+		start_times.push_back(fps.TimeAtFrame(frame, agi::vfr::START));
+		end_times.push_back(fps.TimeAtFrame(frame - 1, agi::vfr::END));
+	}
+
+	for (auto &cur : lines) {
+		// Get start/end frames
+		int startF = fps.FrameAtTime(cur.Start, agi::vfr::START);
+		int endF = fps.FrameAtTime(cur.End, agi::vfr::END);
+
+		// Get closest for start
+		size_t idx = closest_keyframe(kf, startF);
+		int closest = kf[idx];
+		int time = start_times[idx];
+		if ((closest > startF && time - cur.Start <= settings.before_start) || (closest < startF && cur.Start - time <= settings.after_start))
+			cur.Start = time;
+
+		// Get closest for end
+		idx = closest_keyframe(kf, endF);
+		closest = kf[idx] - 1;
+		time = end_times[idx];
+		if ((closest > endF && time - cur.End <= settings.before_end) || (closest < endF && cur.End - time <= settings.after_end))
+			cur.End = time;
+	}
+}
+}
+
+namespace agi { namespace timing {
+void Process(std::vector<Line> &lines, Settings const& settings, std::vector<int> const& keyframes, vfr::Framerate const& fps) {
+	if (lines.empty()) return;
+
+	if (settings.lead_in > 0)
+		add_lead_in(lines, settings.lead_in);
+	if (settings.lead_out > 0)
+		add_lead_out(lines, settings.lead_out);
+	if (settings.adjacent)
+		make_adjacent(lines, settings);
+	if (settings.keyframes)
+		snap_to_keyframes(lines, settings, keyframes, fps);
+}
+} }
@@ -16,7 +16,23 @@
 
 #include "libaegisub/ycbcr_conv.h"
 
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AGI_YCBCR_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace {
+/// Fractional bits used by the fixed-point converters
+const int fixed_shift = 13;
+
+uint8_t clamp_fixed(int v) {
+	if (v < 0) return 0;
+	v >>= fixed_shift;
+	return v > 255 ? 255 : v;
+}
+
 double matrix_coefficients[][3] = {
 	{.299, .587, .114},    // BT.601
 	{.2126, .7152, .0722}, // BT.709
@@ -85,14 +101,97 @@ void ycbcr_converter::init_dst(ycbcr_matrix dst_mat, ycbcr_range dst_range) {
 	}
 }
 
+void ycbcr_converter::init_fixed() {
+	for (size_t i = 0; i < from_ycbcr.size(); ++i)
+		from_ycbcr_fixed[i] = static_cast<int16_t>(std::lround(from_ycbcr[i] * (1 << fixed_shift)));
+	for (size_t i = 0; i < shift_from.size(); ++i)
+		shift_from_fixed[i] = static_cast<int16_t>(shift_from[i]);
+}
+
 ycbcr_converter::ycbcr_converter(ycbcr_matrix mat, ycbcr_range range) {
 	init_src(mat, range);
 	init_dst(mat, range);
+	init_fixed();
 }
 
 ycbcr_converter::ycbcr_converter(ycbcr_matrix src_mat, ycbcr_range src_range, ycbcr_matrix dst_mat, ycbcr_range dst_range) {
 	init_src(src_mat, src_range);
 	init_dst(dst_mat, dst_range);
+	init_fixed();
+}
+
+void ycbcr_converter::ycbcr_to_bgra_row(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, size_t width) const {
+	auto const& m = from_ycbcr_fixed;
+	size_t x = 0;
+
+#ifdef AGI_YCBCR_SSE2
+	// 16 pixels per iteration. Each output channel is computed as
+	// madd((y, u), (m0, m1)) + madd((v, 1), (m2, round)) on 32-bit lanes.
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i y_shift = _mm_set1_epi16(shift_from_fixed[0]);
+	const __m128i u_shift = _mm_set1_epi16(shift_from_fixed[1]);
+	const __m128i v_shift = _mm_set1_epi16(shift_from_fixed[2]);
+	const __m128i one = _mm_set1_epi16(1);
+
+	auto pair = [](int16_t a, int16_t b) {
+		return _mm_set1_epi32((int)(uint16_t)a | ((int)(uint16_t)b << 16));
+	};
+	const int16_t round = 1 << (fixed_shift - 1);
+	const __m128i yu_coeff[3] = {pair(m[0], m[1]), pair(m[3], m[4]), pair(m[6], m[7])};
+	const __m128i v_coeff[3] = {pair(m[2], round), pair(m[5], round), pair(m[8], round)};
+
+	// Convert eight pixels to three vectors of eight 16-bit channel values
+	auto convert8 = [&](__m128i y8, __m128i u8, __m128i v8, __m128i *out) {
+		__m128i yu_lo = _mm_unpacklo_epi16(y8, u8);
+		__m128i yu_hi = _mm_unpackhi_epi16(y8, u8);
+		__m128i v1_lo = _mm_unpacklo_epi16(v8, one);
+		__m128i v1_hi = _mm_unpackhi_epi16(v8, one);
+		for (int c = 0; c < 3; ++c) {
+			__m128i lo = _mm_add_epi32(_mm_madd_epi16(yu_lo, yu_coeff[c]), _mm_madd_epi16(v1_lo, v_coeff[c]));
+			__m128i hi = _mm_add_epi32(_mm_madd_epi16(yu_hi, yu_coeff[c]), _mm_madd_epi16(v1_hi, v_coeff[c]));
+			out[c] = _mm_packs_epi32(_mm_srai_epi32(lo, fixed_shift), _mm_srai_epi32(hi, fixed_shift));
+		}
+	};
+
+	for (; x + 16 <= width; x += 16) {
+		__m128i y16 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(y + x));
+		__m128i u16 = _mm_add_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(u + x / 2)), zero), u_shift);
+		__m128i v16 = _mm_add_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(v + x / 2)), zero), v_shift);
+
+		__m128i lo[3], hi[3];
+		convert8(_mm_add_epi16(_mm_unpacklo_epi8(y16, zero), y_shift),
+			_mm_unpacklo_epi16(u16, u16), _mm_unpacklo_epi16(v16, v16), lo);
+		convert8(_mm_add_epi16(_mm_unpackhi_epi8(y16, zero), y_shift),
+			_mm_unpackhi_epi16(u16, u16), _mm_unpackhi_epi16(v16, v16), hi);
+
+		__m128i r = _mm_packus_epi16(lo[0], hi[0]);
+		__m128i g = _mm_packus_epi16(lo[1], hi[1]);
+		__m128i b = _mm_packus_epi16(lo[2], hi[2]);
+
+		__m128i bg_lo = _mm_unpacklo_epi8(b, g);
+		__m128i bg_hi = _mm_unpackhi_epi8(b, g);
+		__m128i rx_lo = _mm_unpacklo_epi8(r, zero);
+		__m128i rx_hi = _mm_unpackhi_epi8(r, zero);
+
+		auto out = reinterpret_cast<__m128i *>(dst + x * 4);
+		_mm_storeu_si128(out + 0, _mm_unpacklo_epi16(bg_lo, rx_lo));
+		_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(bg_lo, rx_lo));
+		_mm_storeu_si128(out + 2, _mm_unpacklo_epi16(bg_hi, rx_hi));
+		_mm_storeu_si128(out + 3, _mm_unpackhi_epi16(bg_hi, rx_hi));
+	}
+#endif
+
+	for (; x < width; ++x) {
+		int yv = y[x] + shift_from_fixed[0];
+		int uv = u[x / 2] + shift_from_fixed[1];
+		int vv = v[x / 2] + shift_from_fixed[2];
+		const int round = 1 << (fixed_shift - 1);
+		uint8_t *px = dst + x * 4;
+		px[0] = clamp_fixed(m[6] * yv + m[7] * uv + m[8] * vv + round);
+		px[1] = clamp_fixed(m[3] * yv + m[4] * uv + m[5] * vv + round);
+		px[2] = clamp_fixed(m[0] * yv + m[1] * uv + m[2] * vv + round);
+		px[3] = 0;
+	}
 }
 }
 
@@ -0,0 +1,92 @@
+// Copyright (c) 2026, agent <agent@local>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+
+#pragma once
+
+#include <libaegisub/fs_fwd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace agi {
+class AudioProvider;
+
+/// Summary of a block of 16-bit mono audio as drawn by the waveform display
+struct AudioPeak {
+	int16_t min;     ///< Lowest sample, or zero if there are no negative samples
+	int16_t max;     ///< Highest sample, or zero if there are no positive samples
+	int16_t avg_min; ///< Sum of the negative samples divided by the block size
+	int16_t avg_max; ///< Sum of the positive samples divided by the block size
+};
+
+/// @class AudioPeakPyramid
+/// @brief Precomputed peaks of audio at power-of-two decimations
+///
+/// Level zero summarises blocks of base_block samples, and each level after
+/// that summarises pairs of blocks from the level below, so drawing any zoom
+/// level only has to read a few values per pixel. The pyramid is filled in
+/// order by a single writer with Append() while readers use whatever part
+/// of it is already complete.
+class AudioPeakPyramid {
+	std::vector<std::vector<AudioPeak>> levels;
+	int64_t num_samples;
+	/// Number of samples which have been summarised at every level
+	std::atomic<int64_t> ready_samples{0};
+
+	// State of the partially filled level zero block; only touched by the writer
+	int64_t appended = 0;
+	int cur_count = 0;
+	int16_t cur_min = 0, cur_max = 0;
+	int32_t cur_sum_min = 0, cur_sum_max = 0;
+
+	void FinishBlock();
+
+public:
+	/// Number of samples in each level zero block
+	static const int base_block = 512;
+
+	/// @param num_samples Total number of samples which will be appended
+	AudioPeakPyramid(int64_t num_samples);
+
+	/// Create an empty pyramid for the audio from a provider
+	/// @return nullptr if the provider's audio isn't 16-bit mono
+	static std::unique_ptr<AudioPeakPyramid> Create(AudioProvider const& provider);
+
+	/// Add the next count samples to the pyramid
+	void Append(const int16_t *samples, size_t count);
+
+	/// Get the number of samples which have been fully summarised
+	int64_t GetReadySamples() const { return ready_samples.load(std::memory_order_acquire); }
+
+	/// Get the coarsest level whose blocks are no longer than the given
+	/// number of samples, or -1 if level zero's are too long
+	int GetLevel(double max_block_samples) const;
+
+	/// Combine the blocks at the given level which start in [start, end)
+	/// @return false if any of the blocks have not been computed yet
+	bool GetPeak(int level, int64_t start, int64_t end, AudioPeak &out) const;
+
+	/// Write a complete pyramid to a file
+	void Save(fs::path const& filename) const;
+
+	/// Read a pyramid written with Save
+	/// @return nullptr if the file doesn't exist or doesn't match num_samples
+	static std::unique_ptr<AudioPeakPyramid> Load(fs::path const& filename, int64_t num_samples);
+};
+}
@@ -23,6 +23,8 @@
 #include <vector>
 
 namespace agi {
+class AudioPeakPyramid;
+
 class AudioProvider {
 protected:
 	int channels = 0;
@@ -34,6 +36,8 @@ protected:
 	int sample_rate = 0;
 	int bytes_per_sample = 0;
 	bool float_samples = false;
+	/// Index of the track in the source file, or -1 if not applicable
+	int track = -1;
 
 	virtual void FillBuffer(void *buf, int64_t start, int64_t count) const = 0;
 
@@ -51,9 +55,13 @@ public:
 	int     GetBytesPerSample() const { return bytes_per_sample; }
 	int     GetChannels()       const { return channels; }
 	bool    AreSamplesFloat()   const { return float_samples; }
+	int     GetTrack()          const { return track; }
 
 	/// Does this provider benefit from external caching?
 	virtual bool NeedsCache() const { return false; }
+
+	/// Get precomputed waveform peaks for the audio, if the provider has them
+	virtual AudioPeakPyramid const *GetPeaks() const { return nullptr; }
 };
 
 /// Helper base class for an audio provider which wraps another provider
@@ -70,6 +78,7 @@ public:
 		sample_rate = source->GetSampleRate();
 		bytes_per_sample = source->GetBytesPerSample();
 		float_samples = source->AreSamplesFloat();
+		track = source->GetTrack();
 	}
 };
 
@@ -89,6 +98,12 @@ std::unique_ptr<AudioProvider> CreatePCMAudioProvider(fs::path const& filename,
 std::unique_ptr<AudioProvider> CreateConvertAudioProvider(std::unique_ptr<AudioProvider> source_provider);
 std::unique_ptr<AudioProvider> CreateLockAudioProvider(std::unique_ptr<AudioProvider> source_provider);
 std::unique_ptr<AudioProvider> CreateHDAudioProvider(std::unique_ptr<AudioProvider> source_provider, fs::path const& dir);
+/// Create a HD cache which is kept in dir after the provider is destroyed and
+/// is memory-mapped rather than decoded again when opened with the same
+/// cache_key, including by other processes
+/// @param cache_key Identifier for the source file and track; the sample
+///                  format is added to it by this function
+std::unique_ptr<AudioProvider> CreatePersistentHDAudioProvider(std::unique_ptr<AudioProvider> source_provider, fs::path const& dir, std::string const& cache_key);
 std::unique_ptr<AudioProvider> CreateRAMAudioProvider(std::unique_ptr<AudioProvider> source_provider);
 
 void SaveAudioClip(AudioProvider const& provider, fs::path const& path, int start_time, int end_time);
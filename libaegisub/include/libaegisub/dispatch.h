@@ -14,6 +14,8 @@
 //
 // Aegisub Project http://www.aegisub.org/
 
+#include <chrono>
+#include <cstddef>
 #include <functional>
 #include <memory>
 
@@ -38,6 +40,17 @@ namespace agi {
 		/// @param invoke_main A function which invokes the thunk on the GUI thread
 		void Init(std::function<void (Thunk)> invoke_main);
 
+		/// Initialize the dispatch thread pools for use without a GUI event
+		/// loop. The calling thread becomes the main thread, and thunks sent
+		/// to the main queue wait until it calls ProcessMainQueue.
+		void Init();
+
+		/// Run the thunks currently waiting on the main queue when initialized
+		/// without a GUI event loop. Must be called from the main thread.
+		/// @param timeout Time to wait for a thunk to arrive if none are queued
+		/// @return Number of thunks run
+		size_t ProcessMainQueue(std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
 		/// Get the main queue, which runs on the GUI thread
 		Queue& Main();
 
@@ -14,14 +14,21 @@
 
 #include <libaegisub/fs_fwd.h>
 
+#include <atomic>
 #include <boost/interprocess/streams/bufferstream.hpp>
 #include <cstdint>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
 // These macros below aren't a perm solution, it will depend on how annoying they are through
 // actual usage, and also depends on msvc support.
-#define LOG_SINK(section, severity) agi::log::Message(section, severity, __FILE__, __FUNCTION__, __LINE__).stream()
+// The message is only formatted if the severity is enabled for the section.
+#define LOG_SINK(section, severity) \
+	!agi::log::Enabled(section, severity) ? (void)0 : \
+	agi::log::Voidify() & agi::log::Message(section, severity, __FILE__, __FUNCTION__, __LINE__).stream()
 #define LOG_E(section) LOG_SINK(section, agi::log::Exception)
 #define LOG_A(section) LOG_SINK(section, agi::log::Assert)
 #define LOG_W(section) LOG_SINK(section, agi::log::Warning)
@@ -33,7 +40,6 @@
 #define LOG_D_IF(cond, section) if (cond) LOG_SINK(section, agi::log::Debug)
 
 namespace agi {
-namespace dispatch { class Queue; }
 namespace log {
 
 class LogSink;
@@ -54,6 +60,42 @@ extern const char *Severity_ID;
 /// Global log sink.
 extern LogSink *log;
 
+/// Most verbose severity enabled for any section
+extern std::atomic<int> max_severity;
+/// Are there any per-section levels to check?
+extern std::atomic<bool> has_section_levels;
+
+/// Check the per-section levels for a message which passed the global check
+bool SectionEnabled(const char *section, Severity severity);
+
+/// Will a message with the given section and severity be recorded?
+inline bool Enabled(const char *section, Severity severity) {
+	if (!log || severity > max_severity.load(std::memory_order_relaxed))
+		return false;
+	return !has_section_levels.load(std::memory_order_relaxed) || SectionEnabled(section, severity);
+}
+
+/// Set the most verbose severity recorded for sections without a level of
+/// their own
+void SetLevel(Severity severity);
+
+/// Set the most verbose severity recorded for a section and its subsections,
+/// so that "video" also covers "video/open"
+void SetSectionLevel(std::string const& section, Severity severity);
+
+/// Remove all per-section levels
+void ClearSectionLevels();
+
+/// @brief Replace all of the levels with ones parsed from a string
+/// @param spec Comma-separated list of entries, each of which is either a
+///             severity name, which sets the level for sections without one
+///             of their own, or section=severity. Severity names are
+///             exception, assert, warning, info and debug. Sections not
+///             covered by the string log everything.
+/// @throws InvalidInputException if spec is malformed, in which case the
+///         current levels are left unchanged
+void SetLevels(std::string const& spec);
+
 /// Container to hold a single message
 struct SinkMessage {
 	std::string message; ///< Formatted message
@@ -69,19 +111,33 @@ class Emitter;
 
 /// Log sink, single destination for all messages
 class LogSink {
+	/// Most recent messages, for the log window and crash reports
 	std::vector<SinkMessage> messages;
 	size_t next_idx = 0;
-	std::unique_ptr<dispatch::Queue> queue;
+	mutable std::mutex messages_lock;
 
 	/// List of pointers to emitters
 	std::vector<std::unique_ptr<Emitter>> emitters;
+	std::mutex emitters_lock;
+
+	/// Lock-free queue of messages waiting for the drain thread
+	class MessageQueue;
+	std::unique_ptr<MessageQueue> queue;
+	std::thread drain_thread;
+
+	void Drain();
+	void Emit(SinkMessage const& sm);
 
 public:
 	LogSink();
 	~LogSink();
 
-	/// Insert a message into the sink.
-	void Log(SinkMessage const& sm);
+	/// Insert a message into the sink. Never blocks; if the drain thread
+	/// has fallen too far behind the message is dropped.
+	void Log(SinkMessage sm);
+
+	/// Block until all messages logged before the call have been emitted
+	void Flush();
 
 	/// @brief Subscribe an emitter
 	/// @param em Emitter to add
@@ -119,6 +175,12 @@ public:
 };
 
 /// Generates a message and submits it to the log sink.
+/// Helper for LOG_SINK which turns the stream expression into void so that
+/// both branches of the conditional have the same type
+struct Voidify {
+	void operator&(std::ostream&) { }
+};
+
 class Message {
 	boost::interprocess::obufferstream msg;
 	SinkMessage sm;
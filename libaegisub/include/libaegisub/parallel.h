@@ -0,0 +1,51 @@
+// Copyright (c) 2026, agent <agent@local>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace agi {
+	namespace parallel {
+		/// Number of threads CPU-bound work should be spread over
+		size_t Concurrency();
+
+		/// @brief Number of chunks to split a piece of work into
+		/// @param count Number of items to process
+		/// @param min_per_chunk Fewest items which are worth handing to another thread
+		/// @return Between 1 and Concurrency()
+		size_t ChunkCount(size_t count, size_t min_per_chunk);
+
+		/// @brief Run a function over contiguous chunks of [0, count) on the background queue
+		/// @param count Number of items
+		/// @param chunk_count Number of chunks to split the items into
+		/// @param func Called as func(chunk, begin, end) once for each chunk
+		///
+		/// Chunk i covers [count * i / chunk_count, count * (i + 1) / chunk_count).
+		/// The calling thread processes chunks as well, so this is safe to use
+		/// from within a thunk running on the background queue. Returns once
+		/// every chunk has finished. If any chunk throws, the exception from
+		/// the lowest-numbered failing chunk is then rethrown.
+		void ForChunks(size_t count, size_t chunk_count, std::function<void (size_t chunk, size_t begin, size_t end)> const& func);
+
+		/// @brief Call func(i) for each i in [0, count) on the background queue
+		///
+		/// Each item is scheduled separately, so this suits small numbers of
+		/// expensive items. Exceptions are handled as in ForChunks.
+		void For(size_t count, std::function<void (size_t)> const& func);
+	}
+}
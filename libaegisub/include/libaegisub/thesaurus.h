@@ -14,8 +14,7 @@
 
 #include "fs_fwd.h"
 
-#include <boost/container/flat_map.hpp>
-#include <iosfwd>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
@@ -26,12 +25,27 @@ class read_file_mapping;
 namespace charset { class IconvWrapper; }
 
 class Thesaurus {
-	/// Map of word -> byte position in the data file
-	boost::container::flat_map<std::string, size_t> offsets;
+	/// Read handle to the index file, which is kept mapped and searched in place
+	std::unique_ptr<read_file_mapping> idx;
+	/// Range of the index file containing the word lines
+	const char *idx_begin = nullptr;
+	const char *idx_end = nullptr;
+	/// Has the index been checked for whether it's sorted yet?
+	bool index_checked = false;
+	/// Start offsets of the valid word lines sorted by word, used only when
+	/// the index file is not already sorted
+	std::vector<uint32_t> sorted_lines;
+
 	/// Read handle to the data file
 	std::unique_ptr<read_file_mapping> dat;
 	/// Converter from the data file's charset to UTF-8
 	std::unique_ptr<charset::IconvWrapper> conv;
+	/// Converter from UTF-8 to the index file's charset, or null if it is UTF-8
+	std::unique_ptr<charset::IconvWrapper> conv_to_dict;
+
+	void CheckIndex();
+	/// Get the data file offset for a word in the index file's charset
+	uint64_t FindOffset(std::string const& word);
 
 public:
 	/// A pair of a word and synonyms for that word
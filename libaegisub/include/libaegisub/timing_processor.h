@@ -0,0 +1,61 @@
+// Copyright (c) 2026, agent <agent@local>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#pragma once
+
+#include <libaegisub/ass/time.h>
+
+#include <vector>
+
+namespace agi {
+	namespace vfr { class Framerate; }
+
+	namespace timing {
+		/// Start and end time of a line to be processed
+		struct Line {
+			Time Start;
+			Time End;
+		};
+
+		/// Timing post-processor settings. All durations are in milliseconds
+		/// and must not be negative.
+		struct Settings {
+			int lead_in = 0;  ///< Lead-in to add, or zero for none
+			int lead_out = 0; ///< Lead-out to add, or zero for none
+
+			bool adjacent = false;     ///< Snap adjacent lines to each other
+			int adjacent_gap = 0;      ///< Maximum gap between lines to close
+			int adjacent_overlap = 0;  ///< Maximum overlap between lines to remove
+			double adjacent_bias = 0;  ///< Where in the gap or overlap to put the shared time, from 0 (end of the first line) to 1 (start of the second)
+
+			bool keyframes = false; ///< Snap start and end times to keyframes
+			int before_start = 0;  ///< Maximum distance to move start times forwards to a keyframe
+			int after_start = 0;   ///< Maximum distance to move start times backwards to a keyframe
+			int before_end = 0;    ///< Maximum distance to move end times forwards to a keyframe
+			int after_end = 0;     ///< Maximum distance to move end times backwards to a keyframe
+		};
+
+		/// @brief Add lead-in/out, make lines adjacent and snap lines to keyframes
+		/// @param lines Lines to process, sorted by start time. No line may have a negative duration.
+		/// @param settings Which steps to perform and their thresholds
+		/// @param keyframes Sorted keyframe frame numbers to snap to
+		/// @param fps Frame rate for converting between times and keyframes
+		///
+		/// Lead-in and lead-out are only added up to the edges of the
+		/// neighboring lines which a line doesn't already overlap.
+		void Process(std::vector<Line> &lines, Settings const& settings, std::vector<int> const& keyframes, vfr::Framerate const& fps);
+	}
+}
@@ -15,6 +15,7 @@
 // Aegisub Project http://www.aegisub.org/
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
 
 #include <libaegisub/color.h>
@@ -40,8 +41,13 @@ class ycbcr_converter {
 	std::array<double, 3> shift_from;
 	std::array<double, 3> shift_to;
 
+	/// from_ycbcr and shift_from in 3.13 fixed point for the bulk converters
+	std::array<int16_t, 9> from_ycbcr_fixed;
+	std::array<int16_t, 3> shift_from_fixed;
+
 	void init_dst(ycbcr_matrix dst_mat, ycbcr_range dst_range);
 	void init_src(ycbcr_matrix src_mat, ycbcr_range src_range);
+	void init_fixed();
 
 	template<typename T>
 	static std::array<double, 3> prod(std::array<double, 9> m, std::array<T, 3> v) {
@@ -81,6 +87,18 @@ public:
 		return to_uint8_t(prod(from_ycbcr, add(input, shift_from)));
 	}
 
+	/// Convert a row of planar pixels with 2:1 horizontally subsampled chroma
+	/// to packed BGRX from src_mat/src_range
+	/// @param y Luma samples; width bytes are read
+	/// @param u Cb samples; (width + 1) / 2 bytes are read
+	/// @param v Cr samples; (width + 1) / 2 bytes are read
+	/// @param dst Destination; width * 4 bytes are written, with the X byte set to 0
+	/// @param width Number of pixels in the row
+	///
+	/// This uses fixed-point math, so results may differ from ycbcr_to_rgb
+	/// by one in either direction.
+	void ycbcr_to_bgra_row(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, size_t width) const;
+
 	/// Convert rgb to ycbcr using src_mat and then back using dst_mat
 	std::array<uint8_t, 3> rgb_to_rgb(std::array<uint8_t, 3> input) const {
 		return to_uint8_t(prod(from_ycbcr,
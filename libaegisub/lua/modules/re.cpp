@@ -15,9 +15,12 @@
 // Aegisub Project http://www.aegisub.org/
 
 #include "libaegisub/lua/ffi.h"
-#include "libaegisub/make_unique.h"
 
+#include <boost/functional/hash.hpp>
 #include <boost/regex/icu.hpp>
+#include <list>
+#include <mutex>
+#include <unordered_map>
 
 using boost::u32regex;
 namespace {
@@ -43,35 +46,84 @@ namespace agi {
 
 namespace {
 using match = agi_re_match;
+
+/// Process-wide LRU cache of compiled regular expressions keyed on pattern
+/// and flags. Copies of a u32regex share the compiled state, so a cache hit
+/// only costs a reference count increment.
+class RegexCache {
+	typedef std::pair<std::string, int> key_type;
+	typedef std::list<std::pair<key_type, u32regex>> list_type;
+
+	static const size_t max_size = 256;
+
+	std::mutex lock;
+	list_type entries; ///< Most recently used first
+	std::unordered_map<key_type, list_type::iterator, boost::hash<key_type>> index;
+
+public:
+	u32regex Get(const char *pattern, int flags) {
+		key_type key(pattern, flags);
+		{
+			std::lock_guard<std::mutex> l(lock);
+			auto it = index.find(key);
+			if (it != index.end()) {
+				entries.splice(entries.begin(), entries, it->second);
+				return it->second->second;
+			}
+		}
+
+		// Compile without holding the lock; throws on invalid patterns,
+		// which are deliberately not cached
+		auto re = boost::make_u32regex(pattern, boost::u32regex::perl | flags);
+
+		std::lock_guard<std::mutex> l(lock);
+		if (index.find(key) == index.end()) {
+			entries.emplace_front(key, re);
+			index[key] = entries.begin();
+			if (entries.size() > max_size) {
+				index.erase(entries.back().first);
+				entries.pop_back();
+			}
+		}
+		return re;
+	}
+};
+
+RegexCache& regex_cache() {
+	static RegexCache cache;
+	return cache;
+}
+
 bool search(u32regex& re, const char *str, size_t len, int start, boost::cmatch& result) {
 	return u32regex_search(str + start, str + len, result, re,
 		start > 0 ? boost::match_prev_avail | boost::match_not_bob : boost::match_default);
 }
 
-match *regex_match(u32regex& re, const char *str, size_t len, int start) {
-	auto result = agi::make_unique<match>();
-	if (!search(re, str, len, start, result->m))
-		return nullptr;
-	return result.release();
+match *match_new() { return new match; }
+
+/// Match into a caller-owned match object, which reuses its storage between
+/// calls rather than allocating a new one for each match
+bool regex_match(u32regex& re, const char *str, size_t len, int start, match& result) {
+	return search(re, str, len, start, result.m);
 }
 
 int *regex_get_match(match& match, size_t idx) {
-	if (idx > match.m.size() || !match.m[idx].matched)
+	if (idx >= match.m.size() || !match.m[idx].matched)
 		return nullptr;
 	match.range[0] = std::distance(match.m.prefix().first, match.m[idx].first + 1);
 	match.range[1] = std::distance(match.m.prefix().first, match.m[idx].second);
 	return match.range;
 }
 
-int *regex_search(u32regex& re, const char *str, size_t len, size_t start) {
-	boost::cmatch result;
-	if (!search(re, str, len, start, result))
+/// Find the first match, returning its one-based inclusive range. The result
+/// points into scratch, which is also used as the match storage.
+int *regex_search(u32regex& re, const char *str, size_t len, size_t start, match& scratch) {
+	if (!search(re, str, len, start, scratch.m))
 		return nullptr;
 
-	auto ret = static_cast<int *>(malloc(sizeof(int) * 2));
-	ret[0] = start + result.position() + 1;
-	ret[1] = start + result.position() + result.length();
-	return ret;
+	scratch.range[0] = start + scratch.m.position() + 1;
+	scratch.range[1] = start + scratch.m.position() + scratch.m.length();
+	return scratch.range;
 }
 
 char *regex_replace(u32regex& re, const char *replacement, const char *str, size_t len, int max_count) {
@@ -96,10 +148,8 @@ char *regex_replace(u32regex& re, const char *replacement, const char *str, size
 }
 
 u32regex *regex_compile(const char *pattern, int flags, char **err) {
-	auto re = agi::make_unique<u32regex>();
 	try {
-		*re = boost::make_u32regex(pattern, boost::u32regex::perl | flags);
-		return re.release();
+		return new u32regex(regex_cache().Get(pattern, flags));
 	}
 	catch (std::exception const& e) {
 		*err = strdup(e.what());
@@ -132,6 +182,7 @@ extern "C" int luaopen_re_impl(lua_State *L) {
 		"search", regex_search,
 		"match", regex_match,
 		"get_match", regex_get_match,
+		"match_new", match_new,
 		"replace", regex_replace,
 		"compile", regex_compile,
 		"get_flags", get_regex_flags,
@@ -18,6 +18,12 @@
 
 #include <boost/locale/conversion.hpp>
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <unicode/brkiter.h>
+
 namespace {
 template<std::string (*func)(const char *, std::locale const&)>
 char *wrap(const char *str, char **err) {
@@ -28,12 +34,117 @@ char *wrap(const char *str, char **err) {
 		return nullptr;
 	}
 }
+
+// All offsets are zero-based byte offsets passed as ints rather than size_t,
+// as LuaJIT boxes 64-bit integer return values into cdata
+
+/// Are the eight bytes starting at str all ASCII?
+inline bool ascii_word(const char *str) {
+	uint64_t word;
+	memcpy(&word, str, sizeof word);
+	return !(word & UINT64_C(0x8080808080808080));
+}
+
+/// Width of the character with the given lead byte. Matches what the Lua
+/// implementation historically did, so stray continuation bytes count as two
+inline int lead_width(unsigned char b) {
+	if (b < 128) return 1;
+	if (b < 224) return 2;
+	if (b < 240) return 3;
+	return 4;
+}
+
+int char_width(const char *str, int len, int pos) {
+	if (pos < 0 || pos >= len) return 1;
+	return lead_width(str[pos]);
+}
+
+/// Byte offset of the character after the one at pos, clamped to len
+int next_char(const char *str, int len, int pos) {
+	return std::min(len, pos + char_width(str, len, pos));
+}
+
+int length(const char *str, int len) {
+	int count = 0;
+	for (int pos = 0; pos < len; ) {
+		if (len - pos >= 8 && ascii_word(str + pos)) {
+			pos += 8;
+			count += 8;
+			continue;
+		}
+		pos += lead_width(str[pos]);
+		++count;
+	}
+	return count;
+}
+
+/// Byte offset of the index'th (zero-based) character, or -1 if the string
+/// has fewer characters than that
+int char_offset(const char *str, int len, int index) {
+	int pos = 0;
+	while (index > 0 && pos < len) {
+		if (index >= 8 && len - pos >= 8 && ascii_word(str + pos)) {
+			pos += 8;
+			index -= 8;
+			continue;
+		}
+		pos += lead_width(str[pos]);
+		--index;
+	}
+	return index == 0 && pos < len ? pos : -1;
+}
+
+/// Byte offsets of each extended grapheme cluster boundary in str, including
+/// both 0 and len. The returned array must be freed by the caller.
+int *grapheme_boundaries(const char *str, int len, int *count, char **err) {
+	int *bounds = static_cast<int *>(malloc(sizeof(int) * (len + 1)));
+	if (!bounds) {
+		*err = strdup("Out of memory");
+		return nullptr;
+	}
+
+	// Every byte of ASCII text is its own cluster except for CRLF
+	int pos = 0;
+	while (len - pos >= 8 && ascii_word(str + pos)) pos += 8;
+	while (pos < len && !(str[pos] & 0x80)) ++pos;
+	if (pos == len && !memchr(str, '\r', len)) {
+		for (int i = 0; i <= len; ++i) bounds[i] = i;
+		*count = len + 1;
+		return bounds;
+	}
+
+	// BreakIterator instances aren't thread-safe, and ICU caches the rule
+	// data so creating a new one per string is cheap enough
+	UErrorCode status = U_ZERO_ERROR;
+	std::unique_ptr<icu::BreakIterator> bi(icu::BreakIterator::createCharacterInstance(icu::Locale::getDefault(), status));
+	UText *ut = utext_openUTF8(nullptr, str, len, &status);
+	if (U_SUCCESS(status))
+		bi->setText(ut, status);
+	if (U_FAILURE(status)) {
+		utext_close(ut);
+		free(bounds);
+		*err = strdup(u_errorName(status));
+		return nullptr;
+	}
+
+	int n = 0;
+	for (int32_t end = bi->first(); end != icu::BreakIterator::DONE; end = bi->next())
+		bounds[n++] = end;
+	utext_close(ut);
+	*count = n;
+	return bounds;
+}
 }
 
 extern "C" int luaopen_unicode_impl(lua_State *L) {
 	agi::lua::register_lib_table(L, {},
 		"to_upper_case", wrap<boost::locale::to_upper<char>>,
 		"to_lower_case", wrap<boost::locale::to_lower<char>>,
-		"to_fold_case", wrap<boost::locale::fold_case<char>>);
+		"to_fold_case", wrap<boost::locale::fold_case<char>>,
+		"char_width", char_width,
+		"next_char", next_char,
+		"len", length,
+		"char_offset", char_offset,
+		"grapheme_boundaries", grapheme_boundaries);
 	return 1;
 }
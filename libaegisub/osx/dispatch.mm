@@ -16,12 +16,23 @@
 
 #include "libaegisub/dispatch.h"
 
+#include <condition_variable>
+#include <deque>
 #include <dispatch/dispatch.h>
 #include <mutex>
+#include <thread>
 
 namespace {
 using namespace agi::dispatch;
 std::function<void (Thunk)> invoke_main;
+std::thread::id main_thread;
+
+/// Thunks for the main thread when there is no GUI event loop to run them
+struct PendingMainThunks {
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<Thunk> thunks;
+} pending_main;
 
 struct OSXQueue : Queue {
     virtual void DoSync(Thunk thunk)=0;
@@ -31,22 +42,28 @@ struct MainQueue final : OSXQueue {
     void DoInvoke(Thunk thunk) override { invoke_main(thunk); }
 
     void DoSync(Thunk thunk) override {
+        // Waiting on the main queue from the main thread would never finish
+        if (std::this_thread::get_id() == main_thread) {
+            thunk();
+            return;
+        }
+
         std::mutex m;
         std::condition_variable cv;
-        std::unique_lock<std::mutex> l(m);
         std::exception_ptr e;
         bool done = false;
         invoke_main([&]{
-            std::unique_lock<std::mutex> l(m);
             try {
                 thunk();
             }
             catch (...) {
                 e = std::current_exception();
             }
+            std::lock_guard<std::mutex> l(m);
             done = true;
             cv.notify_all();
         });
+        std::unique_lock<std::mutex> l(m);
         cv.wait(l, [&]{ return done; });
         if (e) std::rethrow_exception(e);
     }
@@ -88,6 +105,38 @@ struct GCDQueue final : OSXQueue {
 namespace agi { namespace dispatch {
 void Init(std::function<void (Thunk)> invoke_main) {
     ::invoke_main = std::move(invoke_main);
+    main_thread = std::this_thread::get_id();
+}
+
+void Init() {
+    Init([](Thunk thunk) {
+        {
+            std::lock_guard<std::mutex> l(pending_main.lock);
+            pending_main.thunks.push_back(std::move(thunk));
+        }
+        pending_main.cv.notify_all();
+    });
+}
+
+size_t ProcessMainQueue(std::chrono::milliseconds timeout) {
+    size_t count;
+    {
+        std::unique_lock<std::mutex> l(pending_main.lock);
+        if (pending_main.thunks.empty() && timeout.count() > 0)
+            pending_main.cv.wait_for(l, timeout, [&] { return !pending_main.thunks.empty(); });
+        count = pending_main.thunks.size();
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        Thunk thunk;
+        {
+            std::lock_guard<std::mutex> l(pending_main.lock);
+            thunk = std::move(pending_main.thunks.front());
+            pending_main.thunks.pop_front();
+        }
+        thunk();
+    }
+    return count;
 }
 
 void Queue::Async(Thunk thunk) { DoInvoke(std::move(thunk)); }
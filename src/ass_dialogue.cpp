@@ -39,6 +39,7 @@
 #include <libaegisub/split.h>
 #include <libaegisub/make_unique.h>
 
+#include <atomic>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/trim.hpp>
@@ -49,7 +50,8 @@
 
 using namespace boost::adaptors;
 
-static int next_id = 0;
+// Lines may be constructed concurrently by sharded automation workers
+static std::atomic<int> next_id(0);
 
 AssDialogue::AssDialogue() {
 	Id = ++next_id;
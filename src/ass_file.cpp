@@ -22,6 +22,7 @@
 #include "ass_style.h"
 #include "ass_style_storage.h"
 #include "options.h"
+#include "selection_controller.h"
 
 #include <algorithm>
 #include <boost/algorithm/string/case_conv.hpp>
@@ -201,11 +202,19 @@ bool AssFile::CompLayer(AssDialogue const& lft, AssDialogue const& rgt) {
 	return lft.Layer < rgt.Layer;
 }
 
-void AssFile::Sort(CompFunc comp, std::set<AssDialogue*> const& limit) {
+void AssFile::Sort(CompFunc comp) {
+	Sort(Events, comp);
+}
+
+void AssFile::Sort(CompFunc comp, Selection const& limit) {
 	Sort(Events, comp, limit);
 }
 
-void AssFile::Sort(EntryList<AssDialogue> &lst, CompFunc comp, std::set<AssDialogue*> const& limit) {
+void AssFile::Sort(EntryList<AssDialogue> &lst, CompFunc comp) {
+	lst.sort(comp);
+}
+
+void AssFile::Sort(EntryList<AssDialogue> &lst, CompFunc comp, Selection const& limit) {
 	if (limit.empty()) {
 		lst.sort(comp);
 		return;
@@ -34,13 +34,13 @@
 
 #include <boost/intrusive/list.hpp>
 #include <map>
-#include <set>
 #include <vector>
 
 class AssAttachment;
 class AssDialogue;
 class AssInfo;
 class AssStyle;
+class Selection;
 class wxString;
 
 template<typename T>
@@ -197,10 +197,16 @@ public:
 
 	/// @brief Sort the dialogue lines in this file
 	/// @param comp Comparison function to use. Defaults to sorting by start time.
+	void Sort(CompFunc comp = CompStart);
+	/// @brief Sort some of the dialogue lines in this file
+	/// @param comp Comparison function to use
 	/// @param limit If non-empty, only lines in this set are sorted
-	void Sort(CompFunc comp = CompStart, std::set<AssDialogue*> const& limit = std::set<AssDialogue*>());
+	void Sort(CompFunc comp, Selection const& limit);
 	/// @brief Sort the dialogue lines in the given list
 	/// @param comp Comparison function to use. Defaults to sorting by start time.
+	static void Sort(EntryList<AssDialogue>& lst, CompFunc comp = CompStart);
+	/// @brief Sort some of the dialogue lines in the given list
+	/// @param comp Comparison function to use
 	/// @param limit If non-empty, only lines in this set are sorted
-	static void Sort(EntryList<AssDialogue>& lst, CompFunc comp = CompStart, std::set<AssDialogue*> const& limit = std::set<AssDialogue*>());
+	static void Sort(EntryList<AssDialogue>& lst, CompFunc comp, Selection const& limit);
 };
@@ -31,19 +31,8 @@ enum {
 };
 
 std::shared_ptr<VideoFrame> AsyncVideoProvider::ProcFrame(int frame_number, double time, bool raw) {
-	// Find an unused buffer to use or allocate a new one if needed
-	std::shared_ptr<VideoFrame> frame;
-	for (auto& buffer : buffers) {
-		if (buffer.use_count() == 1) {
-			frame = buffer;
-			break;
-		}
-	}
-
-	if (!frame) {
-		frame = std::make_shared<VideoFrame>();
-		buffers.push_back(frame);
-	}
+	// Reuse a frame which has been released, or allocate a new one if needed
+	auto frame = buffers->Get();
 
 	try {
 		source_provider->GetFrame(frame_number, *frame);
@@ -96,6 +85,9 @@ AsyncVideoProvider::AsyncVideoProvider(agi::fs::path const& video_filename, std:
 , subs_provider(get_subs_provider(parent, br))
 , source_provider(VideoProviderFactory::GetProvider(video_filename, colormatrix, br))
 , parent(parent)
+// Released frames drop their reference to any cached pixel data, so that
+// the cache's buffers can be recycled as soon as it evicts them
+, buffers(std::make_shared<RecyclingPool<VideoFrame>>(4, [](VideoFrame &frame) { frame.shared.reset(); }))
 {
 }
 
@@ -110,6 +102,10 @@ void AsyncVideoProvider::LoadSubtitles(const AssFile *new_subs) throw() {
 	auto copy = new AssFile(*new_subs);
 	worker->Async([=]{
 		subs.reset(copy);
+		lines.clear();
+		lines.reserve(subs->Events.size());
+		for (auto& line : subs->Events)
+			lines.push_back(&line);
 		single_frame = NEW_SUBS_FILE;
 		ProcAsync(req_version, false);
 	});
@@ -122,14 +118,15 @@ void AsyncVideoProvider::UpdateSubtitles(const AssFile *new_subs, const AssDialo
 	// same index in the worker's copy of the file with the new entry
 	auto copy = new AssDialogue(*changed);
 	worker->Async([=]{
-		int i = 0;
-		auto it = subs->Events.begin();
-		std::advance(it, copy->Row - i);
-		i = copy->Row;
-		subs->Events.insert(it, *copy);
-		delete &*it--;
-
-		single_frame = NEW_SUBS_FILE;
+		auto& old = lines[copy->Row];
+		subs->Events.insert(subs->Events.iterator_to(*old), *copy);
+		delete old;
+		old = copy;
+
+		// If the whole file is loaded, patch just the changed event rather
+		// than reserializing and reparsing the entire file
+		if (single_frame != SUBS_FILE_ALREADY_LOADED || !subs_provider || !subs_provider->UpdateLine(*copy))
+			single_frame = NEW_SUBS_FILE;
 		ProcAsync(req_version, true);
 	});
 }
@@ -146,7 +143,7 @@ void AsyncVideoProvider::RequestFrame(int new_frame, double new_time) throw() {
 
 bool AsyncVideoProvider::NeedUpdate(std::vector<AssDialogueBase const*> const& visible_lines) {
 	// Always need to render after a seek
-	if (single_frame != NEW_SUBS_FILE || frame_number != last_rendered)
+	if (frame_number != last_rendered)
 		return true;
 
 	// Obviously need to render if the number of visible lines has changed
@@ -31,6 +31,7 @@ class VideoProvider;
 class VideoProviderError;
 struct AssDialogueBase;
 struct VideoFrame;
+template<typename T> class RecyclingPool;
 namespace agi {
 	class BackgroundRunner;
 	namespace dispatch { class Queue; }
@@ -53,6 +54,9 @@ class AsyncVideoProvider {
 
 	/// Copy of the subtitles file to avoid having to touch the project context
 	std::unique_ptr<AssFile> subs;
+	/// Lines of subs indexed by row, so that single-line updates don't have
+	/// to walk the event list
+	std::vector<AssDialogue *> lines;
 
 	/// If >= 0, the subtitles provider current has just the lines visible on
 	/// that frame loaded. If -1, the entire file is loaded. If -2, the
@@ -76,7 +80,8 @@ class AsyncVideoProvider {
 	/// they can be rendered
 	std::atomic<uint_fast32_t> version{ 0 };
 
-	std::vector<std::shared_ptr<VideoFrame>> buffers;
+	/// Frames which are no longer in use, along with their pixel buffers
+	std::shared_ptr<RecyclingPool<VideoFrame>> buffers;
 
 public:
 	/// @brief Load the passed subtitle file
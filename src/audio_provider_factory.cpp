@@ -25,6 +25,7 @@
 #include <libaegisub/log.h>
 #include <libaegisub/path.h>
 
+#include <boost/crc.hpp>
 #include <boost/range/iterator_range.hpp>
 
 using namespace agi;
@@ -121,7 +122,25 @@ std::unique_ptr<agi::AudioProvider> GetAudioProvider(fs::path const& filename,
 		if (path == "default")
 			path = "?temp";
 		auto cache_dir = path_helper.MakeAbsolute(path_helper.Decode(path), "?temp");
-		return CreateHDAudioProvider(std::move(provider), cache_dir);
+
+		auto max_size = OPT_GET("Audio/Cache/HD/Persistent Size")->GetInt();
+		if (max_size <= 0)
+			return CreateHDAudioProvider(std::move(provider), cache_dir);
+
+		// Decoded audio is kept between sessions in the same way as the
+		// FFMS2 index, keyed on the source file and track
+		if (path == "?temp")
+			cache_dir = path_helper.Decode("?local/audiocache/");
+		boost::crc_32_type hash;
+		hash.process_bytes(filename.string().c_str(), filename.string().size());
+		auto key = std::to_string(hash.checksum()) + "_" + std::to_string(fs::Size(filename))
+			+ "_" + std::to_string(fs::ModifiedTime(filename)) + "_" + std::to_string(provider->GetTrack());
+
+		auto cached = CreatePersistentHDAudioProvider(std::move(provider), cache_dir, key);
+		CleanCache(cache_dir, "*.pcm", max_size);
+		// The waveform peaks are 1/64th the size of the audio
+		CleanCache(cache_dir, "*.peaks", std::max<int64_t>(1, max_size / 64));
+		return cached;
 	}
 
 	throw InternalError("Invalid audio caching method");
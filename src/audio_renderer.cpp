@@ -69,7 +69,10 @@ AudioRenderer::AudioRenderer()
 {
 	bitmaps.reserve(AudioStyle_MAX);
 	for (int i = 0; i < AudioStyle_MAX; ++i)
+	{
 		bitmaps.emplace_back(256, AudioRendererBitmapCacheBitmapFactory(this));
+		bitmaps.back().SetBudget(&cache_budget);
+	}
 
 	// Make sure there's *some* values for those fields, and in the caches
 	SetMillisecondsPerPixel(1);
@@ -113,6 +116,7 @@ void AudioRenderer::SetRenderer(AudioRendererBitmapProvider *const _renderer)
 
 		if (renderer)
 		{
+			renderer->SetCacheBudget(&cache_budget);
 			renderer->SetProvider(provider);
 			renderer->SetAmplitudeScale(amplitude_scale);
 			renderer->SetMillisecondsPerPixel(pixel_ms);
@@ -139,8 +143,9 @@ void AudioRenderer::SetCacheMaxSize(const size_t max_size)
 	// system bitmap object resources and similar. Experimenting shows that 16 MB
 	// bitmap cache should be plenty even if working with a one hour audio clip.
 	cache_bitmap_maxsize = std::min<size_t>(max_size/8, 0x1000000);
-	// The renderer gets whatever is left.
-	cache_renderer_maxsize = max_size - 4*cache_bitmap_maxsize;
+	// Within that, the bitmaps and the renderer's data share the whole size,
+	// with whichever was used least recently evicted first.
+	cache_budget.SetMaxSize(max_size);
 }
 
 void AudioRenderer::ResetBlockCount()
@@ -199,6 +204,9 @@ void AudioRenderer::Render(wxDC &dc, wxPoint origin, const int start, const int
 	const wxDCClipper clipper(dc, wxRect(origin, wxSize(length, pixel_height)));
 	origin.x -= firstbitmapoffset;
 
+	if (firstbitmap <= lastbitmap)
+		renderer->Prefetch(firstbitmap * cache_bitmap_width, (lastbitmap + 1) * cache_bitmap_width);
+
 	for (int i = firstbitmap; i <= lastbitmap; ++i)
 	{
 		dc.DrawBitmap(GetCachedBitmap(i, style), origin);
@@ -212,7 +220,7 @@ void AudioRenderer::Render(wxDC &dc, wxPoint origin, const int start, const int
 	if (needs_age)
 	{
 		bitmaps[style].Age(cache_bitmap_maxsize);
-		renderer->AgeCache(cache_renderer_maxsize);
+		cache_budget.Trim();
 		needs_age = false;
 	}
 }
@@ -89,12 +89,12 @@ class AudioRenderer {
 	/// Width of bitmaps to store in cache
 	const int cache_bitmap_width = 32; // Completely arbitrary value
 
+	/// Memory ceiling shared by the bitmap caches and the renderer's cache
+	DataBlockCacheBudget cache_budget;
 	/// Cached bitmaps for audio ranges
 	std::vector<AudioRendererBitmapCache> bitmaps;
 	/// The maximum allowed size of each bitmap cache, in bytes
 	size_t cache_bitmap_maxsize = 0;
-	/// The maximum allowed size of the renderer's cache, in bytes
-	size_t cache_renderer_maxsize = 0;
 	/// Do the caches need to be aged?
 	bool needs_age = false;
 
@@ -260,6 +260,15 @@ public:
 	/// the width and height to render.
 	virtual void Render(wxBitmap &bmp, int start, AudioRenderingStyle style) = 0;
 
+	/// @brief Prepare to render a range
+	/// @param start First pixel from beginning of the audio stream which is about to be rendered
+	/// @param end   One past the last pixel which is about to be rendered
+	///
+	/// Called before a range is drawn with one or more calls to Render, so
+	/// that deriving classes which are expensive to render can produce the
+	/// data for the whole range at once and look ahead of it.
+	virtual void Prefetch(int start, int end) { }
+
 	/// @brief Blank audio rendering function
 	/// @param dc    The device context to render to
 	/// @param rect  The rectangle to fill with the image of blank audio
@@ -281,10 +290,10 @@ public:
 	/// @param amplitude_scale Scaling factor to zoom to
 	void SetAmplitudeScale(float amplitude_scale);
 
-	/// @brief Age any caches the renderer might keep
-	/// @param max_size Maximum size in bytes the caches should be
+	/// @brief Set the memory budget shared with the bitmap caches
+	/// @param budget Budget to attach any caches to, or nullptr to detach them
 	///
 	/// Deriving classes should override this method if they implement any
-	/// kind of caching.
-	virtual void AgeCache(size_t max_size) { }
+	/// kind of caching. The budget is trimmed by the audio renderer.
+	virtual void SetCacheBudget(DataBlockCacheBudget *budget) { }
 };
@@ -40,13 +40,60 @@
 #endif
 
 #include <libaegisub/audio/provider.h>
+#include <libaegisub/dispatch.h>
 #include <libaegisub/make_unique.h>
+#include <libaegisub/parallel.h>
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 
 #include <wx/image.h>
 #include <wx/dcmemory.h>
 
+/// Scratch buffers for deriving one block at a time
+struct AudioSpectrumWorkspace {
+	/// Raw audio data for the block
+	std::vector<int16_t> audio;
+
+#ifdef WITH_FFTW3
+	/// Input array for FFTW; allocated with fftw_alloc so that it has the
+	/// alignment the plan was made for
+	double *input;
+	/// Output array for FFTW
+	fftw_complex *output;
+
+	AudioSpectrumWorkspace(size_t derivation_size)
+	: audio(2 << derivation_size)
+	, input(fftw_alloc_real(2 << derivation_size))
+	, output(fftw_alloc_complex(2 << derivation_size))
+	{
+	}
+
+	~AudioSpectrumWorkspace()
+	{
+		fftw_free(input);
+		fftw_free(output);
+	}
+#else
+	/// Scratch for 6x the derivation size:
+	/// 2x for the input sample data
+	/// 2x for the real part of the output
+	/// 2x for the imaginary part of the output
+	std::vector<float> fft;
+
+	AudioSpectrumWorkspace(size_t derivation_size)
+	: audio(2 << derivation_size)
+	, fft(6 << derivation_size)
+	{
+	}
+#endif
+
+	AudioSpectrumWorkspace(AudioSpectrumWorkspace const&) = delete;
+	AudioSpectrumWorkspace& operator=(AudioSpectrumWorkspace const&) = delete;
+};
+
 /// Allocates blocks of derived data for the audio spectrum
 struct AudioSpectrumCacheBlockFactory {
 	typedef std::unique_ptr<float, std::default_delete<float[]>> BlockType;
@@ -62,7 +109,7 @@ struct AudioSpectrumCacheBlockFactory {
 	BlockType ProduceBlock(size_t i)
 	{
 		auto res = new float[((size_t)1)<<spectrum->derivation_size];
-		spectrum->FillBlock(i, res);
+		spectrum->FillBlock(spectrum->provider, i, res, *spectrum->workspace);
 		return BlockType(res);
 	}
 
@@ -84,6 +131,39 @@ public:
 	}
 };
 
+/// A set of blocks being produced on the background queue
+struct AudioSpectrumJob {
+	/// Indices of the blocks to produce
+	std::vector<size_t> indices;
+	/// Scratch buffers lent to the job's tasks by the renderer
+	std::vector<std::unique_ptr<AudioSpectrumWorkspace>> workspaces;
+
+	/// Set by the renderer to make the tasks stop early
+	std::atomic<bool> cancelled{false};
+
+	std::mutex lock;
+	std::condition_variable finished;
+	/// Set once every task has stopped
+	bool done = false;
+};
+
+namespace {
+	/// Minimum number of blocks to give each background task
+	const size_t min_blocks_per_task = 4;
+
+	/// @brief Convert audio data to float range [-1;+1)
+	/// @param count Samples to convert
+	/// @param src   Samples to convert
+	/// @param dest  Buffer to fill
+	template<class T>
+	void ConvertToFloat(size_t count, const int16_t *src, T *dest) {
+		for (size_t si = 0; si < count; ++si)
+		{
+			dest[si] = (T)(src[si]) / 32768.0;
+		}
+	}
+}
+
 AudioSpectrumRenderer::AudioSpectrumRenderer(std::string const& color_scheme_name)
 {
 	colors.reserve(AudioStyle_MAX);
@@ -100,39 +180,32 @@ AudioSpectrumRenderer::~AudioSpectrumRenderer()
 
 void AudioSpectrumRenderer::RecreateCache()
 {
+	CancelPrefetch();
+
 #ifdef WITH_FFTW3
 	if (dft_plan)
 	{
 		fftw_destroy_plan(dft_plan);
-		fftw_free(dft_input);
-		fftw_free(dft_output);
 		dft_plan = nullptr;
-		dft_input = nullptr;
-		dft_output = nullptr;
 	}
 #endif
+	workspace.reset();
+	idle_workspaces.clear();
 
 	if (provider)
 	{
 		size_t block_count = (size_t)((provider->GetNumSamples() + (size_t)(1<<derivation_dist) - 1) >> derivation_dist);
 		cache = agi::make_unique<AudioSpectrumCache>(block_count, this);
+		cache->SetBudget(budget);
+		workspace = agi::make_unique<AudioSpectrumWorkspace>(derivation_size);
 
 #ifdef WITH_FFTW3
-		dft_input = fftw_alloc_real(2<<derivation_size);
-		dft_output = fftw_alloc_complex(2<<derivation_size);
 		dft_plan = fftw_plan_dft_r2c_1d(
 			2<<derivation_size,
-			dft_input,
-			dft_output,
+			workspace->input,
+			workspace->output,
 			FFTW_MEASURE);
-#else
-		// Allocate scratch for 6x the derivation size:
-		// 2x for the input sample data
-		// 2x for the real part of the output
-		// 2x for the imaginary part of the output
-		fft_scratch.resize(6 << derivation_size);
 #endif
-		audio_scratch.resize(2 << derivation_size);
 	}
 }
 
@@ -143,6 +216,9 @@ void AudioSpectrumRenderer::OnSetProvider()
 
 void AudioSpectrumRenderer::SetResolution(size_t _derivation_size, size_t _derivation_dist)
 {
+	if (derivation_dist != _derivation_dist || derivation_size != _derivation_size)
+		CancelPrefetch();
+
 	if (derivation_dist != _derivation_dist)
 	{
 		derivation_dist = _derivation_dist;
@@ -157,41 +233,36 @@ void AudioSpectrumRenderer::SetResolution(size_t _derivation_size, size_t _deriv
 	}
 }
 
-template<class T>
-void AudioSpectrumRenderer::ConvertToFloat(size_t count, T *dest) {
-	for (size_t si = 0; si < count; ++si)
-	{
-		dest[si] = (T)(audio_scratch[si]) / 32768.0;
-	}
-}
-
-void AudioSpectrumRenderer::FillBlock(size_t block_index, float *block)
+void AudioSpectrumRenderer::FillBlock(agi::AudioProvider *src, size_t block_index, float *block, AudioSpectrumWorkspace &ws)
 {
 	assert(cache);
 	assert(block);
 
 	int64_t first_sample = ((int64_t)block_index) << derivation_dist;
-	provider->GetAudio(&audio_scratch[0], first_sample, 2 << derivation_size);
+	{
+		std::lock_guard<std::mutex> lock(audio_mutex);
+		src->GetAudio(&ws.audio[0], first_sample, 2 << derivation_size);
+	}
 
 #ifdef WITH_FFTW3
-	ConvertToFloat(2 << derivation_size, dft_input);
+	ConvertToFloat(2 << derivation_size, &ws.audio[0], ws.input);
 
-	fftw_execute(dft_plan);
+	fftw_execute_dft_r2c(dft_plan, ws.input, ws.output);
 
 	double scale_factor = 9 / sqrt(2 << (derivation_size + 1));
 
-	fftw_complex *o = dft_output;
+	fftw_complex *o = ws.output;
 	for (size_t si = 1<<derivation_size; si > 0; --si)
 	{
 		*block++ = log10( sqrt(o[0][0] * o[0][0] + o[0][1] * o[0][1]) * scale_factor + 1 );
 		o++;
 	}
 #else
-	ConvertToFloat(2 << derivation_size, &fft_scratch[0]);
+	ConvertToFloat(2 << derivation_size, &ws.audio[0], &ws.fft[0]);
 
-	float *fft_input = &fft_scratch[0];
-	float *fft_real = &fft_scratch[0] + (2 << derivation_size);
-	float *fft_imag = &fft_scratch[0] + (4 << derivation_size);
+	float *fft_input = &ws.fft[0];
+	float *fft_real = &ws.fft[0] + (2 << derivation_size);
+	float *fft_imag = &ws.fft[0] + (4 << derivation_size);
 
 	FFT fft;
 	fft.Transform(2<<derivation_size, fft_input, fft_real, fft_imag);
@@ -209,6 +280,163 @@ void AudioSpectrumRenderer::FillBlock(size_t block_index, float *block)
 #endif
 }
 
+size_t AudioSpectrumRenderer::BlockForColumn(int x) const
+{
+	return (size_t)(x * pixel_ms * provider->GetSampleRate() / 1000) >> derivation_dist;
+}
+
+void AudioSpectrumRenderer::FindMissingBlocks(int start, int end, std::vector<size_t> &blocks) const
+{
+	size_t block_count = (size_t)((provider->GetNumSamples() + (size_t)(1<<derivation_dist) - 1) >> derivation_dist);
+
+	// Neighbouring columns show the same block when zoomed in, so only the
+	// first column of each run needs checking
+	size_t last = (size_t)-1;
+	for (int x = std::max(start, 0); x < end; ++x)
+	{
+		size_t block_index = BlockForColumn(x);
+		if (block_index >= block_count) break;
+		if (block_index == last) continue;
+		last = block_index;
+		if (!cache->Contains(block_index))
+			blocks.push_back(block_index);
+	}
+}
+
+std::shared_ptr<AudioSpectrumJob> AudioSpectrumRenderer::ComputeBlocks(std::vector<size_t> blocks, bool wait)
+{
+	size_t count = blocks.size();
+	size_t tasks = agi::parallel::ChunkCount(count, min_blocks_per_task);
+
+	// Not worth handing off; let the cache produce these as they're used
+	if (wait && tasks < 2)
+		return nullptr;
+
+	auto job = std::make_shared<AudioSpectrumJob>();
+	job->indices = std::move(blocks);
+
+	// Workspaces are only ever created and destroyed on this thread, as
+	// FFTW's allocation functions aren't guaranteed to be thread-safe
+	for (size_t t = 0; t < tasks; ++t)
+	{
+		if (idle_workspaces.empty())
+			job->workspaces.push_back(agi::make_unique<AudioSpectrumWorkspace>(derivation_size));
+		else
+		{
+			job->workspaces.push_back(std::move(idle_workspaces.back()));
+			idle_workspaces.pop_back();
+		}
+	}
+
+	// The base class changes provider before telling us about it, so the
+	// tasks need their own copy of the one they were started with
+	agi::AudioProvider *src = provider;
+	AudioSpectrumCache *dest = cache.get();
+	auto compute = [=] {
+		agi::parallel::ForChunks(count, tasks, [=](size_t t, size_t first, size_t last) {
+			AudioSpectrumWorkspace *ws = job->workspaces[t].get();
+			size_t block_size = (size_t)1 << derivation_size;
+			for (size_t i = first; i < last && !job->cancelled; ++i)
+			{
+				std::unique_ptr<float[]> block(new float[block_size]);
+				try {
+					FillBlock(src, job->indices[i], block.get(), *ws);
+				}
+				catch (agi::Exception const&) {
+					// Leave the remaining blocks for the cache to produce
+					// on the rendering thread, where the error can be reported
+					break;
+				}
+				dest->Insert(job->indices[i], AudioSpectrumCacheBlockFactory::BlockType(block.release()));
+			}
+		});
+	};
+
+	if (wait)
+	{
+		compute();
+		FinishJob(*job);
+		return nullptr;
+	}
+
+	agi::dispatch::Background().Async([=] {
+		std::exception_ptr error;
+		try {
+			compute();
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(job->lock);
+			job->done = true;
+			job->finished.notify_all();
+		}
+
+		agi::dispatch::Main().Async([=] {
+			// The renderer cancels the job before it goes away
+			if (job->cancelled) return;
+			FinishJob(*job);
+			if (prefetch == job)
+				prefetch.reset();
+		});
+
+		if (error)
+			std::rethrow_exception(error);
+	});
+
+	return job;
+}
+
+void AudioSpectrumRenderer::FinishJob(AudioSpectrumJob &job)
+{
+	for (auto& ws : job.workspaces)
+		idle_workspaces.push_back(std::move(ws));
+	job.workspaces.clear();
+}
+
+void AudioSpectrumRenderer::CancelPrefetch()
+{
+	if (!prefetch) return;
+
+	prefetch->cancelled = true;
+	{
+		std::unique_lock<std::mutex> lock(prefetch->lock);
+		prefetch->finished.wait(lock, [&] { return prefetch->done; });
+	}
+
+	for (auto& ws : prefetch->workspaces)
+		idle_workspaces.push_back(std::move(ws));
+	prefetch->workspaces.clear();
+	prefetch.reset();
+}
+
+void AudioSpectrumRenderer::Prefetch(int start, int end)
+{
+	if (!cache)
+		return;
+
+	std::vector<size_t> blocks;
+	FindMissingBlocks(start, end, blocks);
+	if (!blocks.empty())
+		ComputeBlocks(std::move(blocks), true);
+
+	// Look one screen ahead of and behind the visible range, in that order
+	// of priority, so that scrolling doesn't have to wait for the FFTs.
+	// Only one prefetch runs at a time; the next paint picks up anything
+	// still missing.
+	if (prefetch)
+		return;
+
+	int length = end - start;
+	blocks.clear();
+	FindMissingBlocks(end, end + length, blocks);
+	FindMissingBlocks(start - length, start, blocks);
+	if (!blocks.empty())
+		prefetch = ComputeBlocks(std::move(blocks), false);
+}
+
 void AudioSpectrumRenderer::Render(wxBitmap &bmp, int start, AudioRenderingStyle style)
 {
 	if (!cache)
@@ -223,6 +451,11 @@ void AudioSpectrumRenderer::Render(wxBitmap &bmp, int start, AudioRenderingStyle
 	assert(end >= 0);
 	assert(end >= start);
 
+	std::vector<size_t> missing;
+	FindMissingBlocks(start, end, missing);
+	if (!missing.empty())
+		ComputeBlocks(std::move(missing), true);
+
 	// Prepare an image buffer to write
 	wxImage img(bmp.GetSize());
 	unsigned char *imgdata = img.GetData();
@@ -239,8 +472,7 @@ void AudioSpectrumRenderer::Render(wxBitmap &bmp, int start, AudioRenderingStyle
 	for (int ax = start; ax < end; ++ax)
 	{
 		// Derived audio data
-		size_t block_index = (size_t)(ax * pixel_ms * provider->GetSampleRate() / 1000) >> derivation_dist;
-		float *power = &cache->Get(block_index);
+		float *power = &cache->Get(BlockForColumn(ax));
 
 		// Prepare bitmap writing
 		unsigned char *px = imgdata + (imgheight-1) * stride + (ax - start) * 3;
@@ -292,8 +524,10 @@ void AudioSpectrumRenderer::RenderBlank(wxDC &dc, const wxRect &rect, AudioRende
 	dc.DrawRectangle(rect);
 }
 
-void AudioSpectrumRenderer::AgeCache(size_t max_size)
+void AudioSpectrumRenderer::SetCacheBudget(DataBlockCacheBudget *new_budget)
 {
+	CancelPrefetch();
+	budget = new_budget;
 	if (cache)
-		cache->Age(max_size);
+		cache->SetBudget(budget);
 }
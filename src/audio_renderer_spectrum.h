@@ -35,6 +35,7 @@
 
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include "audio_renderer.h"
@@ -46,6 +47,8 @@
 class AudioColorScheme;
 class AudioSpectrumCache;
 struct AudioSpectrumCacheBlockFactory;
+struct AudioSpectrumJob;
+struct AudioSpectrumWorkspace;
 
 /// @class AudioSpectrumRenderer
 /// @brief Render frequency-power spectrum graphs for audio data.
@@ -80,30 +83,62 @@ class AudioSpectrumRenderer final : public AudioRendererBitmapProvider {
 	void RecreateCache();
 
 	/// @brief Fill a block with frequency-power data for a time range
+	/// @param      src         Audio provider to read from
 	/// @param      block_index Index of the block to fill data for
 	/// @param[out] block       Address to write the data to
-	void FillBlock(size_t block_index, float *block);
+	/// @param      ws          Scratch buffers to use for the derivation
+	///
+	/// May be called from several threads at once, provided each uses its own
+	/// workspace.
+	void FillBlock(agi::AudioProvider *src, size_t block_index, float *block, AudioSpectrumWorkspace &ws);
+
+	/// @brief Get the index of the block displayed in a column
+	/// @param x Absolute pixel column
+	size_t BlockForColumn(int x) const;
+
+	/// @brief Find the blocks needed for a range of columns which are not in the cache
+	/// @param      start  First column
+	/// @param      end    One past the last column
+	/// @param[out] blocks Indices of the missing blocks are appended to this
+	void FindMissingBlocks(int start, int end, std::vector<size_t> &blocks) const;
+
+	/// @brief Produce blocks on the background thread pool
+	/// @param blocks Indices of the blocks to produce
+	/// @param wait   Wait for the blocks before returning
+	/// @return The running job if not waiting
+	///
+	/// The tasks add each block to the cache as soon as it's done.
+	std::shared_ptr<AudioSpectrumJob> ComputeBlocks(std::vector<size_t> blocks, bool wait);
+
+	/// @brief Take back the scratch buffers lent to a finished job
+	void FinishJob(AudioSpectrumJob &job);
 
-	/// @brief Convert audio data to float range [-1;+1)
-	/// @param count Samples to convert
-	/// @param dest Buffer to fill
-	template<class T>
-	void ConvertToFloat(size_t count, T *dest);
+	/// @brief Stop the prefetch job, if any, and wait for its workers to exit
+	void CancelPrefetch();
 
 #ifdef WITH_FFTW3
 	/// FFTW plan data
+	///
+	/// The plan is made on the main thread for the main workspace's arrays,
+	/// and then run on the other workspaces' arrays with
+	/// fftw_execute_dft_r2c, which unlike planning is thread-safe.
 	fftw_plan dft_plan = nullptr;
-	/// Pre-allocated input array for FFTW
-	double *dft_input = nullptr;
-	/// Pre-allocated output array for FFTW
-	fftw_complex *dft_output = nullptr;
-#else
-	/// Pre-allocated scratch area for doing FFT derivations
-	std::vector<float> fft_scratch;
 #endif
 
-	/// Pre-allocated scratch area for storing raw audio data
-	std::vector<int16_t> audio_scratch;
+	/// Scratch buffers for producing blocks on the rendering thread
+	std::unique_ptr<AudioSpectrumWorkspace> workspace;
+
+	/// Scratch buffers not currently in use by a job
+	std::vector<std::unique_ptr<AudioSpectrumWorkspace>> idle_workspaces;
+
+	/// Memory budget the cache counts against, if any
+	DataBlockCacheBudget *budget = nullptr;
+
+	/// Blocks being produced in the background ahead of the visible range
+	std::shared_ptr<AudioSpectrumJob> prefetch;
+
+	/// Serialises reads from the audio provider by worker threads
+	std::mutex audio_mutex;
 
 public:
 	/// @brief Constructor
@@ -119,6 +154,9 @@ public:
 	/// @param style Style to render audio in
 	void Render(wxBitmap &bmp, int start, AudioRenderingStyle style) override;
 
+	/// @brief Produce the spectrum for a range in parallel and look ahead of it
+	void Prefetch(int start, int end) override;
+
 	/// @brief Render blank area
 	void RenderBlank(wxDC &dc, const wxRect &rect, AudioRenderingStyle style) override;
 
@@ -133,7 +171,6 @@ public:
 	/// is specified too large, it will be clamped to the size.
 	void SetResolution(size_t derivation_size, size_t derivation_dist);
 
-	/// @brief Cleans up the cache
-	/// @param max_size Maximum size in bytes for the cache
-	void AgeCache(size_t max_size) override;
+	/// @brief Make the spectrum cache count against a shared budget
+	void SetCacheBudget(DataBlockCacheBudget *budget) override;
 };
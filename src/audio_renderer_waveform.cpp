@@ -32,6 +32,7 @@
 #include "audio_colorscheme.h"
 #include "options.h"
 
+#include <libaegisub/audio/peaks.h>
 #include <libaegisub/audio/provider.h>
 
 #include <algorithm>
@@ -86,33 +87,53 @@ void AudioWaveformRenderer::Render(wxBitmap &bmp, int start, AudioRenderingStyle
 	wxPen pen_peaks(wxPen(pal->get(0.4f)));
 	wxPen pen_avgs(wxPen(pal->get(0.7f)));
 
+	// When zoomed out far enough, use the provider's precomputed peaks with
+	// at least two blocks per pixel rather than reading every sample
+	auto peaks = provider->GetPeaks();
+	int peak_level = peaks ? peaks->GetLevel(pixel_samples / 2) : -1;
+
 	for (int x = 0; x < rect.width; ++x)
 	{
-		provider->GetAudio(audio_buffer.get(), (int64_t)cur_sample, (int64_t)pixel_samples);
-		cur_sample += pixel_samples;
-
 		int peak_min = 0, peak_max = 0;
-		int64_t avg_min_accum = 0, avg_max_accum = 0;
-		auto aud = reinterpret_cast<const int16_t *>(audio_buffer.get());
-		for (int si = pixel_samples; si > 0; --si, ++aud)
+		double avg_min_value = 0, avg_max_value = 0;
+
+		agi::AudioPeak peak;
+		if (peaks && peaks->GetPeak(peak_level, (int64_t)cur_sample, (int64_t)(cur_sample + pixel_samples), peak))
 		{
-			if (*aud > 0)
-			{
-				peak_max = std::max(peak_max, (int)*aud);
-				avg_max_accum += *aud;
-			}
-			else
+			peak_min = peak.min;
+			peak_max = peak.max;
+			avg_min_value = peak.avg_min;
+			avg_max_value = peak.avg_max;
+		}
+		else
+		{
+			provider->GetAudio(audio_buffer.get(), (int64_t)cur_sample, (int64_t)pixel_samples);
+
+			int64_t avg_min_accum = 0, avg_max_accum = 0;
+			auto aud = reinterpret_cast<const int16_t *>(audio_buffer.get());
+			for (int si = pixel_samples; si > 0; --si, ++aud)
 			{
-				peak_min = std::min(peak_min, (int)*aud);
-				avg_min_accum += *aud;
+				if (*aud > 0)
+				{
+					peak_max = std::max(peak_max, (int)*aud);
+					avg_max_accum += *aud;
+				}
+				else
+				{
+					peak_min = std::min(peak_min, (int)*aud);
+					avg_min_accum += *aud;
+				}
 			}
+			avg_min_value = avg_min_accum / pixel_samples;
+			avg_max_value = avg_max_accum / pixel_samples;
 		}
+		cur_sample += pixel_samples;
 
 		// midpoint is half height
 		peak_min = std::max((int)(peak_min * amplitude_scale * midpoint) / 0x8000, -midpoint);
 		peak_max = std::min((int)(peak_max * amplitude_scale * midpoint) / 0x8000, midpoint);
-		int avg_min = std::max((int)(avg_min_accum * amplitude_scale * midpoint / pixel_samples) / 0x8000, -midpoint);
-		int avg_max = std::min((int)(avg_max_accum * amplitude_scale * midpoint / pixel_samples) / 0x8000, midpoint);
+		int avg_min = std::max((int)(avg_min_value * amplitude_scale * midpoint) / 0x8000, -midpoint);
+		int avg_max = std::min((int)(avg_max_value * amplitude_scale * midpoint) / 0x8000, midpoint);
 
 		dc.SetPen(pen_peaks);
 		dc.DrawLine(x, midpoint - peak_max, x, midpoint - peak_min);
@@ -66,12 +66,6 @@ public:
 	/// @brief Render blank area
 	void RenderBlank(wxDC &dc, const wxRect &rect, AudioRenderingStyle style) override;
 
-	/// @brief Cleans up the cache
-	/// @param max_size Maximum size in bytes for the cache
-	///
-	/// Does nothing for waveform renderer, since it does not have a backend cache
-	void AgeCache(size_t max_size) override { }
-
 	/// Get a list of waveform rendering modes
 	static wxArrayString GetWaveformStyles();
 };
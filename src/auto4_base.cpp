@@ -48,6 +48,7 @@
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/trim.hpp>
 #include <future>
+#include <mutex>
 
 #include <wx/dcmemory.h>
 #include <wx/log.h>
@@ -65,6 +66,11 @@ namespace Automation4 {
 	{
 		width = height = descent = extlead = 0;
 
+		// Sharded template workers call this from several threads at once,
+		// and neither GDI nor wx DCs are safe to use concurrently
+		static std::mutex dc_mutex;
+		std::lock_guard<std::mutex> lock(dc_mutex);
+
 		double fontsize = style->fontsize * 64;
 		double spacing = style->spacing * 64;
 
@@ -58,7 +58,9 @@
 #include <libaegisub/lua/script_reader.h>
 #include <libaegisub/lua/utils.h>
 #include <libaegisub/make_unique.h>
+#include <libaegisub/parallel.h>
 #include <libaegisub/path.h>
+#include <libaegisub/timing_processor.h>
 
 #include <algorithm>
 #include <boost/algorithm/string/case_conv.hpp>
@@ -67,6 +69,7 @@
 #include <boost/scope_exit.hpp>
 #include <cassert>
 #include <mutex>
+#include <numeric>
 #include <wx/clipbrd.h>
 #include <wx/log.h>
 #include <wx/msgdlg.h>
@@ -206,6 +209,95 @@ namespace {
 		return 1;
 	}
 
+	/// Read an optional non-negative number from the settings table at index 2
+	int get_timing_setting(lua_State *L, const char *name)
+	{
+		lua_getfield(L, 2, name);
+		int value = lua_isnil(L, -1) ? 0 : (int)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		if (value < 0)
+			error(L, "Timing setting '%s' must not be negative", name);
+		return value;
+	}
+
+	int process_timing(lua_State *L)
+	{
+		argcheck(L, !!lua_istable(L, 1), 1, "");
+		if (lua_isnoneornil(L, 2)) {
+			lua_settop(L, 1);
+			lua_newtable(L);
+		}
+		argcheck(L, !!lua_istable(L, 2), 2, "");
+
+		agi::timing::Settings settings;
+		settings.lead_in = get_timing_setting(L, "lead_in");
+		settings.lead_out = get_timing_setting(L, "lead_out");
+		settings.adjacent_gap = get_timing_setting(L, "adjacent_gap");
+		settings.adjacent_overlap = get_timing_setting(L, "adjacent_overlap");
+		settings.before_start = get_timing_setting(L, "before_start");
+		settings.after_start = get_timing_setting(L, "after_start");
+		settings.before_end = get_timing_setting(L, "before_end");
+		settings.after_end = get_timing_setting(L, "after_end");
+
+		lua_getfield(L, 2, "adjacent");
+		settings.adjacent = !!lua_toboolean(L, -1);
+		lua_getfield(L, 2, "adjacent_bias");
+		settings.adjacent_bias = mid(0.0, lua_tonumber(L, -1), 1.0);
+		lua_getfield(L, 2, "keyframes");
+		settings.keyframes = !!lua_toboolean(L, -1);
+		lua_pop(L, 3);
+
+		std::vector<int> kf;
+		agi::vfr::Framerate no_timecodes;
+		const agi::Context *c = get_context(L);
+		if (settings.keyframes) {
+			if (!c || !c->project->Timecodes().IsLoaded())
+				error(L, "Snapping to keyframes requires a video or timecodes to be loaded");
+			kf = c->project->Keyframes();
+			if (auto provider = c->project->VideoProvider())
+				kf.push_back(provider->GetFrameCount() - 1);
+		}
+
+		// The processor needs the lines sorted by start time, but the caller's
+		// table is left in its original order
+		std::vector<agi::timing::Line> lines;
+		std::vector<int> order;
+		const size_t count = lua_objlen(L, 1);
+		for (size_t i = 1; i <= count; ++i) {
+			lua_rawgeti(L, 1, i);
+			if (!lua_istable(L, -1))
+				error(L, "Line %d is not a table", (int)i);
+			lua_getfield(L, -1, "start_time");
+			lua_getfield(L, -2, "end_time");
+			if (!lua_isnumber(L, -2) || !lua_isnumber(L, -1))
+				error(L, "Line %d is missing its start_time or end_time", (int)i);
+			agi::timing::Line line{(int)lua_tointeger(L, -2), (int)lua_tointeger(L, -1)};
+			if (line.End < line.Start)
+				error(L, "Line %d ends before it starts", (int)i);
+			lua_pop(L, 3);
+			lines.push_back(line);
+			order.push_back(i);
+		}
+
+		std::stable_sort(begin(order), end(order), [&](int a, int b) {
+			return lines[a - 1].Start < lines[b - 1].Start;
+		});
+		std::vector<agi::timing::Line> sorted;
+		sorted.reserve(lines.size());
+		for (int i : order)
+			sorted.push_back(lines[i - 1]);
+
+		agi::timing::Process(sorted, settings, kf, settings.keyframes ? c->project->Timecodes() : no_timecodes);
+
+		for (size_t i = 0; i < order.size(); ++i) {
+			lua_rawgeti(L, 1, order[i]);
+			set_field(L, "start_time", (int)sorted[i].Start);
+			set_field(L, "end_time", (int)sorted[i].End);
+			lua_pop(L, 1);
+		}
+		return 0;
+	}
+
 	int decode_path(lua_State *L)
 	{
 		std::string path = check_string(L, 1);
@@ -223,6 +315,51 @@ namespace {
 		throw error_tag();
 	}
 
+	/// Stand-in for register_macro and register_filter in worker states,
+	/// which run a copy of the script but must not register its features
+	int ignore_registration(lua_State *)
+	{
+		return 0;
+	}
+
+	/// Combines the progress reported by the workers of a sharded run into a
+	/// single progress value for the whole run
+	class ShardProgress {
+		std::mutex lock;
+		ProgressSink *ps;
+		std::vector<size_t> shard_lines; ///< Number of lines in each shard
+		std::vector<double> lines_done;  ///< Number of lines each shard has finished
+		size_t total_lines;
+
+	public:
+		ShardProgress(ProgressSink *ps, std::vector<size_t> shard_lines)
+		: ps(ps)
+		, shard_lines(std::move(shard_lines))
+		, lines_done(this->shard_lines.size())
+		, total_lines(std::accumulate(begin(this->shard_lines), end(this->shard_lines), size_t(0)))
+		{
+		}
+
+		/// Set the progress of one shard
+		/// @param shard Index of the shard
+		/// @param percent Progress through that shard's lines, from 0 to 100
+		void Set(size_t shard, double percent)
+		{
+			std::lock_guard<std::mutex> l(lock);
+			lines_done[shard] = shard_lines[shard] * std::max(0.0, std::min(percent, 100.0)) / 100;
+			double done = std::accumulate(begin(lines_done), end(lines_done), 0.0);
+			ps->SetProgress((int64_t)done, total_lines);
+		}
+	};
+
+	/// Replacement for aegisub.progress.set in worker states
+	int set_shard_progress(lua_State *L)
+	{
+		auto progress = static_cast<ShardProgress *>(lua_touserdata(L, lua_upvalueindex(1)));
+		progress->Set((size_t)lua_tointeger(L, lua_upvalueindex(2)), lua_tonumber(L, 1));
+		return 0;
+	}
+
 	int lua_text_textents(lua_State *L)
 	{
 		argcheck(L, !!lua_istable(L, 1), 1, "");
@@ -373,7 +510,15 @@ namespace {
 		/// destroy internal structures, unreg features and delete environment
 		void Destroy();
 
+		/// Set up the Aegisub API in a new Lua state and run the script in it
+		/// @param L Lua state to initialise
+		/// @param is_worker Is this a worker state for a sharded run rather
+		///                  than the script's own state?
+		/// @return An error message, or an empty string on success
+		std::string InitialiseState(lua_State *L, bool is_worker);
+
 		static int LuaInclude(lua_State *L);
+		static int LuaRunSharded(lua_State *L);
 
 	public:
 		LuaScript(agi::fs::path const& filename);
@@ -419,6 +564,36 @@ namespace {
 
 		bool loaded = false;
 		BOOST_SCOPE_EXIT_ALL(&) { if (!loaded) Destroy(); };
+
+		std::string err = InitialiseState(L, false);
+		if (!err.empty()) {
+			description = err;
+			return;
+		}
+		LuaStackcheck stackcheck(L);
+
+		lua_getglobal(L, "version");
+		if (lua_isnumber(L, -1) && lua_tointeger(L, -1) == 3) {
+			lua_pop(L, 1); // just to avoid tripping the stackcheck in debug
+			description = "Attempted to load an Automation 3 script as an Automation 4 Lua script. Automation 3 is no longer supported.";
+			return;
+		}
+
+		name = get_global_string(L, "script_name");
+		description = get_global_string(L, "script_description");
+		author = get_global_string(L, "script_author");
+		version = get_global_string(L, "script_version");
+
+		if (name.empty())
+			name = GetPrettyFilename().string();
+
+		lua_pop(L, 1);
+		// if we got this far, the script should be ready
+		loaded = true;
+	}
+
+	std::string LuaScript::InitialiseState(lua_State *L, bool is_worker)
+	{
 		LuaStackcheck stackcheck(L);
 
 		// register standard libs
@@ -436,9 +611,9 @@ namespace {
 		// Replace the default lua module loader with our unicode compatible
 		// one and set the module search path
 		if (!Install(L, include_path)) {
-			description = get_string_or_default(L, 1);
+			std::string err = get_string_or_default(L, 1);
 			lua_pop(L, 1);
-			return;
+			return err;
 		}
 		stackcheck.check_stack(0);
 
@@ -456,15 +631,23 @@ namespace {
 
 		// make "aegisub" table
 		lua_pushstring(L, "aegisub");
-		lua_createtable(L, 0, 13);
+		lua_createtable(L, 0, 16);
 
-		set_field<LuaCommand::LuaRegister>(L, "register_macro");
-		set_field<LuaExportFilter::LuaRegister>(L, "register_filter");
+		if (is_worker) {
+			set_field<ignore_registration>(L, "register_macro");
+			set_field<ignore_registration>(L, "register_filter");
+		}
+		else {
+			set_field<LuaCommand::LuaRegister>(L, "register_macro");
+			set_field<LuaExportFilter::LuaRegister>(L, "register_filter");
+			set_field<LuaRunSharded>(L, "__run_sharded");
+		}
 		set_field<lua_text_textents>(L, "text_extents");
 		set_field<frame_from_ms>(L, "frame_from_ms");
 		set_field<ms_from_frame>(L, "ms_from_frame");
 		set_field<video_size>(L, "video_size");
 		set_field<get_keyframes>(L, "keyframes");
+		set_field<process_timing>(L, "process_timing");
 		set_field<decode_path>(L, "decode_path");
 		set_field<cancel_script>(L, "cancel");
 		set_field(L, "lua_automation_version", 4);
@@ -480,9 +663,9 @@ namespace {
 
 		// load user script
 		if (!LoadFile(L, GetFilename())) {
-			description = get_string_or_default(L, 1);
+			std::string err = get_string_or_default(L, 1);
 			lua_pop(L, 1);
-			return;
+			return err;
 		}
 		stackcheck.check_stack(1);
 
@@ -494,31 +677,13 @@ namespace {
 		// this is where features are registered
 		if (lua_pcall(L, 0, 0, -2)) {
 			// error occurred, assumed to be on top of Lua stack
-			description = agi::format("Error initialising Lua script \"%s\":\n\n%s", GetPrettyFilename().string(), get_string_or_default(L, -1));
+			std::string err = agi::format("Error initialising Lua script \"%s\":\n\n%s", GetPrettyFilename().string(), get_string_or_default(L, -1));
 			lua_pop(L, 2); // error + error handler
-			return;
+			return err;
 		}
 		lua_pop(L, 1); // error handler
 		stackcheck.check_stack(0);
-
-		lua_getglobal(L, "version");
-		if (lua_isnumber(L, -1) && lua_tointeger(L, -1) == 3) {
-			lua_pop(L, 1); // just to avoid tripping the stackcheck in debug
-			description = "Attempted to load an Automation 3 script as an Automation 4 Lua script. Automation 3 is no longer supported.";
-			return;
-		}
-
-		name = get_global_string(L, "script_name");
-		description = get_global_string(L, "script_description");
-		author = get_global_string(L, "script_author");
-		version = get_global_string(L, "script_version");
-
-		if (name.empty())
-			name = GetPrettyFilename().string();
-
-		lua_pop(L, 1);
-		// if we got this far, the script should be ready
-		loaded = true;
+		return "";
 	}
 
 	void LuaScript::Destroy()
@@ -604,6 +769,140 @@ namespace {
 		return lua_gettop(L) - pretop;
 	}
 
+	int LuaScript::LuaRunSharded(lua_State *L)
+	{
+		auto subs = LuaAssFile::GetObjPointer(L, 1, false);
+		const std::string function(check_string(L, 2));
+		const size_t first = check_uint(L, 3);
+		const size_t last = check_uint(L, 4);
+		argcheck(L, first > 0, 3, "Out of range line index");
+
+		// Each worker has to load the script and replay its setup, which
+		// isn't worth it for small files
+		const size_t min_lines_per_shard = 64;
+		const size_t line_count = last >= first ? last - first + 1 : 0;
+		const size_t shard_count = agi::parallel::ChunkCount(line_count, min_lines_per_shard);
+		if (shard_count < 2) {
+			push_value(L, false);
+			return 1;
+		}
+
+		LuaScript *s = GetScriptObject(L);
+		const agi::Context *c = get_context(L);
+
+		ProgressSink fallback_progress(nullptr, nullptr);
+		ProgressSink *ps = &fallback_progress;
+		lua_getfield(L, LUA_REGISTRYINDEX, "progress_sink");
+		if (lua_isuserdata(L, -1))
+			ps = LuaProgressSink::GetObjPointer(L, -1);
+		lua_pop(L, 1);
+
+		struct Shard {
+			size_t first;
+			size_t last;
+			LuaAssFile::ShardResult result;
+			bool mergeable = false;
+			bool failed = false;
+			std::string error;
+		};
+
+		std::vector<Shard> shards(shard_count);
+		std::vector<size_t> shard_lines(shard_count);
+		for (size_t i = 0; i < shard_count; ++i) {
+			shards[i].first = first + line_count * i / shard_count;
+			shards[i].last = first + line_count * (i + 1) / shard_count - 1;
+			shard_lines[i] = shards[i].last - shards[i].first + 1;
+		}
+
+		// Each worker reports its progress through its own lines, which is
+		// combined into one value for the whole file
+		ShardProgress progress(ps, std::move(shard_lines));
+
+		auto run_shard = [&](size_t index) {
+			Shard &shard = shards[index];
+			lua_State *WL = luaL_newstate();
+			if (!WL) {
+				shard.failed = true;
+				shard.error = "Could not initialize Lua state";
+				return;
+			}
+			BOOST_SCOPE_EXIT_ALL(&) { lua_close(WL); };
+
+			shard.error = s->InitialiseState(WL, true);
+			if (!shard.error.empty()) {
+				shard.failed = true;
+				return;
+			}
+
+			set_context(WL, c);
+			LuaProgressSink lps(WL, ps, false);
+
+			lua_getglobal(WL, "aegisub");
+			lua_getfield(WL, -1, "progress");
+			lua_pushlightuserdata(WL, &progress);
+			push_value(WL, index);
+			lua_pushcclosure(WL, exception_wrapper<set_shard_progress>, 2);
+			lua_setfield(WL, -2, "set");
+			lua_pop(WL, 2);
+
+			lua_pushcclosure(WL, add_stack_trace, 0);
+			lua_getglobal(WL, function.c_str());
+			auto shard_subs = new LuaAssFile(WL, *subs);
+			push_value(WL, shard.first);
+			push_value(WL, shard.last);
+
+			if (lua_pcall(WL, 3, 0, -5)) {
+				shard.failed = true;
+				// nil error means the script was cancelled
+				if (!lua_isnil(WL, -1))
+					shard.error = get_string_or_default(WL, -1);
+				lua_pop(WL, 2);
+			}
+			else
+				lua_pop(WL, 1);
+
+			shard.mergeable = shard_subs->ShardComplete(*subs, shard.result);
+		};
+
+		agi::parallel::For(shard_count, [&](size_t i) {
+			try {
+				run_shard(i);
+			}
+			catch (agi::Exception const& e) {
+				shards[i].failed = true;
+				shards[i].error = e.GetMessage();
+			}
+			catch (...) {
+				shards[i].failed = true;
+				shards[i].error = "Unknown error in template worker";
+			}
+		});
+
+		for (auto const& shard : shards) {
+			if (!shard.failed) continue;
+			if (shard.error.empty()) {
+				lua_pushnil(L);
+				throw error_tag();
+			}
+			return error(L, "%s", shard.error.c_str());
+		}
+
+		// If any worker did something other than replace and append lines
+		// the script has to be rerun serially
+		for (auto const& shard : shards) {
+			if (!shard.mergeable) {
+				push_value(L, false);
+				return 1;
+			}
+		}
+
+		for (auto& shard : shards)
+			subs->MergeShard(std::move(shard.result));
+
+		push_value(L, true);
+		return 1;
+	}
+
 	void LuaThreadedCall(lua_State *L, int nargs, int nresults, std::string const& title, wxWindow *parent, bool can_open_config)
 	{
 		bool failed = false;
@@ -843,7 +1142,7 @@ namespace {
 
 		// top of stack will be selected lines array, if any was returned
 		if (lua_istable(L, -1)) {
-			std::set<AssDialogue*> sel;
+			Selection sel;
 			lua_for_each(L, [&] {
 				if (!lua_isnumber(L, -1))
 					return;
@@ -79,6 +79,10 @@ namespace Automation4 {
 		/// Lines to delete once processing complete successfully
 		std::vector<std::unique_ptr<AssEntry>> lines_to_delete;
 
+		/// Has a line been inserted or deleted anywhere other than the end
+		/// of the file? Shards can only be merged back if not.
+		bool indices_changed = false;
+
 		/// Create copies of all of the lines in the script info section if it
 		/// hasn't already happened. This is done lazily, since it only needs
 		/// to happen when the user modifies the headers in some way, which
@@ -108,9 +112,20 @@ namespace Automation4 {
 
 		void LuaSetUndoPoint(lua_State *L);
 
+		/// Push the userdata object wrapping this file onto the stack
+		void PushObject(lua_State *L);
+
 		// LuaAssFile can only be deleted by the reference count hitting zero
 		~LuaAssFile();
 	public:
+		/// Lines produced by a shard of a templater run in a worker state
+		struct ShardResult {
+			/// Lines replaced by the worker, with their index in the parent
+			std::vector<std::pair<size_t, std::unique_ptr<AssEntry>>> replaced;
+			/// Lines appended to the end of the file by the worker
+			std::vector<std::unique_ptr<AssEntry>> appended;
+		};
+
 		static LuaAssFile *GetObjPointer(lua_State *L, int idx, bool allow_expired);
 
 		/// makes a Lua representation of AssEntry and places on the top of the stack
@@ -127,12 +142,29 @@ namespace Automation4 {
 		/// End processing without applying any changes made
 		void Cancel();
 
+		/// @brief Signal that a worker using this shard is done running
+		/// @param parent The file this shard was created from
+		/// @param[out] result The lines modified by the worker
+		/// @return false if the worker did something other than replacing
+		///         and appending dialogue lines, in which case its changes
+		///         are discarded
+		bool ShardComplete(LuaAssFile const& parent, ShardResult &result);
+
+		/// Apply the changes made by a shard worker to this file
+		void MergeShard(ShardResult&& result);
+
 		/// Constructor
 		/// @param L lua state
 		/// @param ass File to wrap
 		/// @param can_modify Is modifying the file allowed?
 		/// @param can_set_undo Is setting undo points allowed?
 		LuaAssFile(lua_State *L, AssFile *ass, bool can_modify = false, bool can_set_undo = false);
+
+		/// Create a modifiable copy of another file object's current lines
+		/// for use by a worker running in a different Lua state
+		/// @param L lua state of the worker
+		/// @param parent File object to copy
+		LuaAssFile(lua_State *L, LuaAssFile const& parent);
 	};
 
 	class LuaProgressSink {
@@ -50,6 +50,8 @@
 #include <boost/algorithm/string/case_conv.hpp>
 #include <cassert>
 #include <memory>
+#include <mutex>
+#include <unordered_set>
 
 namespace {
 	using namespace agi::lua;
@@ -124,6 +126,10 @@ namespace {
 		}
 	}
 
+	/// Guards the file's extradata, which may be read and extended by the
+	/// worker states of a sharded run at the same time
+	std::mutex extradata_mutex;
+
 	template<typename T, typename U>
 	const T *check_cast_constptr(const U *value) {
 		return typeid(const T) == typeid(*value) ? static_cast<const T *>(value) : nullptr;
@@ -183,7 +189,12 @@ namespace Automation4 {
 
 			// create extradata table
 			lua_newtable(L);
-			for (auto const& ed : ass->GetExtradata(dia->ExtradataIds)) {
+			std::vector<ExtradataEntry> extradata;
+			{
+				std::lock_guard<std::mutex> lock(extradata_mutex);
+				extradata = ass->GetExtradata(dia->ExtradataIds);
+			}
+			for (auto const& ed : extradata) {
 				push_value(L, ed.key);
 				push_value(L, ed.value);
 				lua_settable(L, -3);
@@ -309,6 +320,7 @@ namespace Automation4 {
 			if (type == LUA_TTABLE) {
 				lua_for_each(L, [&] {
 					if (lua_type(L, -2) != LUA_TSTRING) return;
+					std::lock_guard<std::mutex> lock(extradata_mutex);
 					new_ids.push_back(ass->AddExtradata(
 						get_string_or_default(L, -2),
 						get_string_or_default(L, -1)));
@@ -501,6 +513,7 @@ namespace Automation4 {
 		}
 
 		sort(ids.begin(), ids.end());
+		indices_changed = true;
 
 		size_t id_idx = 0, out = 0;
 		for (size_t i = 0; i < lines.size(); ++i) {
@@ -525,6 +538,7 @@ namespace Automation4 {
 		size_t b = std::min<size_t>(check_uint(L, 2), lines.size());
 
 		if (a >= b) return;
+		indices_changed = true;
 
 		for (size_t i = a; i < b; ++i) {
 			modification_type |= modification_mask(lines[i]);
@@ -555,6 +569,7 @@ namespace Automation4 {
 			for (size_t i = lines.size(); i > 0; --i) {
 				auto cur_group = lines[i - 1] ? lines[i - 1]->Group() : AssEntryGroup::INFO;
 				if (cur_group == group) {
+					indices_changed |= i != lines.size();
 					InsertLine(lines, i, std::move(e));
 					break;
 				}
@@ -581,6 +596,7 @@ namespace Automation4 {
 			return;
 		}
 
+		indices_changed = true;
 		int n = lua_gettop(L);
 		std::vector<AssEntry *> new_entries;
 		new_entries.reserve(n - 1);
@@ -738,6 +754,59 @@ namespace Automation4 {
 		if (!references) delete this;
 	}
 
+	bool LuaAssFile::ShardComplete(LuaAssFile const& parent, ShardResult &result)
+	{
+		std::unordered_set<AssEntry *> parent_lines(parent.lines.begin(), parent.lines.end());
+
+		// Only replacing dialogue lines in place and appending new ones can
+		// be merged, as any other change shifts the indices seen by the
+		// other shards
+		bool mergeable = !indices_changed
+			&& script_info_copied == parent.script_info_copied
+			&& lines.size() >= parent.lines.size();
+		for (size_t i = 0; mergeable && i < lines.size(); ++i) {
+			if (i < parent.lines.size() && lines[i] == parent.lines[i]) continue;
+			mergeable = lines[i] && lines[i]->Group() == AssEntryGroup::DIALOGUE;
+		}
+
+		// Lines created by the worker aren't owned by anything until they're
+		// either handed to the parent or discarded here
+		for (size_t i = 0; i < lines.size(); ++i) {
+			if (!lines[i] || parent_lines.count(lines[i])) continue;
+			std::unique_ptr<AssEntry> e(lines[i]);
+			if (!mergeable) continue;
+			if (i < parent.lines.size())
+				result.replaced.emplace_back(i, std::move(e));
+			else
+				result.appended.push_back(std::move(e));
+		}
+
+		// The parent's lines are still owned by the parent
+		for (auto& line : lines_to_delete) {
+			if (parent_lines.count(line.get()))
+				line.release();
+		}
+		lines_to_delete.clear();
+		lines.clear();
+
+		references--;
+		if (!references) delete this;
+		return mergeable;
+	}
+
+	void LuaAssFile::MergeShard(ShardResult&& result)
+	{
+		for (auto& line : result.replaced) {
+			modification_type |= modification_mask(line.second.get());
+			QueueLineForDeletion(line.first);
+			AssignLine(line.first, std::move(line.second));
+		}
+		for (auto& line : result.appended) {
+			modification_type |= modification_mask(line.get());
+			InsertLine(lines, lines.size(), std::move(line));
+		}
+	}
+
 	LuaAssFile::LuaAssFile(lua_State *L, AssFile *ass, bool can_modify, bool can_set_undo)
 	: ass(ass)
 	, L(L)
@@ -751,6 +820,22 @@ namespace Automation4 {
 		for (auto& line : ass->Events)
 			lines.push_back(&line);
 
+		PushObject(L);
+	}
+
+	LuaAssFile::LuaAssFile(lua_State *L, LuaAssFile const& parent)
+	: ass(parent.ass)
+	, L(L)
+	, can_modify(true)
+	, can_set_undo(false)
+	, lines(parent.lines)
+	, script_info_copied(parent.script_info_copied)
+	{
+		PushObject(L);
+	}
+
+	void LuaAssFile::PushObject(lua_State *L)
+	{
 		// prepare userdata object
 		*static_cast<LuaAssFile**>(lua_newuserdata(L, sizeof(LuaAssFile*))) = this;
 
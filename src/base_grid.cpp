@@ -66,6 +66,7 @@ BaseGrid::BaseGrid(wxWindow* parent, agi::Context *context)
 , context(context)
 , columns(GetGridColumns())
 , columns_visible(OPT_GET("Subtitle/Grid/Column")->GetListBool())
+, line_tracker(agi::make_unique<GridLineTracker>(columns))
 , seek_listener(context->videoController->AddSeekListener(&BaseGrid::OnSeek, this))
 {
 	scrollBar->SetScrollbar(0,10,100,10);
@@ -126,7 +127,10 @@ BEGIN_EVENT_TABLE(BaseGrid,wxWindow)
 	EVT_MENU_RANGE(MENU_SHOW_COL,MENU_SHOW_COL+15,BaseGrid::OnShowColMenu)
 END_EVENT_TABLE()
 
-void BaseGrid::OnSubtitlesCommit(int type) {
+void BaseGrid::OnSubtitlesCommit(int type, const AssDialogue *changed) {
+	if (type == AssFile::COMMIT_NEW || type & (AssFile::COMMIT_ORDER | AssFile::COMMIT_DIAG_ADDREM | AssFile::COMMIT_DIAG_META | AssFile::COMMIT_DIAG_TIME))
+		CountLines(type, changed);
+
 	if (type == AssFile::COMMIT_NEW || type & AssFile::COMMIT_ORDER || type & AssFile::COMMIT_DIAG_ADDREM)
 		UpdateMaps();
 
@@ -135,8 +139,11 @@ void BaseGrid::OnSubtitlesCommit(int type) {
 		Refresh(false);
 		return;
 	}
-	if (type & AssFile::COMMIT_DIAG_TIME)
+	if (type & AssFile::COMMIT_DIAG_TIME) {
+		// The time columns are sized to fit the longest time in the file
+		SetColumnWidths();
 		Refresh(false);
+	}
 	else if (type & AssFile::COMMIT_DIAG_TEXT) {
 		for (auto const& rect : text_refresh_rects)
 			RefreshRect(rect, false);
@@ -165,12 +172,19 @@ void BaseGrid::OnHighlightVisibleChange(agi::OptionValue const& opt) {
 }
 
 void BaseGrid::UpdateStyle() {
+	wxFont old_font = font;
 	wxString fontname = FontFace("Subtitle/Grid");
 	if (fontname.empty()) fontname = "Tahoma";
 	font.SetFaceName(fontname);
 	font.SetPointSize(OPT_GET("Subtitle/Grid/Font Size")->GetInt());
 	font.SetWeight(wxFONTWEIGHT_NORMAL);
 
+	// All of the cached text widths are invalidated by a font change
+	if (!width_helper || font != old_font) {
+		width_helper = agi::make_unique<WidthHelper>();
+		CountLines(AssFile::COMMIT_NEW);
+	}
+
 	wxClientDC dc(this);
 	dc.SetFont(font);
 
@@ -589,6 +603,19 @@ void BaseGrid::AdjustScrollbar() {
 	scrollBar->Thaw();
 }
 
+void BaseGrid::CountLines(int type, const AssDialogue *changed) {
+	wxClientDC dc(this);
+	dc.SetFont(font);
+	width_helper->SetDC(&dc);
+
+	if (type == AssFile::COMMIT_NEW)
+		line_tracker->Reset(*context->ass, *width_helper);
+	else if (changed && !(type & (AssFile::COMMIT_ORDER | AssFile::COMMIT_DIAG_ADDREM)))
+		line_tracker->Changed(*changed, *width_helper);
+	else
+		line_tracker->Sync(*context->ass, *width_helper);
+}
+
 void BaseGrid::SetColumnWidths() {
 	int w, h;
 	GetClientSize(&w, &h);
@@ -600,8 +627,6 @@ void BaseGrid::SetColumnWidths() {
 	text_refresh_rects.clear();
 	int x = 0;
 
-	if (!width_helper)
-		width_helper = agi::make_unique<WidthHelper>();
 	width_helper->SetDC(&dc);
 
 	for (auto const& column : columns) {
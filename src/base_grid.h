@@ -40,6 +40,7 @@ namespace agi {
 }
 class AssDialogue;
 class GridColumn;
+class GridLineTracker;
 class WidthHelper;
 
 class BaseGrid final : public wxWindow {
@@ -69,6 +70,9 @@ class BaseGrid final : public wxWindow {
 	std::vector<std::unique_ptr<GridColumn>> columns;
 	std::vector<bool> columns_visible;
 
+	/// Statistics about the lines in the file used to size the columns
+	std::unique_ptr<GridLineTracker> line_tracker;
+
 	std::vector<wxRect> text_refresh_rects;
 
 	/// Cached brushes used for row backgrounds
@@ -100,11 +104,12 @@ class BaseGrid final : public wxWindow {
 	void OnScroll(wxScrollEvent &event);
 	void OnShowColMenu(wxCommandEvent &event);
 	void OnSize(wxSizeEvent &event);
-	void OnSubtitlesCommit(int type);
+	void OnSubtitlesCommit(int type, const AssDialogue *changed);
 	void OnActiveLineChanged(AssDialogue *);
 	void OnSeek();
 
 	void AdjustScrollbar();
+	void CountLines(int type, const AssDialogue *changed = nullptr);
 	void SetColumnWidths();
 
 	bool IsDisplayed(const AssDialogue *line) const;
@@ -34,64 +34,323 @@
 #pragma once
 
 #include <algorithm>
-#include <list>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <vector>
 
+class DataBlockCacheBudget;
+
+/// @class DataBlockCacheBase
+/// @brief The parts of DataBlockCache which don't depend on the block type
+///
+/// A shared DataBlockCacheBudget uses this interface to evict the least
+/// recently used data from whichever of its caches holds it.
+class DataBlockCacheBase {
+	friend class DataBlockCacheBudget;
+
+	/// Budget this cache counts against, if any
+	std::atomic<DataBlockCacheBudget*> budget{nullptr};
+
+protected:
+	/// Current size of the cache in bytes
+	std::atomic<size_t> size{0};
+
+	/// @brief Get a timestamp for a use of a macroblock
+	///
+	/// The clock is shared by all caches so that their uses can be compared.
+	static uint64_t Tick()
+	{
+		static std::atomic<uint64_t> clock{0};
+		return ++clock;
+	}
+
+	/// @brief Record a change in the size of the cache
+	/// @param delta Number of bytes added to (or if negative removed from) the cache
+	void Account(ptrdiff_t delta);
+
+	/// @brief Get the last use of the least recently used macroblock
+	/// @return The use's timestamp, or UINT64_MAX if the cache is empty
+	virtual uint64_t OldestUse() = 0;
+
+	/// @brief Dispose of the least recently used macroblock
+	virtual void EvictOldest() = 0;
+
+	DataBlockCacheBase() = default;
+	DataBlockCacheBase(DataBlockCacheBase&& other)
+	: size(other.size.load())
+	{
+		assert(!other.budget);
+	}
+
+public:
+	virtual ~DataBlockCacheBase() = default;
+
+	/// @brief Get the current size of the cache
+	/// @return Size in bytes of the blocks held
+	size_t GetSize() const { return size; }
+
+	/// @brief Make the cache count against a shared memory budget
+	/// @param budget Budget to use, or nullptr to stop using one
+	///
+	/// Must not be called while other threads are using the cache.
+	void SetBudget(DataBlockCacheBudget *budget);
+};
+
+/// @class DataBlockCacheBudget
+/// @brief A memory ceiling shared by several caches
+///
+/// The caches attached to a budget keep track of how much memory they're
+/// using in it. Trimming the budget then evicts the least recently used
+/// macroblocks across all of the caches until they fit.
+class DataBlockCacheBudget {
+	friend class DataBlockCacheBase;
+
+	std::mutex lock;
+
+	/// Caches attached to this budget
+	std::vector<DataBlockCacheBase*> caches;
+
+	/// Total size in bytes of the attached caches
+	std::atomic<size_t> size{0};
+
+	/// Size to trim to
+	size_t max_size = 0;
+
+public:
+	DataBlockCacheBudget() = default;
+	DataBlockCacheBudget(DataBlockCacheBudget const&) = delete;
+	DataBlockCacheBudget& operator=(DataBlockCacheBudget const&) = delete;
+
+	~DataBlockCacheBudget()
+	{
+		for (auto cache : caches)
+			cache->budget = nullptr;
+	}
+
+	/// @brief Set the size to trim to
+	/// @param new_max_size Size in bytes
+	///
+	/// Changing the size does not trim the caches.
+	void SetMaxSize(size_t new_max_size)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		max_size = new_max_size;
+	}
+
+	/// @brief Get the total size of the attached caches
+	size_t GetSize() const { return size; }
+
+	/// @brief Evict data until the attached caches fit in the budget
+	///
+	/// As with DataBlockCache::Age, a max size of zero flushes everything.
+	/// References to evicted blocks become invalid, so this should be called
+	/// at a point where nothing is using blocks from any of the caches.
+	void Trim()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		while (size > max_size)
+		{
+			DataBlockCacheBase *oldest = nullptr;
+			uint64_t oldest_use = UINT64_MAX;
+			for (auto cache : caches)
+			{
+				uint64_t use = cache->OldestUse();
+				if (use < oldest_use)
+				{
+					oldest = cache;
+					oldest_use = use;
+				}
+			}
+
+			if (!oldest) break;
+			oldest->EvictOldest();
+		}
+	}
+};
+
+inline void DataBlockCacheBase::Account(ptrdiff_t delta)
+{
+	size += delta;
+	if (auto b = budget.load())
+		b->size += delta;
+}
+
+inline void DataBlockCacheBase::SetBudget(DataBlockCacheBudget *new_budget)
+{
+	auto old_budget = budget.load();
+	if (old_budget == new_budget) return;
+
+	if (old_budget)
+	{
+		std::lock_guard<std::mutex> guard(old_budget->lock);
+		auto& caches = old_budget->caches;
+		caches.erase(std::remove(caches.begin(), caches.end(), this), caches.end());
+		old_budget->size -= size;
+	}
+
+	budget = new_budget;
+
+	if (new_budget)
+	{
+		std::lock_guard<std::mutex> guard(new_budget->lock);
+		new_budget->caches.push_back(this);
+		new_budget->size += size;
+	}
+}
+
 /// @class DataBlockCache
 /// @brief Cache for blocks of data in a stream or similar
 /// @tparam BlockT             Type of blocks to store
 /// @tparam MacroblockExponent Controls the number of blocks per macroblock, for tuning memory usage
 /// @tparam BlockFactoryT      Type of block factory, see BasicDataBlockFactory class for detail on these
+///
+/// Blocks are grouped into macroblocks, which are allocated and aged as a
+/// unit. The macroblocks are spread over a number of shards, each with its
+/// own lock and its own least-recently-used list, so that several threads
+/// can get and insert blocks at once.
+///
+/// A reference returned by Get stays valid until the block is evicted by
+/// Age, SetBlockCount or a budget's Trim, so those should only be called by
+/// the thread which is using the blocks.
 template <typename BlockT, int MacroblockExponent, typename BlockFactoryT>
-class DataBlockCache {
+class DataBlockCache : public DataBlockCacheBase {
 	/// Type of an array of blocks
 	typedef std::vector<typename BlockFactoryT::BlockType> BlockArray;
 
 	struct MacroBlock {
-		/// This macroblock's position in the age list
-		/// Is valid iff blocks.size() > 0
-		typename std::list<MacroBlock*>::iterator position;
-
 		/// The blocks contained in the macroblock
 		BlockArray blocks;
+
+		/// Neighbours in the shard's age list, valid iff blocks.size() > 0
+		MacroBlock *newer = nullptr;
+		MacroBlock *older = nullptr;
+
+		/// Time of the last use of any block in this macroblock
+		uint64_t last_use = 0;
 	};
 
-	/// Type of an array of macro blocks
-	typedef std::vector<MacroBlock> MacroBlockArray;
+	/// A group of macroblocks sharing a lock and an age list
+	struct Shard {
+		std::mutex lock;
 
-	/// The data in the cache
-	MacroBlockArray data;
+		/// Most and least recently used non-empty macroblocks
+		MacroBlock *newest = nullptr;
+		MacroBlock *oldest = nullptr;
+	};
 
-	/// Type of a list of macro blocks
-	typedef std::list<MacroBlock*> AgeList;
+	enum : size_t {
+		/// Number of shards; must be a power of two
+		shard_count = 16,
 
-	/// The data sorted by how long it's been since they were used
-	AgeList age;
+		/// Number of blocks per macroblock
+		macroblock_size = (size_t)1 << MacroblockExponent,
 
-	/// Number of blocks per macroblock
-	size_t macroblock_size;
+		/// Bitmask to extract the inside-macroblock index for a block by bitwise and
+		macroblock_index_mask = macroblock_size - 1
+	};
 
-	/// Bitmask to extract the inside-macroblock index for a block by bitwise and
-	size_t macroblock_index_mask;
+	/// The data in the cache
+	std::vector<MacroBlock> data;
 
-	/// Current size of the cache in bytes
-	size_t size = 0;
+	/// Neighbouring macroblocks go in different shards, so that threads
+	/// working on nearby ranges don't contend
+	std::unique_ptr<Shard[]> shards;
 
 	/// Factory object for blocks
 	BlockFactoryT factory;
 
+	Shard& ShardFor(size_t mbi)
+	{
+		return shards[mbi & (shard_count - 1)];
+	}
+
+	/// @brief Get the macroblock holding a block and mark it as most recently used
+	/// @param shard The macroblock's shard, which must be locked
+	/// @param mbi   Index of the macroblock
+	MacroBlock& Touch(Shard &shard, size_t mbi)
+	{
+		auto &mb = data[mbi];
+
+		if (mb.blocks.empty())
+			mb.blocks.resize(macroblock_size);
+		else if (shard.newest == &mb)
+		{
+			mb.last_use = Tick();
+			return mb;
+		}
+		else
+			Unlink(shard, mb);
+
+		// Put it at the front of the age list
+		mb.older = shard.newest;
+		mb.newer = nullptr;
+		if (shard.newest)
+			shard.newest->newer = &mb;
+		else
+			shard.oldest = &mb;
+		shard.newest = &mb;
+
+		mb.last_use = Tick();
+		return mb;
+	}
+
+	/// @brief Remove a macroblock from its shard's age list
+	void Unlink(Shard &shard, MacroBlock &mb)
+	{
+		(mb.newer ? mb.newer->older : shard.newest) = mb.older;
+		(mb.older ? mb.older->newer : shard.oldest) = mb.newer;
+		mb.newer = mb.older = nullptr;
+	}
+
 	/// @brief Dispose of all blocks in a macroblock and mark it empty
-	/// @param mb_index Index of macroblock to clear
-	void KillMacroBlock(MacroBlock &mb)
+	/// @param shard The macroblock's shard, which must be locked
+	/// @param mb    Macroblock to clear
+	void KillMacroBlock(Shard &shard, MacroBlock &mb)
 	{
 		if (mb.blocks.empty())
 			return;
 
 		auto& ba = mb.blocks;
-		size -= (ba.size() - std::count(ba.begin(), ba.end(), nullptr)) * factory.GetBlockSize();
+		Account(-(ptrdiff_t)((ba.size() - std::count(ba.begin(), ba.end(), nullptr)) * factory.GetBlockSize()));
 
-		ba.clear();
-		age.erase(mb.position);
+		BlockArray().swap(ba);
+		Unlink(shard, mb);
+	}
+
+	uint64_t OldestUse() override
+	{
+		uint64_t oldest_use = UINT64_MAX;
+		for (size_t s = 0; s < shard_count; ++s)
+		{
+			std::lock_guard<std::mutex> guard(shards[s].lock);
+			if (shards[s].oldest)
+				oldest_use = std::min(oldest_use, shards[s].oldest->last_use);
+		}
+		return oldest_use;
+	}
+
+	void EvictOldest() override
+	{
+		Shard *oldest = nullptr;
+		uint64_t oldest_use = UINT64_MAX;
+		for (size_t s = 0; s < shard_count; ++s)
+		{
+			std::lock_guard<std::mutex> guard(shards[s].lock);
+			if (shards[s].oldest && shards[s].oldest->last_use < oldest_use)
+			{
+				oldest = &shards[s];
+				oldest_use = oldest->oldest->last_use;
+			}
+		}
+
+		if (!oldest) return;
+
+		std::lock_guard<std::mutex> guard(oldest->lock);
+		if (oldest->oldest)
+			KillMacroBlock(*oldest, *oldest->oldest);
 	}
 
 public:
@@ -102,15 +361,22 @@ public:
 	/// Note that the block_count is the maximum block index the cache will ever see,
 	/// it is an error to request a block number greater than block_count.
 	///
-	/// The factory object passed must respond well to copying.
+	/// The factory object passed must respond well to copying. If Get is
+	/// called from several threads at once, ProduceBlock must be thread-safe.
 	DataBlockCache(size_t block_count, BlockFactoryT factory = BlockFactoryT())
-	: factory(std::move(factory))
+	: shards(new Shard[shard_count])
+	, factory(std::move(factory))
 	{
 		SetBlockCount(block_count);
 	}
 
+	/// Caches can only be moved while not attached to a budget
 	DataBlockCache(DataBlockCache&&) = default;
-	DataBlockCache& operator=(DataBlockCache&&) = default;
+
+	~DataBlockCache()
+	{
+		SetBudget(nullptr);
+	}
 
 	/// @brief Change the number of blocks in cache
 	/// @param block_count New number of blocks to hold
@@ -121,37 +387,34 @@ public:
 		if (data.size() > 0)
 			Age(0);
 
-		macroblock_size = 1UL << MacroblockExponent;
-		macroblock_index_mask = macroblock_size - 1;
-
+		data.clear();
 		data.resize((block_count + macroblock_size - 1) >> MacroblockExponent);
-		size = 0;
 	}
 
 	/// @brief Clean up the cache
 	/// @param max_size Target maximum size of the cache in bytes
 	///
-	/// Passing a max_size of 0 (zero) causes the cache to be completely flushed
-	/// in a fast manner.
+	/// Passing a max_size of 0 (zero) causes the cache to be completely flushed.
 	///
 	/// The max_size is not a hard limit, the cache size might somewhat exceed the max
 	/// after the aging operation, though it shouldn't be by much.
 	void Age(size_t max_size)
 	{
-		// Quick way out: get rid of everything
 		if (max_size == 0)
 		{
-			size_t block_count = data.size();
-			data.clear();
-			data.resize(block_count);
-			age.clear();
-			size = 0;
+			for (size_t s = 0; s < shard_count; ++s)
+			{
+				auto &shard = shards[s];
+				std::lock_guard<std::mutex> guard(shard.lock);
+				while (shard.oldest)
+					KillMacroBlock(shard, *shard.oldest);
+			}
 			return;
 		}
 
 		// Remove old entries until we're under the max size
-		for (auto it = age.rbegin(); size > max_size && it != age.rend(); )
-			KillMacroBlock(**it++);
+		while (size > max_size && OldestUse() != UINT64_MAX)
+			EvictOldest();
 	}
 
 	/// @brief Obtain a data block from the cache
@@ -160,41 +423,74 @@ public:
 	/// @return A pointer to the block in cache
 	///
 	/// It is legal to pass 0 (null) for created, in this case nothing is returned in it.
+	///
+	/// The block is produced without holding any locks, so if two threads
+	/// ask for the same missing block at once both may produce it; only one
+	/// copy is kept.
 	BlockT& Get(size_t i, bool *created = nullptr)
 	{
 		size_t mbi = i >> MacroblockExponent;
 		assert(mbi < data.size());
 
-		auto &mb = data[mbi];
+		auto &shard = ShardFor(mbi);
+		size_t block_index = i & macroblock_index_mask;
 
-		// Move this macroblock to the front of the age list
-		if (mb.blocks.empty())
 		{
-			mb.blocks.resize(macroblock_size);
-			age.push_front(&mb);
+			std::lock_guard<std::mutex> guard(shard.lock);
+			if (BlockT *b = Touch(shard, mbi).blocks[block_index].get())
+			{
+				if (created) *created = false;
+				return *b;
+			}
 		}
-		else if (mb.position != begin(age))
-			age.splice(begin(age), age, mb.position);
 
-		mb.position = age.begin();
+		auto block = factory.ProduceBlock(i);
+		assert(block != nullptr);
 
-		size_t block_index = i & macroblock_index_mask;
-		assert(block_index < mb.blocks.size());
+		std::lock_guard<std::mutex> guard(shard.lock);
+		auto &slot = Touch(shard, mbi).blocks[block_index];
+		if (!slot)
+		{
+			slot = std::move(block);
+			Account(factory.GetBlockSize());
+		}
 
-		BlockT *b = mb.blocks[block_index].get();
+		if (created) *created = true;
+		return *slot;
+	}
 
-		if (!b)
-		{
-			mb.blocks[block_index] = factory.ProduceBlock(i);
-			b = mb.blocks[block_index].get();
-			assert(b != nullptr);
-			size += factory.GetBlockSize();
+	/// @brief Check whether a block is in the cache without producing it
+	/// @param i Index of the block to check for
+	///
+	/// This does not count as a use of the block for aging purposes.
+	bool Contains(size_t i)
+	{
+		size_t mbi = i >> MacroblockExponent;
+		if (mbi >= data.size()) return false;
 
-			if (created) *created = true;
-		}
-		else
-			if (created) *created = false;
+		std::lock_guard<std::mutex> guard(ShardFor(mbi).lock);
+		auto const& blocks = data[mbi].blocks;
+		return !blocks.empty() && blocks[i & macroblock_index_mask];
+	}
+
+	/// @brief Store a block which was produced outside of the cache
+	/// @param i     Index of the block
+	/// @param block The block's data
+	///
+	/// If the block is already in the cache the new one is discarded.
+	void Insert(size_t i, typename BlockFactoryT::BlockType block)
+	{
+		if (!block) return;
+
+		size_t mbi = i >> MacroblockExponent;
+		assert(mbi < data.size());
+
+		auto &shard = ShardFor(mbi);
+		std::lock_guard<std::mutex> guard(shard.lock);
+		auto &slot = Touch(shard, mbi).blocks[i & macroblock_index_mask];
+		if (slot) return;
 
-		return *b;
+		slot = std::move(block);
+		Account(factory.GetBlockSize());
 	}
 };
@@ -19,6 +19,7 @@
 #include "version.h"
 
 #include <libaegisub/format.h>
+#include <libaegisub/log.h>
 #include <libaegisub/util.h>
 
 #include <boost/filesystem/fstream.hpp>
@@ -85,6 +86,10 @@ void Write(std::string const& error) {
 		file << util::strftime("--- %y-%m-%d %H:%M:%S ------------------\n");
 		file << agi::format("VER - %s\n", GetAegisubLongVersionString());
 		file << agi::format("EXC - Aegisub has crashed with unhandled exception \"%s\".\n", error);
+		if (log::log) {
+			for (auto const& sm : log::log->GetMessages())
+				file << agi::format("LOG - %c %s:%d %s\n", log::Severity_ID[sm.severity], sm.file, sm.line, sm.message);
+		}
 		file << "----------------------------------------\n\n";
 		file.close();
 	}
@@ -75,7 +75,7 @@ enum Mode {
 	REGEXP
 };
 
-std::set<AssDialogue*> process(std::string const& match_text, bool match_case, Mode mode, bool invert, bool comments, bool dialogue, int field_n, AssFile *ass) {
+Selection process(std::string const& match_text, bool match_case, Mode mode, bool invert, bool comments, bool dialogue, int field_n, AssFile *ass) {
 	SearchReplaceSettings settings = {
 		match_text,
 		std::string(),
@@ -90,7 +90,7 @@ std::set<AssDialogue*> process(std::string const& match_text, bool match_case, M
 
 	auto predicate = SearchReplaceEngine::GetMatcher(settings);
 
-	std::set<AssDialogue*> matches;
+	Selection matches;
 	for (auto& diag : ass->Events) {
 		if (diag.Comment && !comments) continue;
 		if (!diag.Comment && !dialogue) continue;
@@ -182,7 +182,7 @@ DialogSelection::~DialogSelection() {
 }
 
 void DialogSelection::Process(wxCommandEvent&) {
-	std::set<AssDialogue*> matches;
+	Selection matches;
 
 	try {
 		matches = process(
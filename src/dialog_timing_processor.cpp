@@ -42,6 +42,7 @@
 
 #include <libaegisub/address_of_adaptor.h>
 #include <libaegisub/ass/time.h>
+#include <libaegisub/timing_processor.h>
 
 #include <algorithm>
 #include <boost/range/adaptor/filtered.hpp>
@@ -360,86 +361,43 @@ std::vector<AssDialogue*> DialogTimingProcessor::SortDialogues() {
 	return sorted;
 }
 
-static int get_closest_kf(std::vector<int> const& kf, int frame) {
-	const auto pos = boost::upper_bound(kf, frame);
-	// Return last keyframe if this is after the last one
-	if (pos == end(kf)) return kf.back();
-	// *pos is greater than frame, and *(pos - 1) is less than or equal to frame
-	return (pos == begin(kf) || *pos - frame < frame - *(pos - 1)) ? *pos : *(pos - 1);
-}
-
-template<class Iter, class Field>
-static int safe_time(Iter begin, Iter end, AssDialogue *comp, int initial, Field field, int const& (*cmp)(int const&, int const&)) {
-	// Compare to every previous line (yay for O(n^2)!) to see if it's OK to add lead-in
-	for (; begin != end; ++begin) {
-		// If the line doesn't already collide with this line, extend it only
-		// to the edge of the line
-		if (!comp->CollidesWith(*begin))
-			initial = cmp(initial, (*begin)->*field);
-	}
-	return initial;
-}
-
 void DialogTimingProcessor::Process() {
 	std::vector<AssDialogue*> sorted = SortDialogues();
 	if (sorted.empty()) return;
 
-	// Add lead-in/out
-	if (hasLeadIn->IsChecked() && leadIn) {
-		for (size_t i = 0; i < sorted.size(); ++i)
-			sorted[i]->Start = safe_time(sorted.rend() - i, sorted.rend(),
-				sorted[i], sorted[i]->Start - leadIn,
-				&AssDialogue::End, &std::max<int>);
-	}
-
-	if (hasLeadOut->IsChecked() && leadOut) {
-		for (size_t i = 0; i < sorted.size(); ++i)
-			sorted[i]->End = safe_time(sorted.begin() + i + 1, sorted.end(),
-				sorted[i], sorted[i]->End + leadOut,
-				&AssDialogue::Start, &std::min<int>);
+	agi::timing::Settings settings;
+	if (hasLeadIn->IsChecked())
+		settings.lead_in = leadIn;
+	if (hasLeadOut->IsChecked())
+		settings.lead_out = leadOut;
+
+	settings.adjacent = adjsEnable->IsChecked();
+	settings.adjacent_gap = adjGap;
+	settings.adjacent_overlap = adjOverlap;
+	settings.adjacent_bias = adjacentBias->GetValue() / 100.0;
+
+	std::vector<int> kf;
+	settings.keyframes = keysEnable->IsChecked();
+	if (settings.keyframes) {
+		kf = c->project->Keyframes();
+		if (auto provider = c->project->VideoProvider())
+			kf.push_back(provider->GetFrameCount() - 1);
 	}
+	settings.before_start = beforeStart;
+	settings.after_start = afterStart;
+	settings.before_end = beforeEnd;
+	settings.after_end = afterEnd;
 
-	// Make adjacent
-	if (adjsEnable->IsChecked()) {
-		double bias = adjacentBias->GetValue() / 100.0;
-
-		for (size_t i = 1; i < sorted.size(); ++i) {
-			AssDialogue *prev = sorted[i - 1];
-			AssDialogue *cur = sorted[i];
-
-			int dist = cur->Start - prev->End;
-			if ((dist < 0 && -dist <= adjOverlap) || (dist > 0 && dist <= adjGap)) {
-				int setPos = prev->End + int(dist * bias);
-				cur->Start = setPos;
-				prev->End = setPos;
-			}
-		}
-	}
+	std::vector<agi::timing::Line> lines;
+	lines.reserve(sorted.size());
+	for (auto diag : sorted)
+		lines.push_back({diag->Start, diag->End});
 
-	// Keyframe snapping
-	if (keysEnable->IsChecked()) {
-		std::vector<int> kf = c->project->Keyframes();
-		auto fps = c->project->Timecodes();
-		if (auto provider = c->project->VideoProvider())
-			kf.push_back(provider->GetFrameCount() - 1);
+	agi::timing::Process(lines, settings, kf, c->project->Timecodes());
 
-		for (AssDialogue *cur : sorted) {
-			// Get start/end frames
-			int startF = fps.FrameAtTime(cur->Start, agi::vfr::START);
-			int endF = fps.FrameAtTime(cur->End, agi::vfr::END);
-
-			// Get closest for start
-			int closest = get_closest_kf(kf, startF);
-			int time = fps.TimeAtFrame(closest, agi::vfr::START);
-			if ((closest > startF && time - cur->Start <= beforeStart) || (closest < startF && cur->Start - time <= afterStart))
-				cur->Start = time;
-
-			// Get closest for end
-			closest = get_closest_kf(kf, endF) - 1;
-			time = fps.TimeAtFrame(closest, agi::vfr::END);
-			if ((closest > endF && time - cur->End <= beforeEnd) || (closest < endF && cur->End - time <= afterEnd))
-				cur->End = time;
-		}
+	for (size_t i = 0; i < sorted.size(); ++i) {
+		sorted[i]->Start = lines[i].Start;
+		sorted[i]->End = lines[i].End;
 	}
 
 	c->ass->Commit(_("timing processor"), AssFile::COMMIT_DIAG_TIME);
@@ -35,6 +35,7 @@
 #include "compat.h"
 #include "format.h"
 #include "include/aegisub/context.h"
+#include "parallel_transform.h"
 #include "project.h"
 
 #include <libaegisub/of_type_adaptor.h>
@@ -156,14 +157,15 @@ void AssTransformFramerateFilter::TransformTimeTags(std::string const& name, Ass
 	VariableDataType type = curParam->GetType();
 	if (type != VariableDataType::INT && type != VariableDataType::FLOAT) return;
 
-	AssTransformFramerateFilter *instance = static_cast<AssTransformFramerateFilter*>(curData);
+	LineState *instance = static_cast<LineState*>(curData);
 	AssDialogue *curDiag = instance->line;
+	auto filter = instance->filter;
 
 	int parVal = curParam->Get<int>();
 
 	switch (curParam->classification) {
 		case AssParameterClass::RELATIVE_TIME_START: {
-			int value = instance->ConvertTime(trunc_cs(curDiag->Start) + parVal) - instance->newStart;
+			int value = filter->ConvertTime(trunc_cs(curDiag->Start) + parVal) - instance->newStart;
 
 			// An end time of 0 is actually the end time of the line, so ensure
 			// nonzero is never converted to 0
@@ -175,11 +177,11 @@ void AssTransformFramerateFilter::TransformTimeTags(std::string const& name, Ass
 			break;
 		}
 		case AssParameterClass::RELATIVE_TIME_END:
-			curParam->Set(instance->newEnd - instance->ConvertTime(trunc_cs(curDiag->End) - parVal));
+			curParam->Set(instance->newEnd - filter->ConvertTime(trunc_cs(curDiag->End) - parVal));
 			break;
 		case AssParameterClass::KARAOKE: {
 			int start = curDiag->Start / 10 + instance->oldK + parVal;
-			int value = (instance->ConvertTime(start * 10) - instance->newStart) / 10 - instance->newK;
+			int value = (filter->ConvertTime(start * 10) - instance->newStart) / 10 - instance->newK;
 			instance->oldK += parVal;
 			instance->newK += value;
 			curParam->Set(value);
@@ -192,24 +194,27 @@ void AssTransformFramerateFilter::TransformTimeTags(std::string const& name, Ass
 
 void AssTransformFramerateFilter::TransformFrameRate(AssFile *subs) {
 	if (!Input.IsLoaded() || !Output.IsLoaded()) return;
-	for (auto& curDialogue : subs->Events) {
-		line = &curDialogue;
-		newK = 0;
-		oldK = 0;
-		newStart = trunc_cs(ConvertTime(curDialogue.Start));
-		newEnd = trunc_cs(ConvertTime(curDialogue.End) + 9);
+
+	LineState initial;
+	initial.filter = this;
+	ParallelTransform(subs->Events, initial, [](AssDialogue &curDialogue, LineState &state) {
+		state.line = &curDialogue;
+		state.newK = 0;
+		state.oldK = 0;
+		state.newStart = trunc_cs(state.filter->ConvertTime(curDialogue.Start));
+		state.newEnd = trunc_cs(state.filter->ConvertTime(curDialogue.End) + 9);
 
 		// Process stuff
-		auto blocks = line->ParseTags();
+		auto blocks = curDialogue.ParseTags();
 		for (auto block : blocks | agi::of_type<AssDialogueBlockOverride>())
-			block->ProcessParameters(TransformTimeTags, this);
-		curDialogue.Start = newStart;
-		curDialogue.End = newEnd;
+			block->ProcessParameters(TransformTimeTags, &state);
+		curDialogue.Start = state.newStart;
+		curDialogue.End = state.newEnd;
 		curDialogue.UpdateText(blocks);
-	}
+	});
 }
 
-int AssTransformFramerateFilter::ConvertTime(int time) {
+int AssTransformFramerateFilter::ConvertTime(int time) const {
 	int frame = Output.FrameAtTime(time);
 	int frameStart = Output.TimeAtFrame(frame);
 	int frameEnd = Output.TimeAtFrame(frame + 1);
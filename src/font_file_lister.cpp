@@ -24,6 +24,7 @@
 
 #include <libaegisub/format_flyweight.h>
 #include <libaegisub/format_path.h>
+#include <libaegisub/parallel.h>
 
 #include <algorithm>
 #include <tuple>
@@ -53,19 +54,34 @@ wxString format_missing(wxString const& str) {
 }
 }
 
+void CodepointSet::merge(CodepointSet const& other) {
+	for (auto const& block : other.blocks)
+		blocks[block.first] |= block.second;
+}
+
+std::vector<int> CodepointSet::to_vector() const {
+	std::vector<int> ret;
+	for (auto const& block : blocks) {
+		for (int i = 0; i < 256; ++i) {
+			if (block.second[i])
+				ret.push_back(block.first * 256 + i);
+		}
+	}
+	return ret;
+}
+
 FontCollector::FontCollector(FontCollectorStatusCallback status_callback)
 : status_callback(std::move(status_callback))
 , lister(this->status_callback)
 {
 }
 
-void FontCollector::ProcessDialogueLine(const AssDialogue *line, int index) {
+void FontCollector::ProcessDialogueLine(const AssDialogue *line, int index, ChunkUsage &chunk) const {
 	if (line->Comment) return;
 
 	auto style_it = styles.find(line->Style);
 	if (style_it == end(styles)) {
-		status_callback(fmt_tl("Style '%s' does not exist\n", line->Style), 2);
-		++missing;
+		chunk.missing_styles.push_back(line->Style);
 		return;
 	}
 
@@ -79,7 +95,8 @@ void FontCollector::ProcessDialogueLine(const AssDialogue *line, int index) {
 		case AssBlockType::OVERRIDE:
 			for (auto const& tag : static_cast<AssDialogueBlockOverride&>(*block).Tags) {
 				if (tag.Name == "\\r") {
-					style = styles[tag.Params[0].Get(line->Style.get())];
+					auto it = styles.find(tag.Params[0].Get(line->Style.get()));
+					style = it != end(styles) ? it->second : StyleInfo();
 					overriden = false;
 				}
 				else if (tag.Name == "\\b") {
@@ -102,7 +119,7 @@ void FontCollector::ProcessDialogueLine(const AssDialogue *line, int index) {
 			if (text.empty())
 				continue;
 
-			auto& usage = used_styles[style];
+			auto& usage = chunk.used_styles[style];
 
 			if (overriden) {
 				auto& lines = usage.lines;
@@ -121,21 +138,18 @@ void FontCollector::ProcessDialogueLine(const AssDialogue *line, int index) {
 					}
 					if (next == 'h') {
 						++i;
-						chars.push_back(0xA0);
+						chars.insert(0xA0);
 						continue;
 					}
 
-					chars.push_back('\\');
+					chars.insert('\\');
 					continue;
 				}
 
 				UChar32 c;
 				U8_NEXT(&text[0], i, size, c);
-				chars.push_back(c);
+				chars.insert(c);
 			}
-
-			sort(begin(chars), end(chars));
-			chars.erase(unique(chars.begin(), chars.end()), chars.end());
 			break;
 		}
 		case AssBlockType::DRAWING:
@@ -145,11 +159,9 @@ void FontCollector::ProcessDialogueLine(const AssDialogue *line, int index) {
 	}
 }
 
-void FontCollector::ProcessChunk(std::pair<StyleInfo, UsageData> const& style) {
+void FontCollector::ProcessChunk(std::pair<const StyleInfo, UsageData> const& style, CollectionResult &res) {
 	if (style.second.chars.empty()) return;
 
-	auto res = lister.GetFontPaths(style.first.facename, style.first.bold, style.first.italic, style.second.chars);
-
 	if (res.paths.empty()) {
 		status_callback(fmt_tl("Could not find font '%s'\n", style.first.facename), 2);
 		PrintUsage(style.second);
@@ -212,12 +224,49 @@ std::vector<agi::fs::path> FontCollector::GetFontPaths(const AssFile *file) {
 		used_styles[info].styles.push_back(style.name);
 	}
 
-	int index = 0;
+	// Lines are processed in parallel chunks, which are then merged in order
+	// so that the usage information and messages match a serial scan
+	std::vector<const AssDialogue *> lines;
 	for (auto const& diag : file->Events)
-		ProcessDialogueLine(&diag, ++index);
+		lines.push_back(&diag);
+
+	const size_t min_lines_per_chunk = 1000;
+	size_t chunk_count = agi::parallel::ChunkCount(lines.size(), min_lines_per_chunk);
+	std::vector<ChunkUsage> chunks(chunk_count);
+	agi::parallel::ForChunks(lines.size(), chunk_count, [&](size_t i, size_t begin, size_t end) {
+		for (size_t j = begin; j < end; ++j)
+			ProcessDialogueLine(lines[j], j + 1, chunks[i]);
+	});
+
+	for (auto& chunk : chunks) {
+		for (auto const& style : chunk.missing_styles) {
+			status_callback(fmt_tl("Style '%s' does not exist\n", style), 2);
+			++missing;
+		}
+		for (auto& style : chunk.used_styles) {
+			auto& usage = used_styles[style.first];
+			usage.chars.merge(style.second.chars);
+			usage.lines.insert(usage.lines.end(), style.second.lines.begin(), style.second.lines.end());
+		}
+	}
+	chunks.clear();
 
 	status_callback(_("Searching for font files\n"), 0);
-	for (auto const& style : used_styles) ProcessChunk(style);
+
+	// Font lookups are independent of each other, so do them all at once and
+	// then report the results in order
+	std::vector<std::pair<const StyleInfo, UsageData> const*> to_look_up;
+	for (auto const& style : used_styles)
+		to_look_up.push_back(&style);
+	std::vector<CollectionResult> found(to_look_up.size());
+	agi::parallel::For(to_look_up.size(), [&](size_t i) {
+		auto const& style = *to_look_up[i];
+		if (!style.second.chars.empty())
+			found[i] = lister.GetFontPaths(style.first.facename, style.first.bold, style.first.italic, style.second.chars.to_vector());
+	});
+	for (size_t i = 0; i < to_look_up.size(); ++i)
+		ProcessChunk(*to_look_up[i], found[i]);
+
 	status_callback(_("Done\n\n"), 0);
 
 	std::vector<agi::fs::path> paths;
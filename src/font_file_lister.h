@@ -17,9 +17,11 @@
 #include <libaegisub/fs_fwd.h>
 #include <libaegisub/scoped_ptr.h>
 
+#include <bitset>
 #include <boost/filesystem/path.hpp>
 #include <functional>
 #include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -45,6 +47,8 @@ class GdiFontFileLister {
 	std::unordered_multimap<uint32_t, agi::fs::path> index;
 	agi::scoped_holder<HDC> dc;
 	std::string buffer;
+	/// The DC and buffer can't be used by several lookups at once
+	std::mutex lock;
 
 	bool ProcessLogFont(LOGFONTW const& expected, LOGFONTW const& actual, std::vector<int> const& characters);
 
@@ -88,7 +92,12 @@ typedef struct _FcFontSet FcFontSet;
 /// @class FontConfigFontFileLister
 /// @brief fontconfig powered font lister
 class FontConfigFontFileLister {
-	agi::scoped_holder<FcConfig*> config;
+	/// Fonts known to fontconfig and the results of previous lookups
+	struct FontIndex;
+	FontIndex &index;
+
+	/// Get the process-wide font index, building it if needed
+	static FontIndex& GetIndex(FontCollectorStatusCallback &cb);
 
 	/// @brief Case-insensitive match ASS/SSA font family against full name. (also known as "name for humans")
 	/// @param family font fullname
@@ -113,6 +122,20 @@ public:
 using FontFileLister = FontConfigFontFileLister;
 #endif
 
+/// A set of codepoints, stored as a bitmap for each block of 256 codepoints
+/// which has any members. Adding a character is constant time and merging
+/// two sets only touches the blocks they use.
+class CodepointSet {
+	std::map<int, std::bitset<256>> blocks;
+public:
+	void insert(int codepoint) { blocks[codepoint >> 8].set(codepoint & 0xFF); }
+	/// Add all of the members of another set to this one
+	void merge(CodepointSet const& other);
+	bool empty() const { return blocks.empty(); }
+	/// Get the members of the set in ascending order
+	std::vector<int> to_vector() const;
+};
+
 /// @class FontCollector
 /// @brief Class which collects the paths to all fonts used in a script
 class FontCollector {
@@ -126,11 +149,19 @@ class FontCollector {
 
 	/// Data about where each style is used
 	struct UsageData {
-		std::vector<int> chars;          ///< Characters used in this style which glyphs will be needed for
+		CodepointSet chars;              ///< Characters used in this style which glyphs will be needed for
 		std::vector<int> lines;          ///< Lines on which this style is used via overrides
 		std::vector<std::string> styles; ///< ASS styles which use this style
 	};
 
+	/// Styles used by a contiguous range of lines, gathered independently of
+	/// the other ranges so that the lines can be processed in parallel
+	struct ChunkUsage {
+		std::map<StyleInfo, UsageData> used_styles;
+		/// Nonexistent styles used by lines in the chunk, in line order
+		std::vector<std::string> missing_styles;
+	};
+
 	/// Message callback provider by caller
 	FontCollectorStatusCallback status_callback;
 
@@ -148,10 +179,10 @@ class FontCollector {
 	int missing_glyphs = 0;
 
 	/// Gather all of the unique styles with text on a line
-	void ProcessDialogueLine(const AssDialogue *line, int index);
+	void ProcessDialogueLine(const AssDialogue *line, int index, ChunkUsage &usage) const;
 
-	/// Get the font for a single style
-	void ProcessChunk(std::pair<StyleInfo, UsageData> const& style);
+	/// Report the font found for a single style
+	void ProcessChunk(std::pair<const StyleInfo, UsageData> const& style, CollectionResult &res);
 
 	/// Print the lines and styles on which a missing font is used
 	void PrintUsage(UsageData const& data);
@@ -22,51 +22,85 @@
 #include <boost/algorithm/string/case_conv.hpp>
 #include <boost/filesystem/path.hpp>
 #include <fontconfig/fontconfig.h>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <tuple>
 #include <wx/intl.h>
 
 namespace {
-bool pattern_matches(FcPattern *pat, const char *field, std::string const& name) {
+void add_names(FcPattern *pat, const char *field, std::set<std::string>& names) {
 	FcChar8 *str;
 	for (int i = 0; FcPatternGetString(pat, field, i, &str) == FcResultMatch; ++i) {
 		std::string sstr((char *)str);
 		boost::to_lower(sstr);
-		if (sstr == name)
-			return true;
+		names.insert(std::move(sstr));
 	}
-	return false;
 }
+}
+
+/// The fontconfig configuration and an index of the fonts in it by
+/// lowercased family and full name, shared by every lister in the process.
+///
+/// Building the configuration and scanning every installed font for each
+/// lookup dominated font collection on systems with many fonts installed,
+/// so this is done once and the results of each lookup are memoised.
+struct FontConfigFontFileLister::FontIndex {
+	agi::scoped_holder<FcConfig*> config;
+
+	/// Outline fonts by name, in the order fontconfig lists them
+	std::unordered_map<std::string, std::vector<FcPattern *>> fonts;
 
-void find_font(FcFontSet *src, FcFontSet *dst, std::string const& family) {
-	if (!src) return;
+	/// Best match for each (family, weight, slant) query; null if there was
+	/// no matching font
+	std::map<std::tuple<std::string, int, int>, std::shared_ptr<FcPattern>> matches;
 
-	for (FcPattern *pat : boost::make_iterator_range(&src->fonts[0], &src->fonts[src->nfont])) {
-		int val;
-		if (FcPatternGetBool(pat, FC_OUTLINE, 0, &val) != FcResultMatch || val != FcTrue) continue;
+	std::mutex lock;
 
-		if (pattern_matches(pat, FC_FULLNAME, family) || pattern_matches(pat, FC_FAMILY, family))
-			FcFontSetAdd(dst, FcPatternDuplicate(pat));
+	void AddFonts(FcFontSet *src) {
+		if (!src) return;
+
+		for (FcPattern *pat : boost::make_iterator_range(&src->fonts[0], &src->fonts[src->nfont])) {
+			int val;
+			if (FcPatternGetBool(pat, FC_OUTLINE, 0, &val) != FcResultMatch || val != FcTrue) continue;
+
+			std::set<std::string> names;
+			add_names(pat, FC_FULLNAME, names);
+			add_names(pat, FC_FAMILY, names);
+			for (auto const& name : names)
+				fonts[name].push_back(pat);
+		}
 	}
-}
 
-}
+	FontIndex(FontCollectorStatusCallback &cb)
+	: config(FcInitLoadConfig(), FcConfigDestroy)
+	{
+		cb(_("Updating font cache\n"), 0);
+		FcConfigBuildFonts(config);
+		AddFonts(FcConfigGetFonts(config, FcSetApplication));
+		AddFonts(FcConfigGetFonts(config, FcSetSystem));
+	}
 
-FontConfigFontFileLister::FontConfigFontFileLister(FontCollectorStatusCallback &cb)
-: config(FcInitLoadConfig(), FcConfigDestroy)
-{
-	cb(_("Updating font cache\n"), 0);
-	FcConfigBuildFonts(config);
-}
+	/// Get the best match for a query, using the cached result if any
+	std::shared_ptr<FcPattern> Match(std::string const& family, int weight, int slant);
 
-CollectionResult FontConfigFontFileLister::GetFontPaths(std::string const& facename, int bold, bool italic, std::vector<int> const& characters) {
-	CollectionResult ret;
+	/// Ask fontconfig for the best match for a query
+	std::shared_ptr<FcPattern> FindMatch(std::string const& family, int weight, int slant);
+};
 
-	std::string family = facename[0] == '@' ? facename.substr(1) : facename;
-	boost::to_lower(family);
+std::shared_ptr<FcPattern> FontConfigFontFileLister::FontIndex::Match(std::string const& family, int weight, int slant) {
+	std::lock_guard<std::mutex> guard(lock);
 
-	int weight = bold == 0 ? 80 :
-	             bold == 1 ? 200 :
-	                         bold;
-	int slant  = italic ? 110 : 0;
+	auto key = std::make_tuple(family, weight, slant);
+	auto it = matches.find(key);
+	if (it != matches.end())
+		return it->second;
+
+	return matches[key] = FindMatch(family, weight, slant);
+}
+
+std::shared_ptr<FcPattern> FontConfigFontFileLister::FontIndex::FindMatch(std::string const& family, int weight, int slant) {
+	std::shared_ptr<FcPattern> ret;
 
 	// Create a fontconfig pattern to match the desired weight/slant
 	agi::scoped_holder<FcPattern*> pat(FcPatternCreate(), FcPatternDestroy);
@@ -83,26 +117,60 @@ CollectionResult FontConfigFontFileLister::GetFontPaths(std::string const& facen
 	// This is needed because the patterns returned by font matching only
 	// include the first family and fullname, so we can't always verify that
 	// we got the actual font we were asking for after the fact
+	auto named = fonts.find(family);
+	if (named == fonts.end()) return ret;
+
 	agi::scoped_holder<FcFontSet*> fset(FcFontSetCreate(), FcFontSetDestroy);
-	find_font(FcConfigGetFonts(config, FcSetApplication), fset, family);
-	find_font(FcConfigGetFonts(config, FcSetSystem), fset, family);
+	for (FcPattern *font : named->second)
+		FcFontSetAdd(fset, FcPatternDuplicate(font));
 
 	// Get the best match from fontconfig
 	FcResult result;
 	FcFontSet *sets[] = { (FcFontSet*)fset };
 
-	agi::scoped_holder<FcFontSet*> matches(FcFontSetSort(config, sets, 1, pat, false, nullptr, &result), FcFontSetDestroy);
-	if (matches->nfont == 0)
+	agi::scoped_holder<FcFontSet*> sorted(FcFontSetSort(config, sets, 1, pat, false, nullptr, &result), FcFontSetDestroy);
+	if (sorted->nfont == 0)
 		return ret;
 
-	auto match = matches->fonts[0];
+	// Keep the match alive after the sorted set is destroyed
+	FcPatternReference(sorted->fonts[0]);
+	ret.reset(sorted->fonts[0], FcPatternDestroy);
+	return ret;
+}
+
+FontConfigFontFileLister::FontIndex& FontConfigFontFileLister::GetIndex(FontCollectorStatusCallback &cb) {
+	static std::unique_ptr<FontIndex> index;
+	static std::once_flag flag;
+	std::call_once(flag, [&] { index.reset(new FontIndex(cb)); });
+	return *index;
+}
+
+FontConfigFontFileLister::FontConfigFontFileLister(FontCollectorStatusCallback &cb)
+: index(GetIndex(cb))
+{
+}
+
+CollectionResult FontConfigFontFileLister::GetFontPaths(std::string const& facename, int bold, bool italic, std::vector<int> const& characters) {
+	CollectionResult ret;
+
+	std::string family = facename[0] == '@' ? facename.substr(1) : facename;
+	boost::to_lower(family);
+
+	int weight = bold == 0 ? 80 :
+	             bold == 1 ? 200 :
+	                         bold;
+	int slant  = italic ? 110 : 0;
+
+	auto match = index.Match(family, weight, slant);
+	if (!match)
+		return ret;
 
 	FcChar8 *file;
-	if(FcPatternGetString(match, FC_FILE, 0, &file) != FcResultMatch)
+	if(FcPatternGetString(match.get(), FC_FILE, 0, &file) != FcResultMatch)
 		return ret;
 
 	FcCharSet *charset;
-	if (FcPatternGetCharSet(match, FC_CHARSET, 0, &charset) == FcResultMatch) {
+	if (FcPatternGetCharSet(match.get(), FC_CHARSET, 0, &charset) == FcResultMatch) {
 		for (int chr : characters) {
 			if (!FcCharSetHasChar(charset, chr))
 				ret.missing += chr;
@@ -111,12 +179,12 @@ CollectionResult FontConfigFontFileLister::GetFontPaths(std::string const& facen
 
 	if (weight > 80) {
 		int actual_weight = weight;
-		if (FcPatternGetInteger(match, FC_WEIGHT, 0, &actual_weight) == FcResultMatch)
+		if (FcPatternGetInteger(match.get(), FC_WEIGHT, 0, &actual_weight) == FcResultMatch)
 			ret.fake_bold = actual_weight <= 80;
 	}
 
 	int actual_slant = slant;
-	if (FcPatternGetInteger(match, FC_SLANT, 0, &actual_slant) == FcResultMatch)
+	if (FcPatternGetInteger(match.get(), FC_SLANT, 0, &actual_slant) == FcResultMatch)
 		ret.fake_italic = italic && !actual_slant;
 
 	ret.paths.emplace_back((const char *)file);
@@ -139,6 +139,7 @@ GdiFontFileLister::GdiFontFileLister(FontCollectorStatusCallback &cb)
 }
 
 CollectionResult GdiFontFileLister::GetFontPaths(std::string const& facename, int bold, bool italic, std::vector<int> const& characters) {
+	std::lock_guard<std::mutex> guard(lock);
 	CollectionResult ret;
 
 	LOGFONTW lf{};
@@ -25,6 +25,7 @@
 
 #include <libaegisub/character_count.h>
 
+#include <map>
 #include <wx/dc.h>
 
 void WidthHelper::Age() {
@@ -94,6 +95,126 @@ void GridColumn::Paint(wxDC &dc, int x, int y, const AssDialogue *d, const agi::
 }
 
 namespace {
+/// Do two versions of a line have the same values for everything which
+/// affects the column widths?
+bool same_widths(AssDialogueBase const& a, AssDialogueBase const& b) {
+	return a.Layer == b.Layer
+		&& a.Margin == b.Margin
+		&& (int)a.Start == (int)b.Start
+		&& (int)a.End == (int)b.End
+		&& a.Style == b.Style
+		&& a.Actor == b.Actor
+		&& a.Effect == b.Effect;
+}
+}
+
+void GridLineTracker::Count(AssDialogueBase const& line, int delta, WidthHelper &helper) {
+	for (auto const& column : columns)
+		column->CountLine(line, delta, helper);
+}
+
+void GridLineTracker::Update(AssDialogue const& line, WidthHelper &helper) {
+	auto it = lines.find(&line);
+	if (it == end(lines)) {
+		Count(line, 1, helper);
+		lines.emplace(&line, Entry{line, generation});
+		return;
+	}
+
+	it->second.generation = generation;
+	if (same_widths(it->second.values, line)) return;
+
+	Count(it->second.values, -1, helper);
+	Count(line, 1, helper);
+	it->second.values = line;
+}
+
+void GridLineTracker::Reset(AssFile const& file, WidthHelper &helper) {
+	for (auto const& column : columns)
+		column->ClearLines();
+	lines.clear();
+	lines.reserve(file.Events.size());
+	for (auto const& line : file.Events) {
+		Count(line, 1, helper);
+		lines.emplace(&line, Entry{line, generation});
+	}
+}
+
+void GridLineTracker::Changed(AssDialogue const& line, WidthHelper &helper) {
+	Update(line, helper);
+}
+
+void GridLineTracker::Sync(AssFile const& file, WidthHelper &helper) {
+	++generation;
+	for (auto const& line : file.Events)
+		Update(line, helper);
+
+	// Anything not seen on this pass has been removed from the file
+	for (auto it = begin(lines); it != end(lines); ) {
+		if (it->second.generation == generation)
+			++it;
+		else {
+			Count(it->second.values, -1, helper);
+			it = lines.erase(it);
+		}
+	}
+}
+
+namespace {
+/// Number of counted lines with each value of an integer field
+class ValueCounts {
+	std::map<int, int> counts;
+
+public:
+	void Add(int value, int delta) {
+		auto it = counts.emplace(value, 0).first;
+		if ((it->second += delta) <= 0)
+			counts.erase(it);
+	}
+
+	void Clear() { counts.clear(); }
+
+	/// Largest value in any line, or zero if none are positive
+	int Max() const {
+		return counts.empty() ? 0 : std::max(0, counts.rbegin()->first);
+	}
+};
+
+/// Rendered widths of the distinct non-empty values of a text field
+class WidthCounts {
+	struct Entry {
+		int lines;
+		int width;
+	};
+	std::unordered_map<boost::flyweight<std::string>, Entry> values;
+	/// Number of distinct values with each width
+	ValueCounts widths;
+
+public:
+	void Add(boost::flyweight<std::string> const& value, int delta, WidthHelper &helper) {
+		if (value.get().empty()) return;
+
+		auto it = values.find(value);
+		if (it == end(values)) {
+			if (delta <= 0) return;
+			int width = helper(value);
+			values.emplace(value, Entry{delta, width});
+			widths.Add(width, 1);
+		}
+		else if ((it->second.lines += delta) <= 0) {
+			widths.Add(it->second.width, -1);
+			values.erase(it);
+		}
+	}
+
+	void Clear() {
+		values.clear();
+		widths.Clear();
+	}
+
+	int Max() const { return widths.Max(); }
+};
+
 #define COLUMN_HEADER(value) \
 	private: const wxString header = value; \
 	public: wxString const& Header() const override { return header; }
@@ -115,17 +236,9 @@ struct GridColumnLineNumber final : GridColumn {
 	}
 };
 
-template<typename T>
-T max_value(T AssDialogueBase::*field, EntryList<AssDialogue> const& lines) {
-	T value = 0;
-	for (AssDialogue const& line : lines) {
-		if (line.*field > value)
-			value = line.*field;
-	}
-	return value;
-}
-
 struct GridColumnLayer final : GridColumn {
+	ValueCounts layers;
+
 	COLUMN_HEADER(_("L"))
 	COLUMN_DESCRIPTION(_("Layer"))
 	bool Centered() const override { return true; }
@@ -135,19 +248,36 @@ struct GridColumnLayer final : GridColumn {
 	}
 
 	int Width(const agi::Context *c, WidthHelper &helper) const override {
-		int max_layer = max_value(&AssDialogue::Layer, c->ass->Events);
+		int max_layer = layers.Max();
 		return max_layer == 0 ? 0 : helper(std::to_wstring(max_layer));
 	}
+
+	void CountLine(AssDialogueBase const& line, int delta, WidthHelper &) override {
+		layers.Add(line.Layer, delta);
+	}
+
+	void ClearLines() override { layers.Clear(); }
 };
 
 struct GridColumnTime : GridColumn {
 	bool by_frame = false;
+	agi::Time AssDialogueBase::*field;
+	ValueCounts times;
+
+	GridColumnTime(agi::Time AssDialogueBase::*field) : field(field) { }
 
 	bool Centered() const override { return true; }
 	void SetByFrame(bool by_frame) override { this->by_frame = by_frame; }
+
+	void CountLine(AssDialogueBase const& line, int delta, WidthHelper &) override {
+		times.Add(line.*field, delta);
+	}
+
+	void ClearLines() override { times.Clear(); }
 };
 
 struct GridColumnStartTime final : GridColumnTime {
+	GridColumnStartTime() : GridColumnTime(&AssDialogueBase::Start) { }
 	COLUMN_HEADER(_("Start"))
 	COLUMN_DESCRIPTION(_("Start Time"))
 
@@ -160,12 +290,13 @@ struct GridColumnStartTime final : GridColumnTime {
 	int Width(const agi::Context *c, WidthHelper &helper) const override {
 		if (!by_frame)
 			return helper(wxS("0:00:00.00"));
-		int frame = c->videoController->FrameAtTime(max_value(&AssDialogue::Start, c->ass->Events), agi::vfr::START);
+		int frame = c->videoController->FrameAtTime(times.Max(), agi::vfr::START);
 		return helper(std::to_wstring(frame));
 	}
 };
 
 struct GridColumnEndTime final : GridColumnTime {
+	GridColumnEndTime() : GridColumnTime(&AssDialogueBase::End) { }
 	COLUMN_HEADER(_("End"))
 	COLUMN_DESCRIPTION(_("End Time"))
 
@@ -178,68 +309,56 @@ struct GridColumnEndTime final : GridColumnTime {
 	int Width(const agi::Context *c, WidthHelper &helper) const override {
 		if (!by_frame)
 			return helper(wxS("0:00:00.00"));
-		int frame = c->videoController->FrameAtTime(max_value(&AssDialogue::End, c->ass->Events), agi::vfr::END);
+		int frame = c->videoController->FrameAtTime(times.Max(), agi::vfr::END);
 		return helper(std::to_wstring(frame));
 	}
 };
 
-template<typename T>
-int max_width(T AssDialogueBase::*field, EntryList<AssDialogue> const& lines, WidthHelper &helper) {
-	int w = 0;
-	for (AssDialogue const& line : lines) {
-		auto const& v = line.*field;
-		if (v.get().empty()) continue;
-		int width = helper(v);
-		if (width > w)
-			w = width;
-	}
-	return w;
-}
+struct GridColumnName : GridColumn {
+	boost::flyweight<std::string> AssDialogueBase::*field;
+	WidthCounts names;
+
+	GridColumnName(boost::flyweight<std::string> AssDialogueBase::*field) : field(field) { }
 
-struct GridColumnStyle final : GridColumn {
-	COLUMN_HEADER(_("Style"))
-	COLUMN_DESCRIPTION(_("Style"))
 	bool Centered() const override { return false; }
 
-	wxString Value(const AssDialogue *d, const agi::Context *c) const override {
-		return to_wx(d->Style);
+	wxString Value(const AssDialogue *d, const agi::Context *) const override {
+		return to_wx(d->*field);
 	}
 
-	int Width(const agi::Context *c, WidthHelper &helper) const override {
-		return max_width(&AssDialogue::Style, c->ass->Events, helper);
+	int Width(const agi::Context *, WidthHelper &) const override {
+		return names.Max();
+	}
+
+	void CountLine(AssDialogueBase const& line, int delta, WidthHelper &helper) override {
+		names.Add(line.*field, delta, helper);
 	}
+
+	void ClearLines() override { names.Clear(); }
+};
+
+struct GridColumnStyle final : GridColumnName {
+	GridColumnStyle() : GridColumnName(&AssDialogueBase::Style) { }
+	COLUMN_HEADER(_("Style"))
+	COLUMN_DESCRIPTION(_("Style"))
 };
 
-struct GridColumnEffect final : GridColumn {
+struct GridColumnEffect final : GridColumnName {
+	GridColumnEffect() : GridColumnName(&AssDialogueBase::Effect) { }
 	COLUMN_HEADER(_("Effect"))
 	COLUMN_DESCRIPTION(_("Effect"))
-	bool Centered() const override { return false; }
-
-	wxString Value(const AssDialogue *d, const agi::Context *) const override {
-		return to_wx(d->Effect);
-	}
-
-	int Width(const agi::Context *c, WidthHelper &helper) const override {
-		return max_width(&AssDialogue::Effect, c->ass->Events, helper);
-	}
 };
 
-struct GridColumnActor final : GridColumn {
+struct GridColumnActor final : GridColumnName {
+	GridColumnActor() : GridColumnName(&AssDialogueBase::Actor) { }
 	COLUMN_HEADER(_("Actor"))
 	COLUMN_DESCRIPTION(_("Actor"))
-	bool Centered() const override { return false; }
-
-	wxString Value(const AssDialogue *d, const agi::Context *) const override {
-		return to_wx(d->Actor);
-	}
-
-	int Width(const agi::Context *c, WidthHelper &helper) const override {
-		return max_width(&AssDialogue::Actor, c->ass->Events, helper);
-	}
 };
 
 struct GridColumnMargin : GridColumn {
 	int index;
+	ValueCounts margins;
+
 	GridColumnMargin(int index) : index(index) { }
 
 	bool Centered() const override { return true; }
@@ -249,13 +368,15 @@ struct GridColumnMargin : GridColumn {
 	}
 
 	int Width(const agi::Context *c, WidthHelper &helper) const override {
-		int max = 0;
-		for (AssDialogue const& line : c->ass->Events) {
-			if (line.Margin[index] > max)
-				max = line.Margin[index];
-		}
+		int max = margins.Max();
 		return max == 0 ? 0 : helper(std::to_wstring(max));
 	}
+
+	void CountLine(AssDialogueBase const& line, int delta, WidthHelper &) override {
+		margins.Add(line.Margin[index], delta);
+	}
+
+	void ClearLines() override { margins.Clear(); }
 };
 
 struct GridColumnMarginLeft final : GridColumnMargin {
@@ -14,6 +14,7 @@
 //
 // Aegisub Project http://www.aegisub.org/
 
+#include "ass_dialogue.h"
 #include "flyweight_hash.h"
 
 #include <memory>
@@ -21,7 +22,7 @@
 #include <vector>
 #include <unordered_map>
 
-class AssDialogue;
+class AssFile;
 class wxDC;
 class wxString;
 namespace agi { struct Context; }
@@ -74,6 +75,44 @@ public:
 	virtual void UpdateWidth(const agi::Context *c, WidthHelper &helper);
 	virtual void SetByFrame(bool /* by_frame */) { }
 	void SetVisible(bool new_value) { visible = new_value; }
+
+	/// Add (delta = 1) or remove (delta = -1) a line's values from the
+	/// statistics which the column's width is calculated from
+	virtual void CountLine(AssDialogueBase const& /* line */, int /* delta */, WidthHelper &) { }
+	/// Forget all counted lines
+	virtual void ClearLines() { }
+};
+
+/// @class GridLineTracker
+/// @brief Keeps the grid columns' width statistics in sync with the file
+///
+/// Remembers the values each line had when it was last counted, so that
+/// after a commit only the lines which actually changed have to be recounted,
+/// and text only has to be measured for values not already in the file.
+class GridLineTracker {
+	struct Entry {
+		AssDialogueBase values;
+		unsigned generation;
+	};
+
+	std::vector<std::unique_ptr<GridColumn>> const& columns;
+	std::unordered_map<const AssDialogue *, Entry> lines;
+	unsigned generation = 0;
+
+	void Count(AssDialogueBase const& line, int delta, WidthHelper &helper);
+	void Update(AssDialogue const& line, WidthHelper &helper);
+
+public:
+	GridLineTracker(std::vector<std::unique_ptr<GridColumn>> const& columns)
+	: columns(columns) { }
+
+	/// Discard all statistics and count every line in the file
+	void Reset(AssFile const& file, WidthHelper &helper);
+	/// Recount a single line which may have been modified
+	void Changed(AssDialogue const& line, WidthHelper &helper);
+	/// Recount all lines which have been added, removed or modified since the
+	/// last call
+	void Sync(AssFile const& file, WidthHelper &helper);
 };
 
 std::vector<std::unique_ptr<GridColumn>> GetGridColumns();
@@ -38,16 +38,30 @@
 #include <string>
 #include <vector>
 
+class AssDialogue;
 class AssFile;
 struct VideoFrame;
 
 class SubtitlesProvider {
 	std::vector<char> buffer;
+	/// Index of the loaded event for each row of the last file loaded, or -1
+	/// if that row was not loaded. Empty if only some of the lines were loaded.
+	std::vector<int> event_index;
+
 	virtual void LoadSubtitles(const char *data, size_t len)=0;
+	/// Number of events the renderer actually loaded, or -1 if unknown
+	virtual int EventCount() const { return -1; }
+	/// Replace a single loaded event with the passed serialized line, or hide
+	/// it if len is zero. Returns false if the event could not be replaced.
+	virtual bool UpdateEvent(size_t index, const char *data, size_t len) { return false; }
 
 public:
 	virtual ~SubtitlesProvider() = default;
 	void LoadSubtitles(AssFile *subs, int time = -1);
+	/// @brief Update a single line of the last file loaded in place
+	/// @param line New version of the line, with the same Row as the old one
+	/// @return Was the line updated? If not, the file needs to be reloaded.
+	bool UpdateLine(AssDialogue const& line);
 	virtual void DrawSubtitles(VideoFrame &dst, double time)=0;
 	virtual void Reinitialize() { }
 };
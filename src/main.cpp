@@ -47,6 +47,7 @@
 #include "format.h"
 #include "frame_main.h"
 #include "include/aegisub/context.h"
+#include "include/aegisub/video_provider.h"
 #include "libresrc/libresrc.h"
 #include "options.h"
 #include "project.h"
@@ -55,7 +56,11 @@
 #include "utils.h"
 #include "value_event.h"
 #include "version.h"
+#include "video_frame.h"
+#include "video_provider_manager.h"
 
+#include <libaegisub/ass/time.h>
+#include <libaegisub/background_runner.h>
 #include <libaegisub/dispatch.h>
 #include <libaegisub/format_path.h>
 #include <libaegisub/fs.h>
@@ -65,10 +70,12 @@
 #include <libaegisub/path.h>
 #include <libaegisub/util.h>
 
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/interprocess/streams/bufferstream.hpp>
 #include <boost/locale.hpp>
 #include <locale>
 #include <wx/clipbrd.h>
+#include <wx/image.h>
 #include <wx/msgdlg.h>
 #include <wx/stackwalk.h>
 #include <wx/utils.h>
@@ -130,19 +137,110 @@ bool ProcessTemplate(const char* in, const char* out) {
 return false;
 
 }
+
+namespace {
+/// Runs tasks on the calling thread, printing their messages to stdout
+struct ConsoleRunner final : agi::BackgroundRunner, agi::ProgressSink {
+	void Run(std::function<void(agi::ProgressSink *)> task) override { task(this); }
+	void SetIndeterminate() override { }
+	void SetTitle(std::string const& title) override { std::cout << title << std::endl; }
+	void SetMessage(std::string const& msg) override { std::cout << msg << std::endl; }
+	void SetProgress(int64_t, int64_t) override { }
+	void Log(std::string const& str) override { std::cout << str; }
+	bool IsCancelled() override { return false; }
+};
+
+/// Write a frame as top-down rows of 32-bit BGRA pixels
+void SaveRaw(VideoFrame const& frame, agi::fs::path const& path) {
+	agi::io::Save file(path, true);
+	auto& out = file.Get();
+	for (size_t y = 0; y < frame.height; ++y) {
+		size_t row = frame.flipped ? frame.height - 1 - y : y;
+		out.write(reinterpret_cast<const char *>(frame.Pixels() + row * frame.pitch), frame.width * 4);
+	}
+}
+
+/// Parse a time given on the command line, either as a number of milliseconds
+/// or as h:mm:ss.cc
+/// @return false if str is not a valid time
+bool ParseRenderTime(std::string const& str, int& time) {
+	if (str.find(':') != std::string::npos) {
+		if (str.find_first_not_of("0123456789:.") != std::string::npos)
+			return false;
+		time = agi::Time(str);
+		return true;
+	}
+
+	if (str.empty() || str.size() > 9 || str.find_first_not_of("0123456789") != std::string::npos)
+		return false;
+	time = std::stoi(str);
+	return true;
+}
+}
+
+/// Render the subtitles in `in` over `video` at each of `times`, writing each
+/// frame next to `out` with the time appended to the file name. Frames are
+/// written as PNG if `out` has a .png extension and as raw BGRA otherwise.
+bool RenderPreviews(const char* in, const char* video, agi::fs::path const& out, std::vector<int> const& times) {
+	try {
+		std::unique_ptr<agi::Context> context(agi::make_unique<agi::Context>());
+		context->project->LoadSubtitles(in);
+
+		ConsoleRunner runner;
+		auto provider = VideoProviderFactory::GetProvider(video, "", &runner);
+		auto fps = provider->GetFPS();
+
+		bool png = boost::iequals(out.extension().string(), ".png");
+		if (png && !wxImage::FindHandler(wxBITMAP_TYPE_PNG))
+			wxImage::AddHandler(new wxPNGHandler);
+
+		libass::RenderBatch(context->ass.get(), times.size(),
+			[&](size_t i, VideoFrame& frame) {
+				provider->GetFrame(fps.FrameAtTime(times[i], agi::vfr::START), frame);
+				return times[i];
+			},
+			[&](size_t i, VideoFrame& frame) {
+				auto path = out.parent_path() / agi::format("%s_%d%s", out.stem().string(), times[i], out.extension().string());
+				if (png)
+					GetImage(frame).SaveFile(to_wx(path.string()), wxBITMAP_TYPE_PNG);
+				else
+					SaveRaw(frame, path);
+			});
+
+		std::cout << "rendered " << times.size() << " frames" << std::endl;
+		return true;
+	}
+	catch (agi::Exception const& err) {
+		std::cout << "exception:" << err.GetMessage() << std::endl;
+	}
+	catch (std::exception const& err) {
+		std::cout << "exception:" << err.what() << std::endl;
+	}
+	catch (std::string const& err) {
+		std::cout << "exception:" << err << std::endl;
+	}
+	return false;
+}
+
 /// @brief Gets called when application starts.
 /// @return bool
 bool AegisubApp::OnInit() {
         config::path = new agi::Path;
-        agi::dispatch::Init([](agi::dispatch::Thunk f) { });
+        agi::dispatch::Init();
 	agi::log::log = new agi::log::LogSink;
-#ifdef _DEBUG
 	agi::log::log->Subscribe(agi::make_unique<agi::log::EmitSTDOUT>());
-#endif
        auto conf_local(config::path->Decode("./config.json"));
        std::unique_ptr<std::istream> localConfig(agi::io::Open(conf_local));
 	config::opt = new agi::Options(conf_local, GET_DEFAULT_CONFIG(default_config));
 
+	// Per-section log levels, e.g. "warning,video=debug"
+	try {
+		agi::log::SetLevels(OPT_GET("App/Log Level")->GetString());
+	}
+	catch (agi::InvalidInputException const& err) {
+		std::cout << "exception:" << err.GetMessage() << std::endl;
+	}
+
 	// Set config file
 
 	StartupLog("Inside OnInit");
@@ -192,12 +290,49 @@ bool AegisubApp::OnInit() {
 
 	StartupLog("Initialization complete");
 	auto const& args = argv.GetArguments();
-        if (args.size() != 3) {
+        bool valid = true;
+        std::vector<int> times;
+        if (args.size() >= 6 && args[1] == "--render") {
+            for (size_t i = 5; i < args.size() && valid; ++i) {
+                std::string time = from_wx(args[i]);
+                times.emplace_back();
+                valid = ParseRenderTime(time, times.back());
+                if (!valid)
+                    std::cout << "invalid time: " << time << std::endl;
+            }
+        }
+        else
+            valid = args.size() == 3;
+
+        if (!valid) {
             std::cout << "usage:" << args[0] << " in out" << std::endl;
+            std::cout << "       " << args[0] << " --render in video out.png|out.bgra time..." << std::endl;
+            std::cout << "video may be a dummy video such as ?dummy:23.976:40000:1920:1080:0:0:0:" << std::endl;
+            std::cout << "time is either milliseconds or h:mm:ss.cc" << std::endl;
         }
-        else {
+        else if (args.size() >= 6)
+            RenderPreviews(args[2], args[3], from_wx(args[4]), times);
+        else
             ProcessTemplate(args[1], args[2]);
-        }
+
+	// Run anything the background queues handed back to the main thread.
+	// Exceptions from Async thunks are rethrown here, so report them and
+	// carry on with the rest of the queue rather than crashing on exit.
+	for (;;) {
+		try {
+			agi::dispatch::ProcessMainQueue();
+			break;
+		}
+		catch (agi::Exception const& err) {
+			std::cout << "exception:" << err.GetMessage() << std::endl;
+		}
+		catch (std::exception const& err) {
+			std::cout << "exception:" << err.what() << std::endl;
+		}
+		catch (...) {
+			std::cout << "exception: unknown error in background task" << std::endl;
+		}
+	}
        
 
 	return true;
@@ -0,0 +1,50 @@
+// Copyright (c) 2026, agent <agent@local>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#pragma once
+
+#include "ass_dialogue.h"
+#include "ass_file.h"
+
+#include <libaegisub/parallel.h>
+
+#include <vector>
+
+/// @brief Apply a transformation to every dialogue line, spread over all cores
+/// @param lines Lines to transform
+/// @param scratch Initial value of each chunk's scratch state
+/// @param func Called as func(AssDialogue&, Scratch&) for each line
+///
+/// The lines are split into contiguous chunks which are each transformed in
+/// order on a single thread with their own copy of the scratch state. func
+/// must not touch any line other than the one passed to it. If func throws,
+/// the exception from the earliest failing chunk is rethrown once all of the
+/// chunks have finished.
+template<typename Scratch, typename Func>
+void ParallelTransform(EntryList<AssDialogue> &lines, Scratch const& scratch, Func&& func) {
+	std::vector<AssDialogue *> to_transform;
+	for (auto& line : lines)
+		to_transform.push_back(&line);
+
+	// Not worth using other threads for small files
+	const size_t min_lines_per_chunk = 256;
+	size_t chunk_count = agi::parallel::ChunkCount(to_transform.size(), min_lines_per_chunk);
+	agi::parallel::ForChunks(to_transform.size(), chunk_count, [&](size_t, size_t begin, size_t end) {
+		Scratch chunk_scratch(scratch);
+		for (size_t i = begin; i < end; ++i)
+			func(*to_transform[i], chunk_scratch);
+	});
+}
@@ -233,11 +233,12 @@ void Project::LoadUnloadFiles(ProjectProperties properties) {
 }
 
 void Project::DoLoadAudio(agi::fs::path const& path, bool quiet) {
+	std::unique_ptr<agi::AudioProvider> provider;
 
 	try {
 		try {
-			//audio_provider = GetAudioProvider(path, *context->path, progress);
-			audio_provider = GetAudioProvider(path, *context->path, NULL);
+			//provider = GetAudioProvider(path, *context->path, progress);
+			provider = GetAudioProvider(path, *context->path, NULL);
 		}
 		catch (agi::UserCancelException const&) { return; }
 		catch (...) {
@@ -264,6 +265,10 @@ void Project::DoLoadAudio(agi::fs::path const& path, bool quiet) {
 	}
 
 	SetPath(audio_file, "?audio", "Audio", path);
+
+	// Keep the old provider alive until the listeners have switched to the
+	// new one, as they may have background work still reading from it
+	audio_provider.swap(provider);
 	AnnounceAudioProviderModified(audio_provider.get());
 }
 
@@ -19,6 +19,7 @@
 #include "ass_dialogue.h"
 #include "ass_file.h"
 #include "ass_style.h"
+#include "parallel_transform.h"
 #include "utils.h"
 
 #include <libaegisub/exception.h>
@@ -278,8 +279,11 @@ void ResampleResolution(AssFile *ass, ResampleSettings settings) {
 
 	for (auto& line : ass->Styles)
 		resample_style(&state, line);
-	for (auto& line : ass->Events)
-		resample_line(&state, line);
+	// Each line is resampled independently, so spread them over all cores.
+	// Every chunk gets its own copy of the state for the tag callbacks.
+	ParallelTransform(ass->Events, state, [](AssDialogue &line, resample_state &chunk_state) {
+		resample_line(&chunk_state, line);
+	});
 
 	ass->SetScriptInfo("PlayResX", std::to_string(settings.dest_x));
 	ass->SetScriptInfo("PlayResY", std::to_string(settings.dest_y));
@@ -24,9 +24,12 @@
 #include "text_selection_controller.h"
 
 #include <libaegisub/exception.h>
+#include <libaegisub/parallel.h>
 #include <libaegisub/util.h>
 
+#include <algorithm>
 #include <boost/locale/conversion.hpp>
+#include <vector>
 
 #include <wx/msgdlg.h>
 
@@ -52,18 +55,17 @@ std::string const& get_normalized(const AssDialogue *diag, decltype(&AssDialogue
 	return value.get();
 }
 
-typedef std::function<MatchState (const AssDialogue*, size_t)> matcher;
+/// Matcher which searches a string rather than a line, so that the search can
+/// be run on text which isn't (yet) in a line
+typedef std::function<MatchState (std::string const&, size_t)> text_matcher;
 
 class noop_accessor {
-	boost::flyweight<std::string> AssDialogueBase::*field;
 	size_t start = 0;
 
 public:
-	noop_accessor(SearchReplaceSettings::Field f) : field(get_dialogue_field(f)) { }
-
-	std::string get(const AssDialogue *d, size_t s) {
+	std::string get(std::string const& text, size_t s) {
 		start = s;
-		return get_normalized(d, field).substr(s);
+		return text.substr(s);
 	}
 
 	MatchState make_match_state(size_t s, size_t e, boost::u32regex *r = nullptr) {
@@ -72,14 +74,11 @@ public:
 };
 
 class skip_tags_accessor {
-	boost::flyweight<std::string> AssDialogueBase::*field;
 	agi::util::tagless_find_helper helper;
 
 public:
-	skip_tags_accessor(SearchReplaceSettings::Field f) : field(get_dialogue_field(f)) { }
-
-	std::string get(const AssDialogue *d, size_t s) {
-		return helper.strip_tags(get_normalized(d, field), s);
+	std::string get(std::string const& text, size_t s) {
+		return helper.strip_tags(text, s);
 	}
 
 	MatchState make_match_state(size_t s, size_t e, boost::u32regex *r = nullptr) {
@@ -89,7 +88,7 @@ public:
 };
 
 template<typename Accessor>
-matcher get_matcher(SearchReplaceSettings const& settings, Accessor&& a) {
+text_matcher get_matcher(SearchReplaceSettings const& settings, Accessor&& a) {
 	if (settings.use_regex) {
 		int flags = boost::u32regex::perl;
 		if (!settings.match_case)
@@ -97,9 +96,9 @@ matcher get_matcher(SearchReplaceSettings const& settings, Accessor&& a) {
 
 		auto regex = boost::make_u32regex(settings.find, flags);
 
-		return [=](const AssDialogue *diag, size_t start) mutable -> MatchState {
+		return [=](std::string const& text, size_t start) mutable -> MatchState {
 			boost::smatch result;
-			auto const& str = a.get(diag, start);
+			auto const& str = a.get(text, start);
 			if (!u32regex_search(str, result, regex, start > 0 ? boost::match_not_bol : boost::match_default))
 				return bad_match;
 			return a.make_match_state(result.position(), result.position() + result.length(), &regex);
@@ -113,8 +112,8 @@ matcher get_matcher(SearchReplaceSettings const& settings, Accessor&& a) {
 	if (!settings.match_case)
 		look_for = boost::locale::fold_case(look_for);
 
-	return [=](const AssDialogue *diag, size_t start) mutable -> MatchState {
-		const auto str = a.get(diag, start);
+	return [=](std::string const& text, size_t start) mutable -> MatchState {
+		const auto str = a.get(text, start);
 		if (full_match_only && str.size() != look_for.size())
 			return bad_match;
 
@@ -128,6 +127,47 @@ matcher get_matcher(SearchReplaceSettings const& settings, Accessor&& a) {
 	};
 }
 
+text_matcher get_text_matcher(SearchReplaceSettings const& settings) {
+	if (settings.skip_tags)
+		return get_matcher(settings, skip_tags_accessor());
+	return get_matcher(settings, noop_accessor());
+}
+
+/// Replace a match in a string
+void replace(std::string &text, MatchState &ms, std::string const& replace_with) {
+	std::string replacement = replace_with;
+	if (ms.re) {
+		auto to_replace = text.substr(ms.start, ms.end - ms.start);
+		replacement = u32regex_replace(to_replace, *ms.re, replacement, boost::format_first_only);
+	}
+
+	text = text.substr(0, ms.start) + replacement + text.substr(ms.end);
+	ms.end = ms.start + replacement.size();
+}
+
+/// Replace every match in a string
+/// @return Number of matches replaced
+size_t replace_all(text_matcher &matches, std::string &text, SearchReplaceSettings const& settings) {
+	if (settings.use_regex) {
+		MatchState ms = matches(text, 0);
+		if (!ms) return 0;
+		size_t count = std::distance(
+			boost::u32regex_iterator<std::string::const_iterator>(begin(text), end(text), *ms.re),
+			boost::u32regex_iterator<std::string::const_iterator>());
+		text = u32regex_replace(text, *ms.re, settings.replace_with);
+		return count;
+	}
+
+	size_t count = 0;
+	size_t pos = 0;
+	while (MatchState ms = matches(text, pos)) {
+		++count;
+		replace(text, ms, settings.replace_with);
+		pos = ms.end;
+	}
+	return count;
+}
+
 template<typename Iterator, typename Container>
 Iterator circular_next(Iterator it, Container& c) {
 	++it;
@@ -139,9 +179,11 @@ Iterator circular_next(Iterator it, Container& c) {
 }
 
 std::function<MatchState (const AssDialogue*, size_t)> SearchReplaceEngine::GetMatcher(SearchReplaceSettings const& settings) {
-	if (settings.skip_tags)
-		return get_matcher(settings, skip_tags_accessor(settings.field));
-	return get_matcher(settings, noop_accessor(settings.field));
+	auto field = get_dialogue_field(settings.field);
+	auto matches = get_text_matcher(settings);
+	return [=](const AssDialogue *diag, size_t start) mutable {
+		return matches(get_normalized(diag, field), start);
+	};
 }
 
 SearchReplaceEngine::SearchReplaceEngine(agi::Context *c)
@@ -152,15 +194,8 @@ SearchReplaceEngine::SearchReplaceEngine(agi::Context *c)
 void SearchReplaceEngine::Replace(AssDialogue *diag, MatchState &ms) {
 	auto& diag_field = diag->*get_dialogue_field(settings.field);
 	auto text = diag_field.get();
-
-	std::string replacement = settings.replace_with;
-	if (ms.re) {
-		auto to_replace = text.substr(ms.start, ms.end - ms.start);
-		replacement = u32regex_replace(to_replace, *ms.re, replacement, boost::format_first_only);
-	}
-
-	diag_field = text.substr(0, ms.start) + replacement + text.substr(ms.end);
-	ms.end = ms.start + replacement.size();
+	replace(text, ms, settings.replace_with);
+	diag_field = text;
 }
 
 bool SearchReplaceEngine::FindReplace(bool replace) {
@@ -238,35 +273,43 @@ bool SearchReplaceEngine::ReplaceAll() {
 	if (!initialized)
 		return false;
 
-	size_t count = 0;
-
-	auto matches = GetMatcher(settings);
-
 	auto const& sel = context->selectionController->GetSelectedSet();
 	bool selection_only = settings.limit_to == SearchReplaceSettings::Limit::SELECTED;
 
+	std::vector<AssDialogue *> lines;
 	for (auto& diag : context->ass->Events) {
 		if (selection_only && !sel.count(&diag)) continue;
 		if (settings.ignore_comments && diag.Comment) continue;
+		lines.push_back(&diag);
+	}
 
-		if (settings.use_regex) {
-			if (MatchState ms = matches(&diag, 0)) {
-				auto& diag_field = diag.*get_dialogue_field(settings.field);
-				std::string const& text = diag_field.get();
-				count += std::distance(
-					boost::u32regex_iterator<std::string::const_iterator>(begin(text), end(text), *ms.re),
-					boost::u32regex_iterator<std::string::const_iterator>());
-				diag_field = u32regex_replace(text, *ms.re, settings.replace_with);
-			}
-			continue;
+	// Matching doesn't modify the lines, so the new text for each line is
+	// built in parallel chunks and then all of the changed lines are updated
+	// at once at the end. Any exception from matching (such as the regex
+	// engine giving up on a pathological pattern) is rethrown here before
+	// anything has been modified.
+	auto field = get_dialogue_field(settings.field);
+	auto matches = get_text_matcher(settings);
+	std::vector<std::string> new_text(lines.size());
+	std::vector<size_t> line_counts(lines.size());
+
+	const size_t min_lines_per_chunk = 1000;
+	size_t chunk_count = agi::parallel::ChunkCount(lines.size(), min_lines_per_chunk);
+	agi::parallel::ForChunks(lines.size(), chunk_count, [&](size_t, size_t begin, size_t end) {
+		// Matchers have per-search state, so each chunk needs its own copy.
+		// The compiled regex is shared between the copies.
+		auto chunk_matches = matches;
+		for (size_t j = begin; j < end; ++j) {
+			new_text[j] = boost::locale::normalize((lines[j]->*field).get());
+			line_counts[j] = replace_all(chunk_matches, new_text[j], settings);
 		}
+	});
 
-		size_t pos = 0;
-		while (MatchState ms = matches(&diag, pos)) {
-			++count;
-			Replace(&diag, ms);
-			pos = ms.end;
-		}
+	size_t count = 0;
+	for (size_t i = 0; i < lines.size(); ++i) {
+		if (!line_counts[i]) continue;
+		count += line_counts[i];
+		lines[i]->*field = new_text[i];
 	}
 
 	if (count > 0) {
@@ -23,6 +23,94 @@
 
 #include <algorithm>
 
+namespace {
+/// Selections this small are faster to binary search than to hash
+const size_t min_indexed_size = 16;
+
+size_t hash_line(AssDialogue *line, int bits) {
+	// Fibonacci hashing, taking the high bits of the product
+	return static_cast<size_t>((reinterpret_cast<uintptr_t>(line) * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - bits));
+}
+}
+
+Selection& Selection::operator=(Selection const& other) {
+	lines = other.lines;
+	unsorted = other.unsorted;
+	index.clear();
+	return *this;
+}
+
+void Selection::Normalize() const {
+	if (!unsorted) return;
+
+	auto mid = lines.end() - unsorted;
+	std::sort(mid, lines.end());
+	std::inplace_merge(lines.begin(), mid, lines.end());
+	lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+	unsorted = 0;
+	index.clear();
+}
+
+void Selection::BuildIndex() const {
+	index_bits = 1;
+	while ((size_t(1) << index_bits) < lines.size() * 2)
+		++index_bits;
+	index.assign(size_t(1) << index_bits, nullptr);
+
+	size_t mask = index.size() - 1;
+	for (auto line : lines) {
+		if (!line) continue;
+		size_t i = hash_line(line, index_bits);
+		while (index[i])
+			i = (i + 1) & mask;
+		index[i] = line;
+	}
+}
+
+Selection::size_type Selection::count(AssDialogue *line) const {
+	Normalize();
+	if (!line || lines.size() < min_indexed_size)
+		return std::binary_search(lines.begin(), lines.end(), line);
+
+	if (index.empty())
+		BuildIndex();
+
+	size_t mask = index.size() - 1;
+	for (size_t i = hash_line(line, index_bits); index[i]; i = (i + 1) & mask) {
+		if (index[i] == line)
+			return 1;
+	}
+	return 0;
+}
+
+Selection::const_iterator Selection::find(AssDialogue *line) const {
+	Normalize();
+	auto it = std::lower_bound(lines.begin(), lines.end(), line);
+	return it != lines.end() && *it == line ? it : lines.end();
+}
+
+Selection::size_type Selection::erase(AssDialogue *line) {
+	Normalize();
+	auto it = std::lower_bound(lines.begin(), lines.end(), line);
+	if (it == lines.end() || *it != line)
+		return 0;
+	lines.erase(it);
+	index.clear();
+	return 1;
+}
+
+void Selection::clear() {
+	lines.clear();
+	unsorted = 0;
+	index.clear();
+}
+
+bool Selection::operator==(Selection const& rgt) const {
+	Normalize();
+	rgt.Normalize();
+	return lines == rgt.lines;
+}
+
 SelectionController::SelectionController(agi::Context *c) : context(c) { }
 
 void SelectionController::SetSelectedSet(Selection new_selection) {
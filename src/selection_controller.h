@@ -29,11 +29,99 @@
 
 #include <libaegisub/signal.h>
 
-#include <set>
+#include <cstdint>
+#include <initializer_list>
 #include <vector>
 
 class AssDialogue;
-typedef std::set<AssDialogue *> Selection;
+
+/// @class Selection
+/// @brief A set of dialogue lines
+///
+/// This has the interface of a std::set<AssDialogue *>, including iterating
+/// in address order, but stores the lines in a single vector. Lines inserted
+/// one at a time are only sorted into place when the set is next read, so
+/// building a selection of n lines is O(n log n) with one allocation rather
+/// than n tree nodes. Large selections also build a hash index on their first
+/// lookup, so that checking every line in the file against the selection is
+/// linear.
+///
+/// The lazily-built parts are not synchronized, so a selection must not be
+/// read from several threads at once.
+class Selection {
+	/// Selected lines. Everything other than the last `unsorted` entries is
+	/// sorted and unique.
+	mutable std::vector<AssDialogue *> lines;
+	/// Number of lines appended since the vector was last sorted
+	mutable size_t unsorted = 0;
+	/// Open-addressed hash table of the lines, or empty if not built
+	mutable std::vector<AssDialogue *> index;
+	/// log2 of index.size()
+	mutable int index_bits = 0;
+
+	/// Sort and deduplicate any newly inserted lines
+	void Normalize() const;
+	/// Build the hash index for lookups
+	void BuildIndex() const;
+
+public:
+	typedef AssDialogue *value_type;
+	typedef AssDialogue *key_type;
+	typedef size_t size_type;
+	typedef std::vector<AssDialogue *>::const_iterator const_iterator;
+	typedef const_iterator iterator;
+	typedef std::vector<AssDialogue *>::const_reverse_iterator const_reverse_iterator;
+	typedef const_reverse_iterator reverse_iterator;
+
+	Selection() = default;
+	Selection(std::initializer_list<AssDialogue *> init) : Selection(init.begin(), init.end()) { }
+	template<typename Iterator>
+	Selection(Iterator first, Iterator last) : lines(first, last), unsorted(lines.size()) { }
+
+	Selection(Selection const& other) : lines(other.lines), unsorted(other.unsorted) { }
+	Selection(Selection&&) = default;
+	Selection& operator=(Selection const& other);
+	Selection& operator=(Selection&&) = default;
+
+	const_iterator begin() const { Normalize(); return lines.begin(); }
+	const_iterator end() const { Normalize(); return lines.end(); }
+	const_reverse_iterator rbegin() const { Normalize(); return lines.rbegin(); }
+	const_reverse_iterator rend() const { Normalize(); return lines.rend(); }
+
+	bool empty() const { return lines.empty(); }
+	size_type size() const { Normalize(); return lines.size(); }
+
+	/// Is the line selected? Returns 0 or 1 like std::set::count.
+	size_type count(AssDialogue *line) const;
+	const_iterator find(AssDialogue *line) const;
+
+	void insert(AssDialogue *line) {
+		lines.push_back(line);
+		++unsorted;
+		index.clear();
+	}
+
+	/// Insert with an ignored hint, for std::inserter
+	iterator insert(const_iterator, AssDialogue *line) {
+		insert(line);
+		return lines.end() - 1;
+	}
+
+	template<typename Iterator>
+	void insert(Iterator first, Iterator last) {
+		size_t size = lines.size();
+		lines.insert(lines.end(), first, last);
+		unsorted += lines.size() - size;
+		index.clear();
+	}
+
+	size_type erase(AssDialogue *line);
+	void clear();
+	void reserve(size_type n) { lines.reserve(n); }
+
+	bool operator==(Selection const& rgt) const;
+	bool operator!=(Selection const& rgt) const { return !(*this == rgt); }
+};
 
 namespace agi { struct Context; }
 
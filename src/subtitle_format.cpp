@@ -54,6 +54,7 @@
 #include <libaegisub/vfr.h>
 
 #include <algorithm>
+#include <set>
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include <wx/choicdlg.h>
@@ -182,65 +183,95 @@ void SubtitleFormat::StripComments(AssFile &file) {
 
 /// @brief Split and merge lines so there are no overlapping lines
 ///
-/// Algorithm described at http://devel.aegisub.org/wiki/Technical/SplitMerge
+/// Every time at which a line starts or ends is a boundary, and each span
+/// between two consecutive boundaries gets a single line containing the text
+/// of all of the lines visible during it, most recently started first.
 void SubtitleFormat::RecombineOverlaps(AssFile &file) {
-	auto cur = file.Events.begin();
-	for (auto next = std::next(cur); next != file.Events.end(); cur = std::prev(next)) {
-		if (next == file.Events.begin() || cur->End <= next->Start) {
-			++next;
-			continue;
-		}
+	std::vector<AssDialogue *> lines;
+	for (auto& line : file.Events)
+		lines.push_back(&line);
+	std::stable_sort(begin(lines), end(lines), [](const AssDialogue *a, const AssDialogue *b) {
+		return a->Start < b->Start;
+	});
 
-		std::unique_ptr<AssDialogue> prevdlg(&*cur);
-		std::unique_ptr<AssDialogue> curdlg(&*next);
-		++next;
-
-		auto insert_line = [&](AssDialogue *newdlg) {
-			file.Events.insert(std::find_if(next, file.Events.end(), [&](AssDialogue const& pos) {
-				return pos.Start >= newdlg->Start;
-			}), *newdlg);
-		};
-
-		//Is there an A part before the overlap?
-		if (curdlg->Start > prevdlg->Start) {
-			// Produce new entry with correct values
-			auto newdlg = new AssDialogue(*prevdlg);
-			newdlg->Start = prevdlg->Start;
-			newdlg->End = curdlg->Start;
-			newdlg->Text = prevdlg->Text;
-			insert_line(newdlg);
+	struct Boundary {
+		int time;
+		size_t line;
+		bool start;
+	};
+
+	// Zero-length lines can't overlap anything, so they're passed through
+	// as-is rather than splitting the lines around them
+	std::vector<Boundary> boundaries;
+	std::vector<size_t> empty;
+	boundaries.reserve(lines.size() * 2);
+	for (size_t i = 0; i < lines.size(); ++i) {
+		int start = lines[i]->Start, end = lines[i]->End;
+		if (end > start) {
+			boundaries.push_back({start, i, true});
+			boundaries.push_back({end, i, false});
 		}
+		else
+			empty.push_back(i);
+	}
+	std::stable_sort(begin(boundaries), end(boundaries), [](Boundary const& a, Boundary const& b) {
+		return a.time < b.time;
+	});
 
-		// Overlapping A+B part
-		{
-			auto newdlg = new AssDialogue(*prevdlg);
-			newdlg->Start = curdlg->Start;
-			newdlg->End = (prevdlg->End < curdlg->End) ? prevdlg->End : curdlg->End;
-			// Put an ASS format hard linewrap between lines
-			newdlg->Text = curdlg->Text.get() + "\\N" + prevdlg->Text.get();
-			insert_line(newdlg);
+	std::vector<AssDialogue *> result;
+	std::vector<bool> reused(lines.size());
+	auto next_empty = begin(empty);
+	auto add_line = [&](size_t i) {
+		result.push_back(lines[i]);
+		reused[i] = true;
+	};
+
+	std::set<size_t> active;
+	std::string text;
+	for (size_t i = 0; i < boundaries.size(); ) {
+		int time = boundaries[i].time;
+		for (; i < boundaries.size() && boundaries[i].time == time; ++i) {
+			if (boundaries[i].start)
+				active.insert(boundaries[i].line);
+			else
+				active.erase(boundaries[i].line);
 		}
 
-		// Is there an A part after the overlap?
-		if (prevdlg->End > curdlg->End) {
-			// Produce new entry with correct values
-			auto newdlg = new AssDialogue(*prevdlg);
-			newdlg->Start = curdlg->End;
-			newdlg->End = prevdlg->End;
-			newdlg->Text = prevdlg->Text;
-			insert_line(newdlg);
+		if (active.empty()) continue;
+		int next = boundaries[i].time;
+
+		for (; next_empty != end(empty) && lines[*next_empty]->Start <= time; ++next_empty)
+			add_line(*next_empty);
+
+		// Lines which don't overlap anything are kept unchanged
+		AssDialogue *first = lines[*active.begin()];
+		if (active.size() == 1 && first->Start == time && first->End == next) {
+			add_line(*active.begin());
+			continue;
 		}
 
-		// Is there a B part after the overlap?
-		if (curdlg->End > prevdlg->End) {
-			// Produce new entry with correct values
-			auto newdlg = new AssDialogue(*prevdlg);
-			newdlg->Start = prevdlg->End;
-			newdlg->End = curdlg->End;
-			newdlg->Text = curdlg->Text;
-			insert_line(newdlg);
+		auto newdlg = new AssDialogue(*first);
+		newdlg->Start = time;
+		newdlg->End = next;
+		text.clear();
+		for (auto it = active.rbegin(); it != active.rend(); ++it) {
+			if (it != active.rbegin())
+				text += "\\N";
+			text += lines[*it]->Text.get();
 		}
+		newdlg->Text = text;
+		result.push_back(newdlg);
+	}
+	for (; next_empty != end(empty); ++next_empty)
+		add_line(*next_empty);
+
+	for (size_t i = 0; i < lines.size(); ++i) {
+		if (!reused[i])
+			delete lines[i];
 	}
+	file.Events.clear();
+	for (auto line : result)
+		file.Events.push_back(*line);
 }
 
 /// @brief Merge identical lines that follow each other
@@ -57,7 +57,9 @@ public:
 	static void StripComments(AssFile &file);
 	/// @brief Split and merge lines so there are no overlapping lines
 	///
-	/// Algorithm described at http://devel.aegisub.org/wiki/Technical/SplitMerge
+	/// Overlapping lines are split at each point where one starts or ends,
+	/// and the parts which overlap are merged into single lines, with the
+	/// later line above the earlier one.
 	static void RecombineOverlaps(AssFile &file);
 	/// Merge sequential identical lines
 	static void MergeIdentical(AssFile &file);
@@ -98,11 +98,41 @@ void SubtitlesProvider::LoadSubtitles(AssFile *subs, int time) {
 				push_line(attachment.GetEntryData());
 	}
 
+	event_index.clear();
+	if (time < 0)
+		event_index.resize(subs->Events.size(), -1);
+
+	int count = 0;
 	push_header("[Events]\n");
 	for (auto const& line : subs->Events) {
-		if (!line.Comment && (time < 0 || !(line.Start > time || line.End <= time)))
+		if (!line.Comment && (time < 0 || !(line.Start > time || line.End <= time))) {
 			push_line(line.GetEntryData());
+			if (line.Row >= 0 && static_cast<size_t>(line.Row) < event_index.size())
+				event_index[line.Row] = count;
+			++count;
+		}
 	}
 
 	LoadSubtitles(&buffer[0], buffer.size());
+
+	// Only keep the index if every line made it into the renderer, as
+	// otherwise the event numbers won't match up
+	if (EventCount() != count)
+		event_index.clear();
+}
+
+bool SubtitlesProvider::UpdateLine(AssDialogue const& line) {
+	if (line.Row < 0 || static_cast<size_t>(line.Row) >= event_index.size())
+		return false;
+
+	int index = event_index[line.Row];
+	// A line which wasn't loaded only needs to be added if it's now visible
+	if (index < 0)
+		return line.Comment;
+	if (line.Comment)
+		return UpdateEvent(index, nullptr, 0);
+
+	auto data = line.GetEntryData();
+	data += '\n';
+	return UpdateEvent(index, &data[0], data.size());
 }
@@ -90,12 +90,13 @@ void CSRISubtitlesProvider::DrawSubtitles(VideoFrame &dst, double time) {
 	if (!instance) return;
 
 	csri_frame frame;
+	auto pixels = dst.MutablePixels();
 	if (dst.flipped) {
-		frame.planes[0] = dst.data.data() + (dst.height-1) * dst.width * 4;
+		frame.planes[0] = pixels + (dst.height-1) * dst.width * 4;
 		frame.strides[0] = -(signed)dst.width * 4;
 	}
 	else {
-		frame.planes[0] = dst.data.data();
+		frame.planes[0] = pixels;
 		frame.strides[0] = dst.width * 4;
 	}
 	frame.pixfmt = CSRI_F_BGR_;
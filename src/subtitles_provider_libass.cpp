@@ -43,13 +43,20 @@
 #include <libaegisub/exception.h>
 #include <libaegisub/log.h>
 #include <libaegisub/make_unique.h>
+#include <libaegisub/parallel.h>
 #include <libaegisub/util.h>
 
+#include <algorithm>
 #include <atomic>
-#include <boost/gil/gil_all.hpp>
+#include <boost/scope_exit.hpp>
 #include <memory>
 #include <mutex>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AGI_BLEND_SSE2
+#include <emmintrin.h>
+#endif
+
 #include <wx/intl.h>
 #include <wx/thread.h>
 
@@ -76,6 +83,17 @@ void msg_callback(int level, const char *fmt, va_list args, void *) {
 		LOG_D("subtitle/provider/libass") << buf;
 }
 
+ASS_Renderer *create_renderer() {
+	auto renderer = ass_renderer_init(library);
+	if (renderer) {
+		ass_set_font_scale(renderer, 1.);
+		ass_set_fonts(renderer, nullptr, "Sans", 1, nullptr, true);
+	}
+	return renderer;
+}
+
+void draw_images(ASS_Image *img, VideoFrame &frame);
+
 // Stuff used on the cache thread, owned by a shared_ptr in case the provider
 // gets deleted before the cache finishing updating
 struct cache_thread_shared {
@@ -125,6 +143,37 @@ public:
 		if (!ass_track) throw agi::InternalError("libass failed to load subtitles.");
 	}
 
+	int EventCount() const override {
+		return ass_track ? ass_track->n_events : -1;
+	}
+
+	bool UpdateEvent(size_t index, const char *data, size_t len) override {
+		if (!ass_track || index >= static_cast<size_t>(ass_track->n_events))
+			return false;
+
+		// An event with no duration is never rendered
+		if (!len) {
+			ass_track->events[index].Duration = 0;
+			return true;
+		}
+
+		// The track is still in the events section after loading, so this
+		// parses the line exactly as it would be when reloading the file and
+		// appends it as a new event, which then replaces the old one
+		int count = ass_track->n_events;
+		ass_process_data(ass_track, const_cast<char *>(data), len);
+		if (ass_track->n_events != count + 1)
+			return false;
+
+		ASS_Event &event = ass_track->events[index];
+		ASS_Event &parsed = ass_track->events[count];
+		parsed.ReadOrder = event.ReadOrder;
+		ass_free_event(ass_track, index);
+		event = parsed;
+		--ass_track->n_events;
+		return true;
+	}
+
 	void DrawSubtitles(VideoFrame &dst, double time) override;
 
 	void Reinitialize() override {
@@ -133,9 +182,7 @@ public:
 			return;
 
 		ass_renderer_done(shared->renderer);
-		shared->renderer = ass_renderer_init(library);
-		ass_set_font_scale(shared->renderer, 1.);
-		ass_set_fonts(shared->renderer, nullptr, "Sans", 1, nullptr, true);
+		shared->renderer = create_renderer();
 	}
 };
 
@@ -145,12 +192,7 @@ LibassSubtitlesProvider::LibassSubtitlesProvider(agi::BackgroundRunner *br)
 {
 	auto state = shared;
 	cache_queue->Async([state] {
-		auto ass_renderer = ass_renderer_init(library);
-		if (ass_renderer) {
-			ass_set_font_scale(ass_renderer, 1.);
-			ass_set_fonts(ass_renderer, nullptr, "Sans", 1, nullptr, true);
-		}
-		state->renderer = ass_renderer;
+		state->renderer = create_renderer();
 		state->ready = true;
 	});
 }
@@ -164,42 +206,115 @@ LibassSubtitlesProvider::~LibassSubtitlesProvider() {
 #define _b(c) (((c)>>8)&0xFF)
 #define _a(c) ((c)&0xFF)
 
+/// x / 255, exact for 0 <= x <= 255 * 255
+inline unsigned int div255(unsigned int x) {
+	return (x + 1 + (x >> 8)) >> 8;
+}
+
+#ifdef AGI_BLEND_SSE2
+inline __m128i div255(__m128i x) {
+	return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, _mm_set1_epi16(1)), _mm_srli_epi16(x, 8)), 8);
+}
+
+/// Blend two pixels stored as 16-bit channels with their per-pixel coverage
+/// already broadcast to each channel
+inline __m128i blend2(__m128i dst, __m128i k, __m128i colour) {
+	__m128i ck = _mm_sub_epi16(_mm_set1_epi16(255), k);
+	return div255(_mm_add_epi16(_mm_mullo_epi16(k, colour), _mm_mullo_epi16(ck, dst)));
+}
+#endif
+
+/// Blend a single row of a libass coverage bitmap into a row of BGRX pixels
+void blend_row(unsigned char *dst, const unsigned char *src, int w, unsigned int b, unsigned int g, unsigned int r, unsigned int opacity) {
+	int x = 0;
+
+#ifdef AGI_BLEND_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i vopacity = _mm_set1_epi16(opacity);
+	const __m128i colour = _mm_setr_epi16(b, g, r, 0, b, g, r, 0);
+	const __m128i alpha_mask = _mm_set1_epi32(0x00FFFFFF);
+
+	for (; x + 8 <= w; x += 8) {
+		__m128i src8 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + x));
+		// Glyph bitmaps are mostly empty, so skip untouched runs entirely
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(src8, zero)) == 0xFFFF)
+			continue;
+
+		__m128i k = div255(_mm_mullo_epi16(_mm_unpacklo_epi8(src8, zero), vopacity));
+		__m128i k_lo = _mm_unpacklo_epi16(k, k);
+		__m128i k_hi = _mm_unpackhi_epi16(k, k);
+
+		auto out = reinterpret_cast<__m128i *>(dst + x * 4);
+		__m128i px_lo = _mm_loadu_si128(out);
+		__m128i px_hi = _mm_loadu_si128(out + 1);
+
+		__m128i res_lo = _mm_packus_epi16(
+			blend2(_mm_unpacklo_epi8(px_lo, zero), _mm_unpacklo_epi32(k_lo, k_lo), colour),
+			blend2(_mm_unpackhi_epi8(px_lo, zero), _mm_unpackhi_epi32(k_lo, k_lo), colour));
+		__m128i res_hi = _mm_packus_epi16(
+			blend2(_mm_unpacklo_epi8(px_hi, zero), _mm_unpacklo_epi32(k_hi, k_hi), colour),
+			blend2(_mm_unpackhi_epi8(px_hi, zero), _mm_unpackhi_epi32(k_hi, k_hi), colour));
+
+		_mm_storeu_si128(out, _mm_and_si128(res_lo, alpha_mask));
+		_mm_storeu_si128(out + 1, _mm_and_si128(res_hi, alpha_mask));
+	}
+#endif
+
+	for (; x < w; ++x) {
+		if (!src[x]) continue;
+		unsigned int k = div255(src[x] * opacity);
+		unsigned int ck = 255 - k;
+
+		unsigned char *px = dst + x * 4;
+		px[0] = div255(k * b + ck * px[0]);
+		px[1] = div255(k * g + ck * px[1]);
+		px[2] = div255(k * r + ck * px[2]);
+		px[3] = 0;
+	}
+}
+
 void LibassSubtitlesProvider::DrawSubtitles(VideoFrame &frame,double time) {
 	ass_set_frame_size(renderer(), frame.width, frame.height);
+	draw_images(ass_render_frame(renderer(), ass_track, int(time * 1000), nullptr), frame);
+}
 
-	ASS_Image* img = ass_render_frame(renderer(), ass_track, int(time * 1000), nullptr);
-
+void draw_images(ASS_Image *img, VideoFrame &frame) {
 	// libass actually returns several alpha-masked monochrome images.
 	// Here, we loop through their linked list, get the colour of the current, and blend into the frame.
 	// This is repeated for all of them.
 
-	using namespace boost::gil;
-	auto dst = interleaved_view(frame.width, frame.height, (bgra8_pixel_t*)frame.data.data(), frame.width * 4);
-	if (frame.flipped)
-		dst = flipped_up_down_view(dst);
+	ptrdiff_t pitch = frame.width * 4;
+	unsigned char *origin = frame.MutablePixels();
+	if (frame.flipped) {
+		origin += (frame.height - 1) * pitch;
+		pitch = -pitch;
+	}
 
 	for (; img; img = img->next) {
 		unsigned int opacity = 255 - ((unsigned int)_a(img->color));
+		if (!opacity) continue;
 		unsigned int r = (unsigned int)_r(img->color);
 		unsigned int g = (unsigned int)_g(img->color);
 		unsigned int b = (unsigned int)_b(img->color);
 
-		auto srcview = interleaved_view(img->w, img->h, (gray8_pixel_t*)img->bitmap, img->stride);
-		auto dstview = subimage_view(dst, img->dst_x, img->dst_y, img->w, img->h);
-
-		transform_pixels(dstview, srcview, dstview, [=](const bgra8_pixel_t frame, const gray8_pixel_t src) -> bgra8_pixel_t {
-			unsigned int k = ((unsigned)src) * opacity / 255;
-			unsigned int ck = 255 - k;
-
-			bgra8_pixel_t ret;
-			ret[0] = (k * b + ck * frame[0]) / 255;
-			ret[1] = (k * g + ck * frame[1]) / 255;
-			ret[2] = (k * r + ck * frame[2]) / 255;
-			ret[3] = 0;
-			return ret;
-		});
+		unsigned char *dst = origin + img->dst_y * pitch + img->dst_x * 4;
+		const unsigned char *src = img->bitmap;
+		for (int y = 0; y < img->h; ++y, dst += pitch, src += img->stride)
+			blend_row(dst, src, img->w, b, g, r, opacity);
 	}
 }
+
+/// Captures the serialized file rather than loading it, so that each batch
+/// worker can parse its own track from it
+class SerializedSubtitles final : public SubtitlesProvider {
+	void LoadSubtitles(const char *data, size_t len) override {
+		buffer.assign(data, data + len);
+	}
+
+public:
+	std::vector<char> buffer;
+	void DrawSubtitles(VideoFrame &, double) override { }
+};
 }
 
 namespace libass {
@@ -207,6 +322,59 @@ std::unique_ptr<SubtitlesProvider> Create(std::string const&, agi::BackgroundRun
 	return agi::make_unique<LibassSubtitlesProvider>(br);
 }
 
+void RenderBatch(AssFile *subs, size_t count,
+                 std::function<int (size_t, VideoFrame&)> const& get_frame,
+                 std::function<void (size_t, VideoFrame&)> const& done) {
+	if (!count) return;
+
+	SerializedSubtitles serialized;
+	static_cast<SubtitlesProvider&>(serialized).LoadSubtitles(subs);
+
+	// Let the initial font cache update finish first rather than having every
+	// worker's renderer try to build it at once
+	cache_queue->Sync([]{});
+
+	// Frames are handed out one at a time rather than in fixed ranges so
+	// that the source is read roughly in order
+	std::atomic<size_t> next{0};
+	std::mutex source_lock;
+	agi::parallel::For(std::min(count, agi::parallel::Concurrency()), [&](size_t) {
+		// Neither tracks nor renderers can be shared between threads, so
+		// each worker gets its own of both
+		ASS_Track *track = nullptr;
+		ASS_Renderer *renderer = nullptr;
+		BOOST_SCOPE_EXIT_ALL(&) {
+			if (renderer) ass_renderer_done(renderer);
+			if (track) ass_free_track(track);
+		};
+
+		try {
+			std::vector<char> data(serialized.buffer);
+			track = ass_read_memory(library, data.data(), data.size(), nullptr);
+			renderer = create_renderer();
+			if (!track || !renderer)
+				throw agi::InternalError("libass failed to load subtitles.");
+
+			VideoFrame frame;
+			for (size_t n; (n = next++) < count; ) {
+				int time;
+				{
+					std::lock_guard<std::mutex> guard(source_lock);
+					time = get_frame(n, frame);
+				}
+				ass_set_frame_size(renderer, frame.width, frame.height);
+				draw_images(ass_render_frame(renderer, track, time, nullptr), frame);
+				done(n, frame);
+			}
+		}
+		catch (...) {
+			// Stop the other workers from starting any more frames
+			next = count;
+			throw;
+		}
+	});
+}
+
 void CacheFonts() {
 	// Initialize the cache worker thread
 	cache_queue = agi::dispatch::Create();
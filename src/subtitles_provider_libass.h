@@ -14,13 +14,31 @@
 //
 // Aegisub Project http://www.aegisub.org/
 
+#include <functional>
 #include <memory>
 #include <string>
 
+class AssFile;
 class SubtitlesProvider;
+struct VideoFrame;
 namespace agi { class BackgroundRunner; }
 
 namespace libass {
 	std::unique_ptr<SubtitlesProvider> Create(std::string const&, agi::BackgroundRunner *br);
 	void CacheFonts();
+
+	/// @brief Render subtitles onto a batch of frames using every core
+	/// @param subs File to render
+	/// @param count Number of frames to render
+	/// @param get_frame Fill in the frame with the given index and return the
+	///                  time in milliseconds to render at. Calls to this are
+	///                  serialized, but may come from any thread.
+	/// @param done Receives each finished frame. Called from several threads
+	///             at once.
+	///
+	/// Blocks until all of the frames have been rendered, and rethrows the
+	/// first error raised by any of the workers.
+	void RenderBatch(AssFile *subs, size_t count,
+	                 std::function<int (size_t, VideoFrame&)> const& get_frame,
+	                 std::function<void (size_t, VideoFrame&)> const& done);
 }
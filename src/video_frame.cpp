@@ -37,7 +37,7 @@ wxImage GetImage(VideoFrame const& frame) {
 	using namespace boost::gil;
 
 	wxImage img(frame.width, frame.height);
-	auto src = interleaved_view(frame.width, frame.height, (bgra8_pixel_t*)frame.data.data(), frame.pitch);
+	auto src = interleaved_view(frame.width, frame.height, (const bgra8_pixel_t*)frame.Pixels(), frame.pitch);
 	auto dst = interleaved_view(frame.width, frame.height, (rgb8_pixel_t*)img.GetData(), 3 * frame.width);
 	if (frame.flipped)
 		src = flipped_up_down_view(src);
@@ -14,16 +14,100 @@
 //
 // Aegisub Project http://www.aegisub.org/
 
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 class wxImage;
 
 struct VideoFrame {
+	/// Pixel data owned by this frame. Ignored while shared is set.
 	std::vector<unsigned char> data;
+	/// Immutable pixel data shared with other frames, for providers which
+	/// return the same image repeatedly
+	std::shared_ptr<const std::vector<unsigned char>> shared;
 	size_t width;
 	size_t height;
 	size_t pitch;
 	bool flipped;
+
+	/// Get the pixel data for reading
+	const unsigned char *Pixels() const {
+		return shared ? shared->data() : data.data();
+	}
+
+	/// Size of the pixel data in bytes
+	size_t Size() const {
+		return shared ? shared->size() : data.size();
+	}
+
+	/// Get the pixel data for writing, copying it out of the shared buffer
+	/// first if needed
+	unsigned char *MutablePixels() {
+		if (shared) {
+			data.assign(shared->begin(), shared->end());
+			shared.reset();
+		}
+		return data.data();
+	}
+
+	/// Get a frame-owned buffer of the given size to decode into, dropping
+	/// any shared data
+	unsigned char *Allocate(size_t size) {
+		shared.reset();
+		data.resize(size);
+		return data.data();
+	}
 };
 
 wxImage GetImage(VideoFrame const& frame);
+
+/// @class RecyclingPool
+/// @brief A pool of objects which go back into the pool when the last
+///        reference to them is released rather than being freed
+///
+/// This is used for frames and pixel buffers, which are large enough that
+/// reallocating them for every frame shows up when scrubbing. Objects may be
+/// released on any thread, and may outlive the owner of the pool.
+template<typename T>
+class RecyclingPool : public std::enable_shared_from_this<RecyclingPool<T>> {
+	std::mutex lock;
+	/// Objects which are ready to be handed out again
+	std::vector<std::unique_ptr<T>> free;
+	/// Maximum number of free objects to keep
+	size_t max_free;
+	/// Called on objects as they're returned to the pool
+	std::function<void (T&)> reset;
+
+	void Put(T *obj) {
+		std::unique_ptr<T> ptr(obj);
+		if (reset) reset(*ptr);
+
+		std::lock_guard<std::mutex> guard(lock);
+		if (free.size() < max_free)
+			free.push_back(std::move(ptr));
+	}
+
+public:
+	/// @param max_free Maximum number of unused objects to hold on to
+	/// @param reset    Function to drop any references an object holds when it's returned
+	RecyclingPool(size_t max_free, std::function<void (T&)> reset = nullptr)
+	: max_free(max_free), reset(std::move(reset)) { }
+
+	/// Get a recycled object if there is one, or a new one otherwise
+	std::shared_ptr<T> Get() {
+		std::unique_ptr<T> obj;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (!free.empty()) {
+				obj = std::move(free.back());
+				free.pop_back();
+			}
+		}
+		if (!obj) obj.reset(new T());
+
+		auto self = this->shared_from_this();
+		return std::shared_ptr<T>(obj.release(), [=](T *p) { self->Put(p); });
+	}
+};
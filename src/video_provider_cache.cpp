@@ -19,44 +19,132 @@
 #include "options.h"
 #include "video_frame.h"
 
+#include <libaegisub/dispatch.h>
 #include <libaegisub/make_unique.h>
 
+#include <algorithm>
+#include <atomic>
 #include <list>
+#include <mutex>
+#include <unordered_map>
 
 namespace {
 /// A video frame and its frame number
 struct CachedFrame {
-	VideoFrame frame;
+	/// The frame's pixel data, which is never modified once cached
+	std::shared_ptr<const std::vector<unsigned char>> pixels;
+	size_t width;
+	size_t height;
+	size_t pitch;
+	bool flipped;
 	int frame_number;
 
-	CachedFrame(VideoFrame const& frame, int frame_number)
-	: frame(frame), frame_number(frame_number) { }
-
-	CachedFrame(CachedFrame const&) = delete;
+	/// Point a frame at the cached pixel data
+	///
+	/// The frame's own buffer is left alone so that its memory can be reused
+	/// for decoding into next time.
+	void CopyTo(VideoFrame &frame) const {
+		frame.shared = pixels;
+		frame.width = width;
+		frame.height = height;
+		frame.pitch = pitch;
+		frame.flipped = flipped;
+	}
 };
 
+/// Maximum number of frames to decode ahead of sequential requests
+const int max_prefetch_frames = 8;
+
 /// @class VideoProviderCache
 /// @brief A wrapper around a video provider which provides LRU caching
+///
+/// When frames are requested in order, as during playback or while
+/// rendering every frame, the next few frames are decoded ahead of time on
+/// a background queue.
 class VideoProviderCache final : public VideoProvider {
 	/// The source provider to get frames from
 	std::unique_ptr<VideoProvider> master;
 
+	/// Serialises decoding, as the source provider isn't thread-safe
+	std::mutex decode_lock;
+
+	/// Guards cache, index and cache_size
+	std::mutex cache_lock;
+
 	/// @brief Maximum size of the cache in bytes
 	///
-	/// Note that this is a soft limit. The cache stops allocating new frames
-	/// once it has exceeded the limit, but it never tries to shrink
+	/// Note that this is a soft limit, as the most recent frame is always
+	/// kept even if it alone is larger
 	const size_t max_cache_size = OPT_GET("Provider/Video/Cache/Size")->GetInt() << 20; // convert MB to bytes
 
+	/// Total size of the pixel data in the cache
+	size_t cache_size = 0;
+
 	/// Cache of video frames with the most recently used ones at the front
 	std::list<CachedFrame> cache;
 
+	/// Index of the frames in the cache by frame number
+	std::unordered_map<int, std::list<CachedFrame>::iterator> index;
+
+	/// Pixel buffers of evicted frames, to decode new frames into
+	std::shared_ptr<RecyclingPool<std::vector<unsigned char>>> buffers =
+		std::make_shared<RecyclingPool<std::vector<unsigned char>>>(4);
+
+	/// Last frame number requested by GetFrame
+	int last_requested = -1;
+	/// Last frame number which has been queued for decoding ahead
+	int prefetched_to = -1;
+	/// Incremented to make the queued decode-ahead work stop
+	std::atomic<unsigned> generation{0};
+	/// Frame the decode-ahead work decodes into
+	VideoFrame prefetch_frame;
+	/// Queue which decodes ahead of sequential requests
+	std::unique_ptr<agi::dispatch::Queue> prefetch_queue = agi::dispatch::Create();
+
+	/// Must be called with cache_lock held
+	void Evict() {
+		auto& last = cache.back();
+		cache_size -= last.pixels->size();
+		index.erase(last.frame_number);
+		cache.pop_back();
+	}
+
+	/// Get a frame from the cache if it's there
+	bool Lookup(int n, VideoFrame &out);
+
+	/// Check if a frame is in the cache
+	bool Contains(int n);
+
+	/// Add a freshly decoded frame to the cache
+	void Store(int n, VideoFrame &frame);
+
+	/// Queue decoding of the frames after n
+	void Prefetch(int n);
+
+	/// Stop any decoding ahead and wait for it to finish
+	void CancelPrefetch() {
+		++generation;
+		prefetched_to = last_requested;
+		prefetch_queue->Sync([]{});
+	}
+
 public:
 	VideoProviderCache(std::unique_ptr<VideoProvider> master) : master(std::move(master)) { }
 
+	~VideoProviderCache() {
+		CancelPrefetch();
+	}
+
 	void GetFrame(int n, VideoFrame &frame) override;
 
 	void SetColorSpace(std::string const& m) override {
-		cache.clear();
+		CancelPrefetch();
+		{
+			std::lock_guard<std::mutex> lock(cache_lock);
+			cache.clear();
+			index.clear();
+			cache_size = 0;
+		}
 		return master->SetColorSpace(m);
 	}
 
@@ -74,28 +162,99 @@ public:
 	bool HasAudio() const override                 { return master->HasAudio(); }
 };
 
-void VideoProviderCache::GetFrame(int n, VideoFrame &out) {
-	size_t total_size = 0;
+bool VideoProviderCache::Lookup(int n, VideoFrame &out) {
+	std::lock_guard<std::mutex> lock(cache_lock);
+	auto it = index.find(n);
+	if (it == index.end()) return false;
 
-	for (auto cur = cache.begin(); cur != cache.end(); ++cur) {
-		if (cur->frame_number == n) {
-			cache.splice(cache.begin(), cache, cur); // Move to front
-			out = cache.front().frame;
-			return;
-		}
+	cache.splice(cache.begin(), cache, it->second); // Move to front
+	cache.front().CopyTo(out);
+	return true;
+}
 
-		total_size += cur->frame.data.size();
+bool VideoProviderCache::Contains(int n) {
+	std::lock_guard<std::mutex> lock(cache_lock);
+	return index.count(n) > 0;
+}
+
+void VideoProviderCache::Store(int n, VideoFrame &frame) {
+	// Rather than copying the decoded frame into the cache, hand the decoded
+	// buffer to the cache and give the frame a recycled one to decode into
+	// next time. Anything which wants to draw on the frame copies it back
+	// out with MutablePixels.
+	if (!frame.shared) {
+		auto buffer = buffers->Get();
+		buffer->swap(frame.data);
+		frame.shared = std::move(buffer);
 	}
 
-	master->GetFrame(n, out);
+	std::lock_guard<std::mutex> lock(cache_lock);
+	if (index.count(n)) return;
+
+	cache.push_front(CachedFrame{frame.shared, frame.width, frame.height, frame.pitch, frame.flipped, n});
+	index[n] = cache.begin();
+	cache_size += frame.shared->size();
 
-	if (total_size >= max_cache_size) {
-		cache.splice(cache.begin(), cache, --cache.end()); // Move last to front
-		cache.front().frame_number = n;
-		cache.front().frame = out;
+	while (cache_size > max_cache_size && cache.size() > 1)
+		Evict();
+}
+
+void VideoProviderCache::GetFrame(int n, VideoFrame &out) {
+	int prev = last_requested;
+	last_requested = n;
+
+	// Moving forward by a frame, or skipping ahead to a frame which has
+	// already been queued as happens when playback drops frames, counts as
+	// sequential access. Any other jump makes the queued frames unwanted.
+	bool sequential = n > prev && n <= std::max(prefetched_to, prev) + 1;
+	if (!sequential && n != prev) {
+		++generation;
+		prefetched_to = n;
 	}
-	else
-		cache.emplace_front(out, n);
+
+	if (!Lookup(n, out)) {
+		std::lock_guard<std::mutex> lock(decode_lock);
+		// The decode-ahead may have produced the frame while we waited
+		if (!Lookup(n, out)) {
+			master->GetFrame(n, out);
+			Store(n, out);
+		}
+	}
+
+	if (sequential)
+		Prefetch(n);
+}
+
+void VideoProviderCache::Prefetch(int n) {
+	// Only decode as far ahead as the cache can hold without evicting the
+	// frames which are about to be used
+	size_t frame_size = std::max<size_t>(1, (size_t)GetWidth() * GetHeight() * 4);
+	int count = std::min<int>(max_prefetch_frames, max_cache_size / frame_size / 2);
+
+	int first = std::max(prefetched_to, n) + 1;
+	int last = std::min(n + count, GetFrameCount() - 1);
+	if (first > last) return;
+	prefetched_to = last;
+
+	unsigned gen = generation;
+	prefetch_queue->Async([=] {
+		for (int i = first; i <= last && generation == gen; ++i) {
+			if (Contains(i)) continue;
+
+			std::lock_guard<std::mutex> lock(decode_lock);
+			if (generation != gen) break;
+			if (Contains(i)) continue;
+
+			try {
+				master->GetFrame(i, prefetch_frame);
+			}
+			catch (VideoProviderError const&) {
+				// Let the real request report the error
+				break;
+			}
+			Store(i, prefetch_frame);
+		}
+	});
 }
 }
 
@@ -53,14 +53,15 @@ DummyVideoProvider::DummyVideoProvider(double fps, int frames, int width, int he
 , width(width)
 , height(height)
 {
-	data.resize(width * height * 4);
+	auto pixels = std::make_shared<std::vector<unsigned char>>(width * height * 4);
+	data = pixels;
 
 	auto red = colour.r;
 	auto green = colour.g;
 	auto blue = colour.b;
 
 	using namespace boost::gil;
-	auto dst = interleaved_view(width, height, (bgra8_pixel_t*)data.data(), 4 * width);
+	auto dst = interleaved_view(width, height, (bgra8_pixel_t*)pixels->data(), 4 * width);
 
 	bgra8_pixel_t colors[2] = {
 		bgra8_pixel_t(blue, green, red, 0),
@@ -92,7 +93,7 @@ std::string DummyVideoProvider::MakeFilename(double fps, int frames, int width,
 }
 
 void DummyVideoProvider::GetFrame(int, VideoFrame &frame) {
-	frame.data    = data;
+	frame.shared  = data;
 	frame.width   = width;
 	frame.height  = height;
 	frame.pitch   = width * 4;
@@ -34,6 +34,9 @@
 
 #include "include/aegisub/video_provider.h"
 
+#include <memory>
+#include <vector>
+
 namespace agi { struct Color; }
 
 /// @class DummyVideoProvider
@@ -47,8 +50,9 @@ class DummyVideoProvider final : public VideoProvider {
 	int width;               ///< Width in pixels
 	int height;              ///< Height in pixels
 
-	/// The data for the image returned for all frames
-	std::vector<unsigned char> data;
+	/// The data for the image returned for all frames, shared with every
+	/// frame handed out
+	std::shared_ptr<const std::vector<unsigned char>> data;
 
 public:
 	/// Create a dummy video from separate parameters
@@ -313,6 +313,7 @@ void FFmpegSourceVideoProvider::GetFrame(int n, VideoFrame &out) {
 	if (!frame)
 		throw VideoDecodeError(std::string("Failed to retrieve frame: ") +  ErrInfo.Buffer);
 
+	out.shared.reset();
 	out.data.assign(frame->Data[0], frame->Data[0] + frame->Linesize[0] * Height);
 	out.flipped = false;
 	out.width = Width;
@@ -395,28 +395,13 @@ void YUV4MPEGVideoProvider::GetFrame(int n, VideoFrame &frame) {
 	auto src_y = reinterpret_cast<const unsigned char *>(file.read(seek_table[n], luma_sz + chroma_sz * 2));
 	auto src_u = src_y + luma_sz;
 	auto src_v = src_u + chroma_sz;
-	frame.data.resize(w * h * 4);
-	unsigned char *dst = &frame.data[0];
+	unsigned char *dst = frame.Allocate(w * h * 4);
 
+	// Each chroma row is shared by two luma rows
 	for (int py = 0; py < h; ++py) {
-		for (int px = 0; px < w / 2; ++px) {
-			const uint8_t u = *src_u++;
-			const uint8_t v = *src_v++;
-			for (unsigned int i = 0; i < 2; ++i) {
-				const uint8_t y = *src_y++;
-				auto rgb = conv.ycbcr_to_rgb({{y, u, v}});
-				*dst++ = rgb[2];
-				*dst++ = rgb[1];
-				*dst++ = rgb[0];
-				*dst++ = 0;
-			}
-		}
-
-		// Roll back u/v on even lines
-		if (!(py & 1)) {
-			src_u -= uv_width;
-			src_v -= uv_width;
-		}
+		int uv_offset = (py / 2) * uv_width;
+		conv.ycbcr_to_bgra_row(src_y + py * w, src_u + uv_offset, src_v + uv_offset,
+			dst + py * w * 4, uv_width * 2);
 	}
 
 	frame.flipped = false;
@@ -294,8 +294,10 @@ void VisualTool<FeatureType>::SetSelection(FeatureType *feat, bool clear) {
 		Selection sel;
 		if (!clear)
 			sel = c->selectionController->GetSelectedSet();
-		if (sel.insert(feat->line).second)
+		if (!sel.count(feat->line)) {
+			sel.insert(feat->line);
 			c->selectionController->SetSelectedSet(std::move(sel));
+		}
 	}
 }
 
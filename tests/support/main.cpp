@@ -24,7 +24,7 @@
 #include <ctime>
 
 int main(int argc, char **argv) {
-	agi::dispatch::Init([](agi::dispatch::Thunk f) { });
+	agi::dispatch::Init();
 	std::locale::global(boost::locale::generator().generate(""));
 
 	int retval;
@@ -16,6 +16,7 @@
 
 #include <main.h>
 
+#include <libaegisub/audio/peaks.h>
 #include <libaegisub/audio/provider.h>
 #include <libaegisub/fs.h>
 #include <libaegisub/make_unique.h>
@@ -23,6 +24,7 @@
 #include <libaegisub/util.h>
 
 #include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
 
 namespace bfs = boost::filesystem;
 
@@ -228,6 +230,167 @@ TEST(lagi_audio, hd_cache) {
 		ASSERT_EQ(static_cast<uint16_t>((1 << 22) - 256 + i), buff[i]);
 }
 
+TEST(lagi_audio, persistent_hd_cache) {
+	agi::fs::path dir("data/audiocache");
+	bfs::remove_all(dir);
+
+	{
+		auto provider = agi::CreatePersistentHDAudioProvider(agi::make_unique<TestAudioProvider<>>(2), dir, "key");
+		while (provider->GetDecodedSamples() != provider->GetNumSamples()) agi::util::sleep_for(0);
+	}
+
+	// The second source gives different data, so the audio has to come from the cache
+	auto source = agi::make_unique<TestAudioProvider<>>(2);
+	source->bias = 5;
+	auto provider = agi::CreatePersistentHDAudioProvider(std::move(source), dir, "key");
+	ASSERT_EQ(provider->GetNumSamples(), provider->GetDecodedSamples());
+	ASSERT_NE(nullptr, provider->GetPeaks());
+	EXPECT_EQ(provider->GetNumSamples(), provider->GetPeaks()->GetReadySamples());
+
+	uint16_t buff[512];
+	provider->GetAudio(buff, 48000 - 256, 512);
+	for (size_t i = 0; i < 512; ++i)
+		ASSERT_EQ(static_cast<uint16_t>(48000 - 256 + i), buff[i]);
+}
+
+TEST(lagi_audio, persistent_hd_cache_keyed_on_format) {
+	agi::fs::path dir("data/audiocache");
+	bfs::remove_all(dir);
+
+	{
+		auto provider = agi::CreatePersistentHDAudioProvider(agi::make_unique<TestAudioProvider<>>(2), dir, "key");
+		while (provider->GetDecodedSamples() != provider->GetNumSamples()) agi::util::sleep_for(0);
+	}
+
+	auto source = agi::make_unique<TestAudioProvider<>>(3);
+	source->bias = 5;
+	auto provider = agi::CreatePersistentHDAudioProvider(std::move(source), dir, "key");
+	while (provider->GetDecodedSamples() != provider->GetNumSamples()) agi::util::sleep_for(0);
+
+	uint16_t buff[16];
+	provider->GetAudio(buff, 0, 16);
+	for (size_t i = 0; i < 16; ++i)
+		ASSERT_EQ(static_cast<uint16_t>(i + 5), buff[i]);
+}
+
+TEST(lagi_audio, persistent_hd_cache_rebuilds_peaks) {
+	agi::fs::path dir("data/audiocache");
+	bfs::remove_all(dir);
+
+	{
+		auto provider = agi::CreatePersistentHDAudioProvider(agi::make_unique<TestAudioProvider<>>(2), dir, "key");
+		while (provider->GetDecodedSamples() != provider->GetNumSamples()) agi::util::sleep_for(0);
+	}
+	for (bfs::directory_iterator it(dir), end; it != end; ++it) {
+		if (it->path().extension() == ".peaks")
+			bfs::remove(it->path());
+	}
+
+	auto provider = agi::CreatePersistentHDAudioProvider(agi::make_unique<TestAudioProvider<>>(2), dir, "key");
+	auto peaks = provider->GetPeaks();
+	ASSERT_NE(nullptr, peaks);
+
+	// Read while the peaks are being rebuilt in the background
+	uint16_t buff[512];
+	while (peaks->GetReadySamples() != provider->GetNumSamples()) {
+		provider->GetAudio(buff, 48000 - 256, 512);
+		for (size_t i = 0; i < 512; ++i)
+			ASSERT_EQ(static_cast<uint16_t>(48000 - 256 + i), buff[i]);
+	}
+
+	agi::AudioPeak peak;
+	EXPECT_TRUE(peaks->GetPeak(0, 0, provider->GetNumSamples(), peak));
+}
+
+TEST(lagi_audio, persistent_hd_cache_bad_directory) {
+	agi::fs::path file("data/audiocache_not_a_dir");
+	bfs::remove_all(file);
+	bfs::ofstream(file) << "x";
+
+	EXPECT_THROW(agi::CreatePersistentHDAudioProvider(agi::make_unique<TestAudioProvider<>>(2), file/"cache", "key"),
+		agi::AudioProviderError);
+}
+
+TEST(lagi_audio, peak_pyramid) {
+	std::vector<int16_t> samples(100000);
+	for (size_t i = 0; i < samples.size(); ++i)
+		samples[i] = (int16_t)((i * 7919) % 65536 - 32768) / (1 + (int)(i / 10000));
+
+	agi::AudioPeakPyramid peaks(samples.size());
+	peaks.Append(samples.data(), 30000);
+	EXPECT_EQ(29696, peaks.GetReadySamples());
+	peaks.Append(samples.data() + 30000, samples.size() - 30000);
+	EXPECT_EQ(100000, peaks.GetReadySamples());
+
+	EXPECT_EQ(-1, peaks.GetLevel(511));
+	EXPECT_EQ(0, peaks.GetLevel(512));
+	EXPECT_EQ(3, peaks.GetLevel(5000));
+
+	for (int level = 0; level < 5; ++level) {
+		int64_t block = 512 << level;
+		for (int64_t start = 0; start < 100000; start += 3 * block) {
+			agi::AudioPeak peak;
+			ASSERT_TRUE(peaks.GetPeak(level, start, start + 3 * block, peak));
+
+			int16_t min = 0, max = 0;
+			for (int64_t i = start; i < std::min<int64_t>(start + 3 * block, 100000); ++i) {
+				min = std::min(min, samples[i]);
+				max = std::max(max, samples[i]);
+			}
+			ASSERT_EQ(min, peak.min);
+			ASSERT_EQ(max, peak.max);
+		}
+	}
+}
+
+TEST(lagi_audio, peak_pyramid_incomplete) {
+	std::vector<int16_t> samples(4096, 1000);
+	agi::AudioPeakPyramid peaks(8192);
+	peaks.Append(samples.data(), samples.size());
+
+	agi::AudioPeak peak;
+	EXPECT_TRUE(peaks.GetPeak(1, 0, 4096, peak));
+	EXPECT_EQ(1000, peak.max);
+	EXPECT_EQ(1000, peak.avg_max);
+	EXPECT_EQ(0, peak.min);
+	EXPECT_FALSE(peaks.GetPeak(1, 0, 5000, peak));
+	EXPECT_TRUE(peaks.GetPeak(3, 0, 4096, peak));
+	EXPECT_FALSE(peaks.GetPeak(4, 0, 8192, peak));
+}
+
+TEST(lagi_audio, peak_pyramid_save) {
+	std::vector<int16_t> samples(10000);
+	for (size_t i = 0; i < samples.size(); ++i)
+		samples[i] = (int16_t)(i * 3);
+
+	agi::AudioPeakPyramid peaks(samples.size());
+	peaks.Append(samples.data(), samples.size());
+	ASSERT_NO_THROW(peaks.Save("data/audio.peaks"));
+
+	EXPECT_EQ(nullptr, agi::AudioPeakPyramid::Load("data/audio.peaks", 10001));
+	auto loaded = agi::AudioPeakPyramid::Load("data/audio.peaks", 10000);
+	ASSERT_NE(nullptr, loaded);
+	EXPECT_EQ(10000, loaded->GetReadySamples());
+
+	agi::AudioPeak a, b;
+	for (int level = 0; level < 5; ++level) {
+		ASSERT_TRUE(peaks.GetPeak(level, 0, 10000, a));
+		ASSERT_TRUE(loaded->GetPeak(level, 0, 10000, b));
+		EXPECT_EQ(a.max, b.max);
+		EXPECT_EQ(a.avg_max, b.avg_max);
+	}
+}
+
+TEST(lagi_audio, ram_cache_peaks) {
+	auto provider = agi::CreateRAMAudioProvider(agi::make_unique<TestAudioProvider<>>(2));
+	ASSERT_NE(nullptr, provider->GetPeaks());
+	while (provider->GetPeaks()->GetReadySamples() != provider->GetNumSamples()) agi::util::sleep_for(0);
+
+	agi::AudioPeak peak;
+	ASSERT_TRUE(provider->GetPeaks()->GetPeak(0, 0, 512, peak));
+	EXPECT_EQ(511, peak.max);
+}
+
 TEST(lagi_audio, convert_8bit) {
 	auto provider = agi::CreateConvertAudioProvider(agi::make_unique<TestAudioProvider<uint8_t>>());
 
@@ -253,6 +416,37 @@ TEST(lagi_audio, convert_32bit) {
 	EXPECT_EQ(SHRT_MAX, sample);
 }
 
+TEST(lagi_audio, convert_24bit) {
+	struct AudioProvider : agi::AudioProvider {
+		AudioProvider() {
+			channels = 1;
+			num_samples = 1 << 16;
+			decoded_samples = num_samples;
+			sample_rate = 48000;
+			bytes_per_sample = 3;
+			float_samples = false;
+		}
+
+		void FillBuffer(void *buf, int64_t start, int64_t count) const override {
+			auto out = static_cast<uint8_t *>(buf);
+			for (int64_t end = start + count; start < end; ++start) {
+				int32_t sample = static_cast<int32_t>(start + SHRT_MIN) * 256 + 0x7F;
+				*out++ = sample & 0xFF;
+				*out++ = (sample >> 8) & 0xFF;
+				*out++ = (sample >> 16) & 0xFF;
+			}
+		}
+	};
+
+	auto provider = agi::CreateConvertAudioProvider(agi::make_unique<AudioProvider>());
+	EXPECT_EQ(2, provider->GetBytesPerSample());
+
+	int16_t samples[1 << 16];
+	provider->GetAudio(samples, 0, 1 << 16);
+	for (int i = 0; i < (1 << 16); ++i)
+		ASSERT_EQ(i + SHRT_MIN, samples[i]);
+}
+
 TEST(lagi_audio, sample_doubling) {
 	struct AudioProvider : agi::AudioProvider {
 		AudioProvider() {
@@ -318,6 +512,35 @@ TEST(lagi_audio, stereo_downmix) {
 		EXPECT_EQ(i, samples[i]);
 }
 
+TEST(lagi_audio, surround_downmix) {
+	struct AudioProvider : agi::AudioProvider {
+		AudioProvider() {
+			channels = 6;
+			num_samples = 1000;
+			decoded_samples = num_samples;
+			sample_rate = 48000;
+			bytes_per_sample = 2;
+			float_samples = false;
+		}
+
+		void FillBuffer(void *buf, int64_t start, int64_t count) const override {
+			auto out = static_cast<int16_t *>(buf);
+			for (int64_t end = start + count; start < end; ++start) {
+				for (int c = 0; c < 6; ++c)
+					*out++ = (int16_t)(c == 0 ? -start : 0);
+			}
+		}
+	};
+
+	auto provider = agi::CreateConvertAudioProvider(agi::make_unique<AudioProvider>());
+	EXPECT_EQ(1, provider->GetChannels());
+
+	int16_t samples[1000];
+	provider->GetAudio(samples, 0, 1000);
+	for (int i = 0; i < 1000; ++i)
+		ASSERT_EQ(-i / 6, samples[i]);
+}
+
 template<typename Float>
 struct FloatAudioProvider : agi::AudioProvider {
 	FloatAudioProvider() {
@@ -358,6 +581,32 @@ TEST(lagi_audio, double_conversion) {
 		ASSERT_EQ(i + SHRT_MIN, samples[i]);
 }
 
+TEST(lagi_audio, float_saturation) {
+	struct AudioProvider : agi::AudioProvider {
+		AudioProvider() {
+			channels = 1;
+			num_samples = 100;
+			decoded_samples = num_samples;
+			sample_rate = 48000;
+			bytes_per_sample = sizeof(float);
+			float_samples = true;
+		}
+
+		void FillBuffer(void *buf, int64_t start, int64_t count) const override {
+			auto out = static_cast<float *>(buf);
+			for (int64_t end = start + count; start < end; ++start)
+				*out++ = start & 1 ? 2.f : -2.f;
+		}
+	};
+
+	auto provider = agi::CreateConvertAudioProvider(agi::make_unique<AudioProvider>());
+
+	int16_t samples[100];
+	provider->GetAudio(samples, 0, 100);
+	for (int i = 0; i < 100; ++i)
+		ASSERT_EQ(i & 1 ? SHRT_MAX : SHRT_MIN, samples[i]);
+}
+
 TEST(lagi_audio, pcm_simple) {
 	auto path = agi::Path().Decode("?temp/pcm_simple");
 	{
@@ -0,0 +1,118 @@
+// Copyright (c) 2026, agent <agent@local>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include <libaegisub/dispatch.h>
+
+#include <main.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+class lagi_dispatch : public libagi { };
+
+TEST(lagi_dispatch, background_sync) {
+	bool ran = false;
+	auto caller = std::this_thread::get_id();
+	std::thread::id runner;
+	agi::dispatch::Background().Sync([&] {
+		ran = true;
+		runner = std::this_thread::get_id();
+	});
+	EXPECT_TRUE(ran);
+	EXPECT_NE(caller, runner);
+}
+
+TEST(lagi_dispatch, background_async_runs_everything) {
+	std::atomic<int> count(0);
+	for (int i = 0; i < 1000; ++i)
+		agi::dispatch::Background().Async([&] { ++count; });
+
+	for (int i = 0; i < 1000 && count < 1000; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	EXPECT_EQ(1000, count);
+}
+
+TEST(lagi_dispatch, nested_background_work) {
+	std::atomic<int> count(0);
+	agi::dispatch::Background().Sync([&] {
+		for (int i = 0; i < 100; ++i)
+			agi::dispatch::Background().Async([&] { ++count; });
+	});
+
+	for (int i = 0; i < 1000 && count < 100; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	EXPECT_EQ(100, count);
+}
+
+TEST(lagi_dispatch, serial_queue_preserves_order) {
+	auto queue = agi::dispatch::Create();
+	std::vector<int> values;
+	std::atomic<int> running(0);
+	bool overlapped = false;
+	for (int i = 0; i < 500; ++i) {
+		queue->Async([&, i] {
+			if (++running != 1) overlapped = true;
+			values.push_back(i);
+			--running;
+		});
+	}
+	queue->Sync([] { });
+
+	ASSERT_EQ(500u, values.size());
+	for (int i = 0; i < 500; ++i)
+		EXPECT_EQ(i, values[i]);
+	EXPECT_FALSE(overlapped);
+}
+
+TEST(lagi_dispatch, sync_rethrows) {
+	auto queue = agi::dispatch::Create();
+	EXPECT_THROW(queue->Sync([] { throw 5; }), int);
+	EXPECT_THROW(agi::dispatch::Background().Sync([] { throw 5; }), int);
+}
+
+TEST(lagi_dispatch, main_sync_from_main_thread) {
+	bool ran = false;
+	agi::dispatch::Main().Sync([&] { ran = true; });
+	EXPECT_TRUE(ran);
+}
+
+TEST(lagi_dispatch, main_queue_pump) {
+	bool ran = false;
+	agi::dispatch::Background().Async([&] {
+		agi::dispatch::Main().Async([&] { ran = true; });
+	});
+
+	for (int i = 0; i < 100 && !ran; ++i)
+		agi::dispatch::ProcessMainQueue(std::chrono::milliseconds(50));
+	EXPECT_TRUE(ran);
+}
+
+TEST(lagi_dispatch, async_exceptions_go_to_main) {
+	agi::dispatch::Background().Async([] { throw 5; });
+
+	bool thrown = false;
+	for (int i = 0; i < 100 && !thrown; ++i) {
+		try {
+			agi::dispatch::ProcessMainQueue(std::chrono::milliseconds(50));
+		}
+		catch (int e) {
+			EXPECT_EQ(5, e);
+			thrown = true;
+		}
+	}
+	EXPECT_TRUE(thrown);
+}
@@ -0,0 +1,134 @@
+// Copyright (c) 2026, agent <agent@local>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include <libaegisub/exception.h>
+#include <libaegisub/log.h>
+#include <libaegisub/make_unique.h>
+
+#include <main.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+struct CountingEmitter final : agi::log::Emitter {
+	std::atomic<int> *count;
+	CountingEmitter(std::atomic<int> *count) : count(count) { }
+	void log(agi::log::SinkMessage const&) override { ++*count; }
+};
+
+/// Counts how many times the message was actually formatted
+struct Probe {
+	int *formatted;
+};
+std::ostream& operator<<(std::ostream& os, Probe p) {
+	++*p.formatted;
+	return os;
+}
+}
+
+class lagi_log : public libagi {
+protected:
+	void TearDown() override {
+		agi::log::SetLevel(agi::log::Debug);
+		agi::log::ClearSectionLevels();
+	}
+};
+
+TEST_F(lagi_log, disabled_messages_are_not_formatted) {
+	int formatted = 0;
+	agi::log::SetLevel(agi::log::Warning);
+	LOG_D("test/log") << Probe{&formatted};
+	LOG_I("test/log") << Probe{&formatted};
+	EXPECT_EQ(0, formatted);
+	LOG_W("test/log") << Probe{&formatted};
+	EXPECT_EQ(1, formatted);
+}
+
+TEST_F(lagi_log, section_levels) {
+	agi::log::SetLevel(agi::log::Warning);
+	agi::log::SetSectionLevel("video", agi::log::Debug);
+	agi::log::SetSectionLevel("video/noisy", agi::log::Exception);
+
+	EXPECT_TRUE(agi::log::Enabled("video", agi::log::Debug));
+	EXPECT_TRUE(agi::log::Enabled("video/open", agi::log::Debug));
+	EXPECT_FALSE(agi::log::Enabled("videos", agi::log::Debug));
+	EXPECT_FALSE(agi::log::Enabled("audio", agi::log::Info));
+	EXPECT_TRUE(agi::log::Enabled("audio", agi::log::Warning));
+	EXPECT_FALSE(agi::log::Enabled("video/noisy/thing", agi::log::Warning));
+	EXPECT_TRUE(agi::log::Enabled("video/noisy/thing", agi::log::Exception));
+
+	agi::log::ClearSectionLevels();
+	EXPECT_FALSE(agi::log::Enabled("video", agi::log::Debug));
+}
+
+TEST_F(lagi_log, set_levels_from_string) {
+	agi::log::SetLevels(" warning, video = Debug ,video/noisy=exception");
+	EXPECT_FALSE(agi::log::Enabled("audio", agi::log::Info));
+	EXPECT_TRUE(agi::log::Enabled("audio", agi::log::Warning));
+	EXPECT_TRUE(agi::log::Enabled("video/open", agi::log::Debug));
+	EXPECT_FALSE(agi::log::Enabled("video/noisy", agi::log::Assert));
+	EXPECT_TRUE(agi::log::Enabled("video/noisy", agi::log::Exception));
+
+	// Replaces rather than adds to the existing levels
+	agi::log::SetLevels("audio=info");
+	EXPECT_TRUE(agi::log::Enabled("video", agi::log::Debug));
+	EXPECT_FALSE(agi::log::Enabled("audio/open", agi::log::Debug));
+	EXPECT_TRUE(agi::log::Enabled("audio/open", agi::log::Info));
+
+	agi::log::SetLevels("");
+	EXPECT_TRUE(agi::log::Enabled("audio/open", agi::log::Debug));
+}
+
+TEST_F(lagi_log, set_levels_rejects_bad_input) {
+	agi::log::SetLevels("warning");
+	EXPECT_THROW(agi::log::SetLevels("verbose"), agi::InvalidInputException);
+	EXPECT_THROW(agi::log::SetLevels("debug,video=loud"), agi::InvalidInputException);
+	EXPECT_THROW(agi::log::SetLevels("=info"), agi::InvalidInputException);
+
+	// Levels are unchanged by a string which fails to parse
+	EXPECT_FALSE(agi::log::Enabled("video", agi::log::Info));
+	EXPECT_TRUE(agi::log::Enabled("video", agi::log::Warning));
+}
+
+TEST_F(lagi_log, messages_from_many_threads) {
+	std::atomic<int> count(0);
+	agi::log::LogSink sink;
+	sink.Subscribe(agi::make_unique<CountingEmitter>(&count));
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 4; ++i) {
+		threads.emplace_back([&] {
+			for (int j = 0; j < 500; ++j) {
+				agi::log::SinkMessage sm;
+				sm.section = "test/log";
+				sm.severity = agi::log::Debug;
+				sm.file = __FILE__;
+				sm.func = __FUNCTION__;
+				sm.line = __LINE__;
+				sm.time = 0;
+				sink.Log(sm);
+			}
+		});
+	}
+	for (auto& thread : threads) thread.join();
+	sink.Flush();
+
+	// The subscription message also goes to the global sink, not this one
+	EXPECT_EQ(2000, count);
+	EXPECT_EQ(250u, sink.GetMessages().size());
+}
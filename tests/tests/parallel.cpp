@@ -0,0 +1,93 @@
+// Copyright (c) 2026, agent <agent@local>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include <libaegisub/dispatch.h>
+#include <libaegisub/parallel.h>
+
+#include <main.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+class lagi_parallel : public libagi { };
+
+TEST(lagi_parallel, chunk_count) {
+	EXPECT_EQ(1u, agi::parallel::ChunkCount(0, 100));
+	EXPECT_EQ(1u, agi::parallel::ChunkCount(150, 100));
+	EXPECT_EQ(1u, agi::parallel::ChunkCount(10, 0));
+	EXPECT_EQ(agi::parallel::Concurrency(), agi::parallel::ChunkCount(1000000, 1));
+}
+
+TEST(lagi_parallel, empty) {
+	bool called = false;
+	agi::parallel::ForChunks(0, 4, [&](size_t, size_t, size_t) { called = true; });
+	agi::parallel::For(0, [&](size_t) { called = true; });
+	EXPECT_FALSE(called);
+}
+
+TEST(lagi_parallel, chunks_cover_range_once) {
+	std::vector<std::atomic<int>> seen(1003);
+	for (auto& s : seen) s = 0;
+	std::vector<int> chunk_seen(7);
+
+	agi::parallel::ForChunks(seen.size(), 7, [&](size_t chunk, size_t begin, size_t end) {
+		EXPECT_EQ(seen.size() * chunk / 7, begin);
+		EXPECT_EQ(seen.size() * (chunk + 1) / 7, end);
+		++chunk_seen[chunk];
+		for (size_t i = begin; i < end; ++i)
+			++seen[i];
+	});
+
+	for (auto& s : seen)
+		EXPECT_EQ(1, s);
+	for (int c : chunk_seen)
+		EXPECT_EQ(1, c);
+}
+
+TEST(lagi_parallel, for_each_item) {
+	std::vector<std::atomic<int>> seen(100);
+	for (auto& s : seen) s = 0;
+	agi::parallel::For(seen.size(), [&](size_t i) { ++seen[i]; });
+	for (auto& s : seen)
+		EXPECT_EQ(1, s);
+}
+
+TEST(lagi_parallel, rethrows_first_failing_chunk) {
+	std::atomic<int> ran(0);
+	try {
+		agi::parallel::ForChunks(100, 10, [&](size_t chunk, size_t, size_t) {
+			++ran;
+			if (chunk == 3 || chunk == 8)
+				throw std::runtime_error(std::to_string(chunk));
+		});
+		FAIL() << "Exception was not rethrown";
+	}
+	catch (std::runtime_error const& e) {
+		EXPECT_STREQ("3", e.what());
+	}
+	EXPECT_EQ(10, ran);
+}
+
+TEST(lagi_parallel, nested_in_background_queue) {
+	std::atomic<int> count(0);
+	agi::dispatch::Background().Sync([&] {
+		agi::parallel::For(64, [&](size_t) {
+			agi::parallel::For(64, [&](size_t) { ++count; });
+		});
+	});
+	EXPECT_EQ(64 * 64, count);
+}
@@ -145,3 +145,62 @@ TEST_F(lagi_thes, unindexed_word) {
 	ASSERT_NO_THROW(entries = thes.Lookup("Unindexed Word"));
 	EXPECT_EQ(0, entries.size());
 }
+
+TEST_F(lagi_thes, sorted_index) {
+	{
+		std::ofstream idx(idx_path.c_str(), std::ios::binary);
+		std::ofstream dat(dat_path.c_str(), std::ios::binary);
+
+		idx << "UTF-8\r\n" << 4 << "\r\n";
+		dat << "UTF-8\n";
+
+		idx << "Apple|" << dat.tellp() << "\r\n";
+		dat << "Apple|1\n(noun)|Apple|Fruit\n";
+
+		idx << "Banana|1|1\r\n";
+		idx << "Banana|" << dat.tellp() << "\r\n";
+		dat << "Banana|1\n(noun)|Banana|Plantain\n";
+
+		idx << "Cherry|" << dat.tellp();
+		dat << "Cherry|1\n(noun)|Cherry|Drupe\n";
+	}
+
+	agi::Thesaurus thes(dat_path, idx_path);
+
+	std::vector<agi::Thesaurus::Entry> entries;
+	for (auto word : {"Apple", "Banana", "Cherry"}) {
+		ASSERT_NO_THROW(entries = thes.Lookup(word));
+		ASSERT_EQ(1, entries.size());
+		EXPECT_EQ(std::string("(noun) ") + word, entries[0].first);
+	}
+
+	ASSERT_NO_THROW(entries = thes.Lookup("Apricot"));
+	EXPECT_EQ(0, entries.size());
+	ASSERT_NO_THROW(entries = thes.Lookup("Zucchini"));
+	EXPECT_EQ(0, entries.size());
+	ASSERT_NO_THROW(entries = thes.Lookup("A"));
+	EXPECT_EQ(0, entries.size());
+}
+
+TEST_F(lagi_thes, legacy_charset) {
+	{
+		std::ofstream idx(idx_path.c_str(), std::ios::binary);
+		std::ofstream dat(dat_path.c_str(), std::ios::binary);
+
+		idx << "ISO8859-1\n" << 1 << "\n";
+		dat << "ISO8859-1\n";
+
+		idx << "caf\xE9|" << dat.tellp() << "\n";
+		dat << "caf\xE9|1\n(noun)|caf\xE9|bistro\n";
+	}
+
+	agi::Thesaurus thes(dat_path, idx_path);
+
+	std::vector<agi::Thesaurus::Entry> entries;
+	ASSERT_NO_THROW(entries = thes.Lookup("caf\xC3\xA9"));
+	ASSERT_EQ(1, entries.size());
+	EXPECT_EQ("(noun) caf\xC3\xA9", entries[0].first);
+
+	ASSERT_NO_THROW(entries = thes.Lookup("\xE6\x97\xA5"));
+	EXPECT_EQ(0, entries.size());
+}
@@ -0,0 +1,113 @@
+// Copyright (c) 2026, agent <agent@local>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include <libaegisub/timing_processor.h>
+#include <libaegisub/vfr.h>
+
+#include <main.h>
+
+using namespace agi::timing;
+
+namespace {
+std::vector<Line> process(std::vector<Line> lines, Settings const& settings, std::vector<int> const& kf = {}) {
+	Process(lines, settings, kf, agi::vfr::Framerate(25));
+	return lines;
+}
+}
+
+#define EXPECT_TIMES(line, start, end) do { \
+	EXPECT_EQ(start, (int)(line).Start); \
+	EXPECT_EQ(end, (int)(line).End); \
+} while (false)
+
+TEST(lagi_timing_processor, empty) {
+	Settings s;
+	s.lead_in = s.lead_out = 100;
+	EXPECT_NO_THROW(process({}, s));
+}
+
+TEST(lagi_timing_processor, lead_in_isolated) {
+	Settings s;
+	s.lead_in = 200;
+	auto res = process({{1000, 2000}}, s);
+	EXPECT_TIMES(res[0], 800, 2000);
+}
+
+TEST(lagi_timing_processor, lead_in_stops_at_previous_line) {
+	Settings s;
+	s.lead_in = 500;
+	auto res = process({{0, 900}, {1000, 2000}, {2100, 3000}}, s);
+	EXPECT_TIMES(res[1], 900, 2000);
+	EXPECT_TIMES(res[2], 2000, 3000);
+}
+
+TEST(lagi_timing_processor, lead_in_ignores_overlapping_lines) {
+	Settings s;
+	s.lead_in = 500;
+	auto res = process({{0, 900}, {500, 5000}, {1000, 2000}}, s);
+	EXPECT_TIMES(res[1], 0, 5000);
+	EXPECT_TIMES(res[2], 900, 2000);
+}
+
+TEST(lagi_timing_processor, lead_out_stops_at_next_line) {
+	Settings s;
+	s.lead_out = 500;
+	auto res = process({{0, 900}, {1000, 2000}, {1200, 1500}, {2300, 3000}}, s);
+	EXPECT_TIMES(res[0], 0, 1000);
+	EXPECT_TIMES(res[1], 1000, 2300);
+	EXPECT_TIMES(res[2], 1200, 2000);
+	EXPECT_TIMES(res[3], 2300, 3500);
+}
+
+TEST(lagi_timing_processor, lead_out_uses_new_start_times) {
+	Settings s;
+	s.lead_in = 200;
+	s.lead_out = 500;
+	auto res = process({{0, 1000}, {1300, 2000}}, s);
+	EXPECT_TIMES(res[0], 0, 1100);
+	EXPECT_TIMES(res[1], 1100, 2500);
+}
+
+TEST(lagi_timing_processor, adjacent) {
+	Settings s;
+	s.adjacent = true;
+	s.adjacent_gap = 200;
+	s.adjacent_overlap = 100;
+	s.adjacent_bias = 0.5;
+	auto res = process({{0, 1000}, {1100, 2000}, {1950, 3000}, {3500, 4000}}, s);
+	EXPECT_TIMES(res[0], 0, 1050);
+	EXPECT_TIMES(res[1], 1050, 1970);
+	EXPECT_TIMES(res[2], 1970, 3000);
+	EXPECT_TIMES(res[3], 3500, 4000);
+}
+
+TEST(lagi_timing_processor, keyframes) {
+	Settings s;
+	s.keyframes = true;
+	s.before_start = s.after_start = s.before_end = s.after_end = 100;
+
+	// At 25 fps, lines starting or ending at 1980ms start on frame 50 and end
+	// on frame 49
+	auto res = process({{1920, 2080}, {2200, 3000}}, s, {0, 50});
+	EXPECT_TIMES(res[0], 1980, 1980);
+	EXPECT_TIMES(res[1], 2200, 3000);
+}
+
+TEST(lagi_timing_processor, keyframes_with_no_keyframes) {
+	Settings s;
+	s.keyframes = true;
+	s.before_start = s.after_start = s.before_end = s.after_end = 100;
+	auto res = process({{1920, 2080}}, s);
+	EXPECT_TIMES(res[0], 1920, 2080);
+}
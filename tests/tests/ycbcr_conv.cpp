@@ -0,0 +1,72 @@
+// Copyright (c) 2026, agent <agent@local>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include <libaegisub/ycbcr_conv.h>
+
+#include <main.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+class lagi_ycbcr : public libagi { };
+
+TEST(lagi_ycbcr, bgra_row_matches_ycbcr_to_rgb) {
+	agi::ycbcr_converter conv(agi::ycbcr_matrix::bt601, agi::ycbcr_range::tv);
+
+	// Odd width so that both the vectorized body and the tail get used
+	const size_t width = 517;
+	std::vector<uint8_t> y(width), u(width / 2 + 1), v(width / 2 + 1), dst(width * 4, 0xFF);
+
+	for (int luma = 0; luma < 256; luma += 5) {
+		for (size_t i = 0; i < width; ++i)
+			y[i] = static_cast<uint8_t>(luma + i);
+		for (size_t i = 0; i < u.size(); ++i) {
+			u[i] = static_cast<uint8_t>(i * 3);
+			v[i] = static_cast<uint8_t>(255 - i * 7);
+		}
+
+		conv.ycbcr_to_bgra_row(y.data(), u.data(), v.data(), dst.data(), width);
+
+		for (size_t i = 0; i < width; ++i) {
+			auto rgb = conv.ycbcr_to_rgb({{y[i], u[i / 2], v[i / 2]}});
+			EXPECT_GE(1, std::abs(rgb[0] - dst[i * 4 + 2]));
+			EXPECT_GE(1, std::abs(rgb[1] - dst[i * 4 + 1]));
+			EXPECT_GE(1, std::abs(rgb[2] - dst[i * 4 + 0]));
+			EXPECT_EQ(0, dst[i * 4 + 3]);
+		}
+	}
+}
+
+TEST(lagi_ycbcr, bgra_row_clamps) {
+	agi::ycbcr_converter conv(agi::ycbcr_matrix::bt709, agi::ycbcr_range::tv);
+
+	std::vector<uint8_t> y(32, 255), u(16, 255), v(16, 255), dst(32 * 4);
+	conv.ycbcr_to_bgra_row(y.data(), u.data(), v.data(), dst.data(), 32);
+	for (size_t i = 0; i < 32; ++i) {
+		EXPECT_EQ(255, dst[i * 4 + 0]);
+		EXPECT_EQ(255, dst[i * 4 + 2]);
+	}
+
+	std::fill(begin(y), end(y), 0);
+	std::fill(begin(u), end(u), 0);
+	std::fill(begin(v), end(v), 0);
+	conv.ycbcr_to_bgra_row(y.data(), u.data(), v.data(), dst.data(), 32);
+	for (size_t i = 0; i < 32; ++i) {
+		EXPECT_EQ(0, dst[i * 4 + 0]);
+		EXPECT_EQ(0, dst[i * 4 + 2]);
+	}
+}
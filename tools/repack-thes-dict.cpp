@@ -83,7 +83,7 @@ int main(int argc, char *argv[]) {
 		printf("usage: respack-thes-dict <path-to-dict-without-extension>\n");
 		return 1;
 	}
-	agi::dispatch::Init([](agi::dispatch::Thunk f) { });
+	agi::dispatch::Init();
 	std::locale::global(boost::locale::generator().generate(""));
 	agi::log::log = new agi::log::LogSink;
 